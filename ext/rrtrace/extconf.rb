@@ -10,6 +10,10 @@ require_relative "rust_build_helper"
 # selectively, or entirely remove this flag.
 append_cflags("-fvisibility=hidden")
 
+# Postponed jobs that can be triggered from a native thread exist since
+# Ruby 3.3; without them the sampler skips GC and VM statistics.
+have_func("rb_postponed_job_preregister", "ruby/debug.h")
+
 root_dir = File.expand_path("../../", __dir__)
 RustBuildHelper.build(root_dir)
 
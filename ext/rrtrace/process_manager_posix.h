@@ -34,6 +34,11 @@ static inline void terminate_process(process_id pid) {
     waitpid(pid, NULL, 0);
 }
 
+static inline void wait_process(process_id pid) {
+    if (pid == 0) return;
+    waitpid(pid, NULL, 0);
+}
+
 static inline void close_process(process_id pid) {
     (void)pid;
 }
@@ -46,6 +46,11 @@ static inline void terminate_process(process_id pid) {
     TerminateProcess(pid, 1);
 }
 
+static inline void wait_process(process_id pid) {
+    if (pid == NULL) return;
+    WaitForSingleObject(pid, INFINITE);
+}
+
 static inline void close_process(process_id pid) {
     if (pid == NULL) return;
     CloseHandle(pid);
@@ -1,11 +1,16 @@
 #include "rrtrace.h"
-#include "rrtrace_event_ringbuffer.h"
+#include "rrtrace_method_table.h"
+#include "rrtrace_name_table.h"
+#include "rrtrace_profile.h"
+#include "rrtrace_shared_region.h"
 
 #if defined(_WIN32) || defined(__MINGW32__) || defined(__MINGW64__)
 #include "process_manager_windows.h"
+#include "sampler_windows.h"
 #include "shared_memory_windows.h"
 #else
 #include "process_manager_posix.h"
+#include "sampler_posix.h"
 #include "shared_memory_posix.h"
 #endif
 
@@ -17,11 +22,55 @@
 
 typedef struct {
   uint32_t thread_id;
+  uint32_t context_id;
+  // Nesting depth of Rrtrace.trace blocks, and the change requested by the
+  // latest enter/exit, applied at the return of that native method.
+  int trace_depth;
+  int pending_trace_depth;
+  // Set while the thread is inside Rrtrace.self_time.
+  RRTraceProfile *profile;
 } ThreadData;
 
+#define MAX_SAMPLED_THREADS 256
+
+typedef struct {
+  uint64_t thread;
+  uint64_t cpu_ns;
+  double usage;
+  uint32_t name_key;
+  int seen;
+  int has_usage;
+} SampledThread;
+
+// Periodic runtime metrics, emitted as counters. Process memory and thread
+// CPU time are read on a native thread without the GVL; GC and VM stats need
+// the GVL and are read by a postponed job the sampler thread triggers.
+typedef struct {
+  uint32_t interval_ms;
+  int active;
+  atomic_int running;
+  sampler_thread thread;
+  process_stats stats;
+  uint64_t elapsed_ns;
+  SampledThread threads[MAX_SAMPLED_THREADS];
+#ifdef HAVE_RB_POSTPONED_JOB_PREREGISTER
+  rb_postponed_job_handle_t vm_job;
+#endif
+  size_t constant_cache_invalidations;
+  int has_constant_cache_invalidations;
+  uint32_t resident_key;
+  uint32_t virtual_key;
+  uint32_t heap_live_slots_key;
+  uint32_t heap_free_slots_key;
+  uint32_t heap_pages_key;
+  uint32_t malloc_increase_key;
+  uint32_t constant_cache_invalidations_key;
+} Sampler;
+
 typedef struct {
   shared_memory_handle shared_memory;
   RRTraceEventRingBuffer *event_ringbuffer;
+  RRTraceMetadataRingBuffer *metadata_ringbuffer;
   process_id visualizer_process_id;
   rb_internal_thread_event_hook_t *thread_start_hook;
   rb_internal_thread_event_hook_t *thread_ready_hook;
@@ -35,6 +84,29 @@ typedef struct {
   rb_internal_thread_specific_key_t thread_data_key;
   atomic_uint_fast32_t next_thread_id;
   atomic_flag event_ringbuffer_lock;
+  atomic_flag metadata_ringbuffer_lock;
+  RRTraceMethodTable method_table;
+  VALUE method_table_holder;
+  RRTraceNameTable name_table;
+  atomic_flag name_table_lock;
+  Sampler sampler;
+  // Record calls only on threads inside Rrtrace.trace.
+  int selective;
+  // Whether Rrtrace.trace defers its depth change to the C return of the
+  // native enter/exit, which is only seen when C calls are traced.
+  int defer_trace_depth;
+  // Number of threads with a profile, so the hooks skip the lookup when 0.
+  int profiling;
+  // Session options, see Rrtrace::Options.
+  uint32_t output_mode;
+  int drop_when_full;
+  uint64_t dropped_events;
+  // Methods matching the filters are decided once, when they are interned;
+  // the hooks then look the decision up by method key.
+  VALUE include_filter;
+  VALUE exclude_filter;
+  uint8_t *method_excluded;
+  size_t method_excluded_capacity;
   int started;
 #ifdef RRTRACE_WRITE_DEBUG_LOG
   FILE *log;
@@ -46,6 +118,10 @@ static inline void push_event(TraceContext *context, RRTraceEvent event) {
   while (atomic_flag_test_and_set_explicit(&context->event_ringbuffer_lock, memory_order_acquire)) {
   }
   while (!rrtrace_event_ringbuffer_push(context->event_ringbuffer, event)) {
+    if (context->drop_when_full) {
+      context->dropped_events++;
+      break;
+    }
     if (!is_process_running(context->visualizer_process_id)) {
       context->event_ringbuffer = NULL;
       break;
@@ -54,21 +130,170 @@ static inline void push_event(TraceContext *context, RRTraceEvent event) {
   atomic_flag_clear_explicit(&context->event_ringbuffer_lock, memory_order_release);
 }
 
-static uint32_t get_thread_id(TraceContext *context, VALUE thread) {
+static void push_metadata(TraceContext *context, uint32_t kind, uint32_t key, const void *payload, size_t length) {
+  if (context->metadata_ringbuffer == NULL) return;
+  while (atomic_flag_test_and_set_explicit(&context->metadata_ringbuffer_lock, memory_order_acquire)) {
+  }
+  while (!rrtrace_metadata_ringbuffer_push(context->metadata_ringbuffer, kind, key, payload, length)) {
+    if (!is_process_running(context->visualizer_process_id)) {
+      context->metadata_ringbuffer = NULL;
+      break;
+    }
+  }
+  atomic_flag_clear_explicit(&context->metadata_ringbuffer_lock, memory_order_release);
+}
+
+static ThreadData *get_thread_data(TraceContext *context, VALUE thread) {
   ThreadData *data = rb_internal_thread_specific_get(thread, context->thread_data_key);
   if (data == NULL) {
     data = malloc(sizeof(ThreadData));
     data->thread_id = atomic_fetch_add_explicit(&context->next_thread_id, 1, memory_order_relaxed);
+    data->context_id = 0;
+    data->trace_depth = 0;
+    data->pending_trace_depth = 0;
+    data->profile = NULL;
     rb_internal_thread_specific_set(thread, context->thread_data_key, data);
   }
-  return data->thread_id;
+  return data;
+}
+
+static uint32_t get_thread_id(TraceContext *context, VALUE thread) {
+  return get_thread_data(context, thread)->thread_id;
+}
+
+static void append_class_path(VALUE str, VALUE klass) {
+  if (RB_TYPE_P(klass, T_CLASS) && RB_FL_TEST(klass, RUBY_FL_SINGLETON)) {
+    VALUE attached = rb_funcall(klass, rb_intern("attached_object"), 0);
+    if (RB_TYPE_P(attached, T_CLASS) || RB_TYPE_P(attached, T_MODULE)) {
+      rb_str_cat_cstr(str, "#<Class:");
+      rb_str_append(str, rb_class_path(attached));
+      rb_str_cat_cstr(str, ">");
+    } else {
+      rb_str_append(str, rb_class_path(klass));
+    }
+  } else if (RB_TYPE_P(klass, T_CLASS) || RB_TYPE_P(klass, T_MODULE)) {
+    rb_str_append(str, rb_class_path(klass));
+  }
+}
+
+// The method record payload is "<class path>\0<method name>\0<source path>".
+// The visualizer derives display names and palette categories from it.
+static void publish_method(TraceContext *context, uint32_t key, VALUE klass, ID method_id, struct rb_trace_arg_struct *tracearg) {
+  VALUE payload = rb_str_buf_new(64);
+  append_class_path(payload, klass);
+  rb_str_buf_cat(payload, "", 1);
+  VALUE method_name = method_id ? rb_id2str(method_id) : Qfalse;
+  if (RTEST(method_name)) rb_str_append(payload, method_name);
+  rb_str_buf_cat(payload, "", 1);
+  if (rb_tracearg_event_flag(tracearg) & RUBY_EVENT_CALL) {
+    VALUE path = rb_tracearg_path(tracearg);
+    if (RB_TYPE_P(path, T_STRING)) rb_str_append(payload, path);
+  }
+  push_metadata(context, METADATA_KIND_METHOD, key, RSTRING_PTR(payload), RSTRING_LEN(payload));
+  RB_GC_GUARD(payload);
+}
+
+static int filtering(TraceContext *context) {
+  return !NIL_P(context->include_filter) || !NIL_P(context->exclude_filter);
+}
+
+// Matches "Class#method" against the filters. Regexp#match? leaves $~ of
+// the traced code alone.
+static void filter_method(TraceContext *context, uint32_t key, VALUE klass, ID method_id) {
+  if (key >= context->method_excluded_capacity) {
+    size_t capacity = context->method_excluded_capacity ? context->method_excluded_capacity : 1024;
+    while (key >= capacity) capacity *= 2;
+    context->method_excluded = realloc(context->method_excluded, capacity);
+    memset(context->method_excluded + context->method_excluded_capacity, 0, capacity - context->method_excluded_capacity);
+    context->method_excluded_capacity = capacity;
+  }
+  VALUE name = rb_str_buf_new(64);
+  append_class_path(name, klass);
+  rb_str_cat_cstr(name, "#");
+  VALUE method_name = method_id ? rb_id2str(method_id) : Qfalse;
+  if (RTEST(method_name)) rb_str_append(name, method_name);
+  int excluded = 0;
+  if (!NIL_P(context->include_filter) && !RTEST(rb_funcall(context->include_filter, rb_intern("match?"), 1, name))) excluded = 1;
+  if (!NIL_P(context->exclude_filter) && RTEST(rb_funcall(context->exclude_filter, rb_intern("match?"), 1, name))) excluded = 1;
+  context->method_excluded[key] = (uint8_t)excluded;
+  RB_GC_GUARD(name);
+}
+
+static inline int method_excluded(TraceContext *context, uint32_t key) {
+  return key < context->method_excluded_capacity && context->method_excluded[key];
+}
+
+static uint32_t intern_method(TraceContext *context, struct rb_trace_arg_struct *tracearg, ID *method_id_out) {
+  VALUE method_sym = rb_tracearg_method_id(tracearg);
+  ID method_id = NIL_P(method_sym) ? 0 : RB_SYM2ID(method_sym);
+  VALUE klass = rb_tracearg_defined_class(tracearg);
+  int inserted;
+  uint32_t key = rrtrace_method_table_intern(&context->method_table, klass, method_id, &inserted);
+  if (inserted) {
+    publish_method(context, key, klass, method_id, tracearg);
+    if (filtering(context)) filter_method(context, key, klass, method_id);
+  }
+  *method_id_out = method_id;
+  return key;
+}
+
+static void lock_name_table(TraceContext *context) {
+  while (atomic_flag_test_and_set_explicit(&context->name_table_lock, memory_order_acquire)) {
+  }
+}
+
+static void unlock_name_table(TraceContext *context) {
+  atomic_flag_clear_explicit(&context->name_table_lock, memory_order_release);
+}
+
+static void publish_names(TraceContext *context) {
+  lock_name_table(context);
+  for (size_t i = 0; i < context->name_table.capacity; i++) {
+    if (!rrtrace_name_table_occupied(&context->name_table, i)) continue;
+    RRTraceNameEntry *entry = &context->name_table.entries[i];
+    push_metadata(context, METADATA_KIND_NAME, entry->key, entry->name, entry->length);
+  }
+  unlock_name_table(context);
+}
+
+// In selective mode the thread's flag is checked before anything else, so
+// calls on other threads cost a lookup and a compare.
+static inline int call_traced(TraceContext *context) {
+  if (!context->selective) return 1;
+  ThreadData *data = rb_internal_thread_specific_get(rb_thread_current(), context->thread_data_key);
+  return data != NULL && data->trace_depth > 0;
+}
+
+// Applies a pending enter/exit after deciding on the return itself: the
+// return of the native enter is not recorded and the return of the native
+// exit is, matching their calls. Without C call events nothing is pending.
+static inline int return_traced(TraceContext *context) {
+  if (!context->selective) return 1;
+  ThreadData *data = rb_internal_thread_specific_get(rb_thread_current(), context->thread_data_key);
+  if (data == NULL) return 0;
+  int traced = data->trace_depth > 0;
+  data->trace_depth += data->pending_trace_depth;
+  data->pending_trace_depth = 0;
+  return traced;
+}
+
+static inline RRTraceProfile *current_profile(TraceContext *context) {
+  if (!context->profiling) return NULL;
+  ThreadData *data = rb_internal_thread_specific_get(rb_thread_current(), context->thread_data_key);
+  return data != NULL ? data->profile : NULL;
 }
 
 static void tracepoint_call_handler(VALUE tpval, void *data) {
   TraceContext *context = (TraceContext *)data;
+  if (!call_traced(context)) return;
   struct rb_trace_arg_struct *tracearg = rb_tracearg_from_tracepoint(tpval);
-  uint64_t method_id = RB_SYM2ID(rb_tracearg_method_id(tracearg));
-  push_event(context, event_call(method_id));
+  ID method_id;
+  uint32_t method_key = intern_method(context, tracearg, &method_id);
+  if (method_excluded(context, method_key)) return;
+  RRTraceEvent event = event_call(method_key);
+  push_event(context, event);
+  RRTraceProfile *profile = current_profile(context);
+  if (profile != NULL) rrtrace_profile_call(profile, method_key, event_timestamp(event));
 #ifdef RRTRACE_WRITE_DEBUG_LOG
   const char *method_name = rb_id2name(method_id);
   fprintf(context->log, "CALL: %s\n", method_name);
@@ -78,9 +303,15 @@ static void tracepoint_call_handler(VALUE tpval, void *data) {
 
 static void tracepoint_return_handler(VALUE tpval, void *data) {
   TraceContext *context = (TraceContext *)data;
+  if (!return_traced(context)) return;
   struct rb_trace_arg_struct *tracearg = rb_tracearg_from_tracepoint(tpval);
-  uint64_t method_id = RB_SYM2ID(rb_tracearg_method_id(tracearg));
-  push_event(context, event_return(method_id));
+  ID method_id;
+  uint32_t method_key = intern_method(context, tracearg, &method_id);
+  if (method_excluded(context, method_key)) return;
+  RRTraceEvent event = event_return(method_key);
+  push_event(context, event);
+  RRTraceProfile *profile = current_profile(context);
+  if (profile != NULL) rrtrace_profile_return(profile, event_timestamp(event));
 #ifdef RRTRACE_WRITE_DEBUG_LOG
   const char *method_name = rb_id2name(method_id);
   fprintf(context->log, "RETURN: %s\n", method_name);
@@ -136,10 +367,14 @@ static void thread_suspended_handler(rb_event_flag_t event, const rb_internal_th
 #endif
 }
 
+// A thread inside Rrtrace.with_context restates its context id on every
+// switch, so the visualizer also picks it up after tracing restarts.
 static void thread_resume_handler(rb_event_flag_t event, const rb_internal_thread_event_data_t *event_data, void *data) {
   TraceContext *context = (TraceContext *)data;
-  uint32_t thread_id = get_thread_id(context, event_data->thread);
+  ThreadData *thread_data = get_thread_data(context, event_data->thread);
+  uint32_t thread_id = thread_data->thread_id;
   push_event(context, event_thread_resume(thread_id));
+  if (thread_data->context_id != 0) push_event(context, event_context(thread_data->context_id));
 #ifdef RRTRACE_WRITE_DEBUG_LOG
   fprintf(context->log, "THREAD %02d RESUME\n", thread_id);
   fflush(context->log);
@@ -158,6 +393,189 @@ static void thread_exit_handler(rb_event_flag_t event, const rb_internal_thread_
 
 static TraceContext trace_context;
 
+// The sampler thread interns thread names without the GVL, so the table has
+// its own lock.
+uint32_t rrtrace_intern_name(const char *name, size_t length) {
+  TraceContext *context = &trace_context;
+  int inserted;
+  lock_name_table(context);
+  uint32_t key = rrtrace_name_table_intern(&context->name_table, name, length, &inserted);
+  if (inserted) push_metadata(context, METADATA_KIND_NAME, key, name, length);
+  unlock_name_table(context);
+  return key;
+}
+
+void rrtrace_span_begin(uint32_t name_key) {
+  push_event(&trace_context, event_span_begin(name_key));
+}
+
+void rrtrace_span_end(uint32_t name_key) {
+  push_event(&trace_context, event_span_end(name_key));
+}
+
+void rrtrace_mark(uint32_t name_key) {
+  push_event(&trace_context, event_mark(name_key));
+}
+
+void rrtrace_counter(uint32_t name_key, double value) {
+  push_event(&trace_context, event_counter(name_key, (float)value));
+}
+
+static uint32_t intern_name_cstr(const char *name) {
+  return rrtrace_intern_name(name, strlen(name));
+}
+
+// Percent of one core used by each thread since the previous sample. A
+// thread is named on its first sample and reported from the second on.
+// Usage is emitted only after all threads were read, as pushing to a full
+// ring may block and would skew the readings of the remaining threads.
+static void sample_thread_cpu(void *arg, uint64_t thread, const char *name, uint64_t cpu_ns) {
+  Sampler *sampler = (Sampler *)arg;
+  SampledThread *free_slot = NULL;
+  for (size_t i = 0; i < MAX_SAMPLED_THREADS; i++) {
+    SampledThread *sampled = &sampler->threads[i];
+    if (sampled->thread == thread) {
+      sampled->has_usage = cpu_ns >= sampled->cpu_ns;
+      if (sampled->has_usage) sampled->usage = (double)(cpu_ns - sampled->cpu_ns) * 100.0 / (double)sampler->elapsed_ns;
+      sampled->cpu_ns = cpu_ns;
+      sampled->seen = 1;
+      return;
+    }
+    if (sampled->thread == 0 && free_slot == NULL) free_slot = sampled;
+  }
+  if (free_slot == NULL) return;
+
+  char label[64];
+  snprintf(label, sizeof(label), "cpu %% %s (%llu)", name, (unsigned long long)thread);
+  free_slot->thread = thread;
+  free_slot->cpu_ns = cpu_ns;
+  free_slot->name_key = intern_name_cstr(label);
+  free_slot->seen = 1;
+  free_slot->has_usage = 0;
+}
+
+static void sampler_main(void *arg) {
+  TraceContext *context = (TraceContext *)arg;
+  Sampler *sampler = &context->sampler;
+  uint64_t last_sample_time = now();
+  while (atomic_load_explicit(&sampler->running, memory_order_acquire)) {
+    sleep_milliseconds(sampler->interval_ms);
+    if (!atomic_load_explicit(&sampler->running, memory_order_acquire)) break;
+    uint64_t sample_time = now();
+    sampler->elapsed_ns = sample_time - last_sample_time;
+    last_sample_time = sample_time;
+
+    for (size_t i = 0; i < MAX_SAMPLED_THREADS; i++) sampler->threads[i].seen = 0;
+    read_thread_cpu(&sampler->stats, sample_thread_cpu, sampler);
+    uint64_t resident_bytes, virtual_bytes;
+    int has_memory = read_process_memory(&sampler->stats, &resident_bytes, &virtual_bytes);
+
+    for (size_t i = 0; i < MAX_SAMPLED_THREADS; i++) {
+      SampledThread *sampled = &sampler->threads[i];
+      if (sampled->seen && sampled->has_usage) rrtrace_counter(sampled->name_key, sampled->usage);
+      if (!sampled->seen) sampled->thread = 0;
+    }
+    if (has_memory) {
+      rrtrace_counter(sampler->resident_key, (double)resident_bytes);
+      rrtrace_counter(sampler->virtual_key, (double)virtual_bytes);
+    }
+
+#ifdef HAVE_RB_POSTPONED_JOB_PREREGISTER
+    if (sampler->vm_job != POSTPONED_JOB_HANDLE_INVALID) rb_postponed_job_trigger(sampler->vm_job);
+#endif
+  }
+}
+
+#ifdef HAVE_RB_POSTPONED_JOB_PREREGISTER
+// Runs with the GVL at the next safe point after the sampler thread asks
+// for it. Cache invalidations are reported per interval. Before Ruby 3.3
+// postponed jobs can only be registered from a Ruby thread, so these
+// statistics are not sampled there.
+static void sample_vm(void *arg) {
+  TraceContext *context = (TraceContext *)arg;
+  Sampler *sampler = &context->sampler;
+  if (!atomic_load_explicit(&sampler->running, memory_order_acquire)) return;
+
+  rrtrace_counter(sampler->heap_live_slots_key, (double)rb_gc_stat(ID2SYM(rb_intern("heap_live_slots"))));
+  rrtrace_counter(sampler->heap_free_slots_key, (double)rb_gc_stat(ID2SYM(rb_intern("heap_free_slots"))));
+  rrtrace_counter(sampler->heap_pages_key, (double)rb_gc_stat(ID2SYM(rb_intern("heap_allocated_pages"))));
+  rrtrace_counter(sampler->malloc_increase_key, (double)rb_gc_stat(ID2SYM(rb_intern("malloc_increase_bytes"))));
+
+  VALUE vm = rb_const_get(rb_cObject, rb_intern("RubyVM"));
+  VALUE invalidations = rb_funcall(vm, rb_intern("stat"), 1, ID2SYM(rb_intern("constant_cache_invalidations")));
+  if (!RB_INTEGER_TYPE_P(invalidations)) return;
+  size_t total = NUM2SIZET(invalidations);
+  if (sampler->has_constant_cache_invalidations) {
+    rrtrace_counter(sampler->constant_cache_invalidations_key, (double)(total - sampler->constant_cache_invalidations));
+  }
+  sampler->constant_cache_invalidations = total;
+  sampler->has_constant_cache_invalidations = 1;
+}
+#endif
+
+static void start_sampler(TraceContext *context, uint32_t interval_ms) {
+  Sampler *sampler = &context->sampler;
+  sampler->interval_ms = interval_ms;
+  sampler->resident_key = intern_name_cstr("rss bytes");
+  sampler->virtual_key = intern_name_cstr("virtual memory bytes");
+  sampler->heap_live_slots_key = intern_name_cstr("heap live slots");
+  sampler->heap_free_slots_key = intern_name_cstr("heap free slots");
+  sampler->heap_pages_key = intern_name_cstr("heap pages");
+  sampler->malloc_increase_key = intern_name_cstr("malloc increase bytes");
+  sampler->constant_cache_invalidations_key = intern_name_cstr("constant cache invalidations");
+  sampler->has_constant_cache_invalidations = 0;
+  memset(sampler->threads, 0, sizeof(sampler->threads));
+  process_stats_open(&sampler->stats);
+
+  atomic_store_explicit(&sampler->running, 1, memory_order_release);
+  if (!start_sampler_thread(&sampler->thread, sampler_main, context)) {
+    atomic_store_explicit(&sampler->running, 0, memory_order_release);
+    process_stats_close(&sampler->stats);
+    rb_warn("rrtrace: failed to start the sampler thread");
+    return;
+  }
+  sampler->active = 1;
+}
+
+static void stop_sampler(TraceContext *context) {
+  Sampler *sampler = &context->sampler;
+  if (!sampler->active) return;
+
+  atomic_store_explicit(&sampler->running, 0, memory_order_release);
+  join_sampler_thread(sampler->thread);
+  process_stats_close(&sampler->stats);
+  sampler->active = 0;
+}
+
+static const rrtrace_api c_api = {
+  RRTRACE_API_VERSION,
+  sizeof(rrtrace_api),
+  rrtrace_intern_name,
+  rrtrace_span_begin,
+  rrtrace_span_end,
+  rrtrace_mark,
+  rrtrace_counter,
+};
+
+// Symbols and frozen strings are looked up without allocating.
+static uint32_t intern_name_value(VALUE name) {
+  if (RB_SYMBOL_P(name)) name = rb_sym2str(name);
+  StringValue(name);
+  return rrtrace_intern_name(RSTRING_PTR(name), RSTRING_LEN(name));
+}
+
+static void method_table_holder_mark(void *ptr) {
+  rrtrace_method_table_mark((const RRTraceMethodTable *)ptr);
+}
+
+static const rb_data_type_t method_table_holder_type = {
+  "rrtrace/method_table",
+  {method_table_holder_mark, NULL, NULL},
+  NULL,
+  NULL,
+  RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
 static void unregister_tracepoint(VALUE *tracepoint) {
   if (NIL_P(*tracepoint)) return;
 
@@ -174,6 +592,8 @@ static void remove_thread_hook(rb_internal_thread_event_hook_t **hook) {
 }
 
 static void cleanup_context(TraceContext *context) {
+  stop_sampler(context);
+
   unregister_tracepoint(&context->trace_call);
   unregister_tracepoint(&context->trace_return);
   unregister_tracepoint(&context->trace_gc_start);
@@ -186,10 +606,21 @@ static void cleanup_context(TraceContext *context) {
   remove_thread_hook(&context->thread_exit_hook);
 
   context->event_ringbuffer = NULL;
+  context->metadata_ringbuffer = NULL;
+  // A visualizer writing a file is asked to finish instead of killed.
+  int wait_for_visualizer = context->output_mode != RRTRACE_OUTPUT_WINDOW && context->visualizer_process_id != invalid_process_id();
+  if (wait_for_visualizer) {
+    RRTraceSharedRegion *region = shared_memory_ptr(&context->shared_memory);
+    atomic_store_explicit(&region->header.stopped, 1, memory_order_release);
+  }
   close_shared_memory(&context->shared_memory);
 
   if (context->visualizer_process_id != invalid_process_id()) {
-    terminate_process(context->visualizer_process_id);
+    if (wait_for_visualizer) {
+      wait_process(context->visualizer_process_id);
+    } else {
+      terminate_process(context->visualizer_process_id);
+    }
     close_process(context->visualizer_process_id);
     context->visualizer_process_id = invalid_process_id();
   }
@@ -205,29 +636,179 @@ static VALUE rrtrace_native_stop(VALUE self) {
   if (!trace_context.started) return Qfalse;
 
   cleanup_context(&trace_context);
+  if (trace_context.dropped_events > 0) {
+    rb_warn("rrtrace dropped %llu events because the ring buffer was full", (unsigned long long)trace_context.dropped_events);
+  }
   return Qtrue;
 }
 
-static VALUE rrtrace_native_start(VALUE self, VALUE visualizer) {
+static VALUE rrtrace_native_span_begin(VALUE self, VALUE name) {
+  uint32_t key = intern_name_value(name);
+  rrtrace_span_begin(key);
+  return UINT2NUM(key);
+}
+
+static VALUE rrtrace_native_span_end(VALUE self, VALUE key) {
+  rrtrace_span_end(NUM2UINT(key));
+  return Qnil;
+}
+
+static VALUE rrtrace_native_span_end_name(VALUE self, VALUE name) {
+  rrtrace_span_end(intern_name_value(name));
+  return Qnil;
+}
+
+static VALUE rrtrace_native_mark(VALUE self, VALUE name) {
+  rrtrace_mark(intern_name_value(name));
+  return Qnil;
+}
+
+// Returns the previous context id of the current thread.
+static VALUE rrtrace_native_swap_context(VALUE self, VALUE context_id) {
+  uint32_t id = NUM2UINT(context_id);
+  ThreadData *data = get_thread_data(&trace_context, rb_thread_current());
+  uint32_t previous = data->context_id;
+  data->context_id = id;
+  if (id != previous) push_event(&trace_context, event_context(id));
+  return UINT2NUM(previous);
+}
+
+static void change_trace_depth(int delta) {
+  ThreadData *data = get_thread_data(&trace_context, rb_thread_current());
+  if (trace_context.started && trace_context.defer_trace_depth) {
+    data->pending_trace_depth += delta;
+  } else {
+    data->trace_depth += delta;
+  }
+}
+
+static VALUE rrtrace_native_trace_enter(VALUE self) {
+  change_trace_depth(1);
+  return Qnil;
+}
+
+static VALUE rrtrace_native_trace_exit(VALUE self) {
+  change_trace_depth(-1);
+  return Qnil;
+}
+
+static VALUE rrtrace_native_profile_begin(VALUE self) {
+  ThreadData *data = get_thread_data(&trace_context, rb_thread_current());
+  if (data->profile != NULL) rb_raise(rb_eRuntimeError, "Rrtrace.self_time cannot be nested");
+  data->profile = rrtrace_profile_new();
+  trace_context.profiling++;
+  return Qnil;
+}
+
+// Returns up to `limit` methods with the most self time as
+// [defined class, method name, nanoseconds], the most first.
+static VALUE rrtrace_native_profile_end(VALUE self, VALUE limit_value) {
+  long limit = NUM2LONG(limit_value);
+  ThreadData *data = get_thread_data(&trace_context, rb_thread_current());
+  RRTraceProfile *profile = data->profile;
+  if (profile == NULL) return rb_ary_new();
+  data->profile = NULL;
+  trace_context.profiling--;
+
+  RRTraceMethodTable *table = &trace_context.method_table;
+  RRTraceMethodEntry **top = malloc(sizeof(RRTraceMethodEntry *) * (limit > 0 ? (size_t)limit : 1));
+  long count = 0;
+  for (size_t i = 0; i < table->capacity && limit > 0; i++) {
+    RRTraceMethodEntry *entry = &table->entries[i];
+    if (entry->key == UINT32_MAX) continue;
+    uint64_t self_ns = rrtrace_profile_self_ns(profile, entry->key);
+    if (self_ns == 0) continue;
+    long position;
+    if (count < limit) {
+      position = count++;
+    } else if (self_ns > rrtrace_profile_self_ns(profile, top[limit - 1]->key)) {
+      position = limit - 1;
+    } else {
+      continue;
+    }
+    while (position > 0 && rrtrace_profile_self_ns(profile, top[position - 1]->key) < self_ns) {
+      top[position] = top[position - 1];
+      position--;
+    }
+    top[position] = entry;
+  }
+
+  VALUE result = rb_ary_new_capa(count);
+  for (long i = 0; i < count; i++) {
+    VALUE method_name = top[i]->method_id ? ID2SYM(top[i]->method_id) : Qnil;
+    uint64_t self_ns = rrtrace_profile_self_ns(profile, top[i]->key);
+    rb_ary_push(result, rb_ary_new_from_args(3, top[i]->klass, method_name, ULL2NUM(self_ns)));
+  }
+  free(top);
+  rrtrace_profile_free(profile);
+  return result;
+}
+
+static VALUE rrtrace_native_counter(VALUE self, VALUE name, VALUE value) {
+  rrtrace_counter(intern_name_value(name), NUM2DBL(value));
+  return Qnil;
+}
+
+static VALUE option(VALUE options, const char *name) {
+  return rb_funcall(options, rb_intern(name), 0);
+}
+
+static int option_is(VALUE value, const char *name) {
+  return value == ID2SYM(rb_intern(name));
+}
+
+static uint32_t output_mode_option(VALUE output) {
+  if (option_is(output, "record")) return RRTRACE_OUTPUT_RECORD;
+  if (option_is(output, "headless")) return RRTRACE_OUTPUT_HEADLESS;
+  if (option_is(output, "export")) return RRTRACE_OUTPUT_EXPORT;
+  return RRTRACE_OUTPUT_WINDOW;
+}
+
+// `options` is an Rrtrace::Options, which has validated every value.
+static VALUE rrtrace_native_start(VALUE self, VALUE visualizer, VALUE options) {
   TraceContext *context = &trace_context;
   VALUE visualizer_path = rb_str_dup(StringValue(visualizer));
   char *visualizer_path_cstr = StringValueCStr(visualizer_path);
+  VALUE sample_interval_ms = option(options, "sample_interval_ms");
+  uint32_t interval_ms = NIL_P(sample_interval_ms) ? 0 : NUM2UINT(sample_interval_ms);
+  VALUE events = option(options, "events");
+  int trace_calls = RTEST(rb_ary_includes(events, ID2SYM(rb_intern("call"))));
+  int trace_c_calls = RTEST(rb_ary_includes(events, ID2SYM(rb_intern("c_call"))));
+  int trace_gc = RTEST(rb_ary_includes(events, ID2SYM(rb_intern("gc"))));
+  uint64_t ring_size = NUM2ULL(option(options, "ring_size"));
+  uint64_t retention_ns = (uint64_t)(NUM2DBL(option(options, "retention")) * 1e9);
+  uint32_t flags = RTEST(option(options, "coalesce")) ? RRTRACE_FLAG_COALESCE_RUNS : 0;
+  uint32_t max_fps = NUM2UINT(option(options, "max_fps"));
+  uint32_t history_mb = NUM2UINT(option(options, "history_mb"));
+  VALUE output_path = option(options, "output_path");
+  const char *output_path_cstr = NIL_P(output_path) ? "" : StringValueCStr(output_path);
 
   if (context->started) return Qfalse;
 
   atomic_store_explicit(&context->next_thread_id, 1, memory_order_relaxed);
+  context->selective = RTEST(option(options, "selective"));
+  context->defer_trace_depth = context->selective && trace_c_calls;
+  context->output_mode = output_mode_option(option(options, "output"));
+  context->drop_when_full = option_is(option(options, "backpressure"), "drop");
+  context->dropped_events = 0;
+  context->include_filter = option(options, "include");
+  context->exclude_filter = option(options, "exclude");
+  if (context->method_excluded_capacity > 0) memset(context->method_excluded, 0, context->method_excluded_capacity);
 
   char shm_name[64];
   generate_shared_memory_name(shm_name, sizeof(shm_name));
-  context->shared_memory = open_shared_memory(shm_name, sizeof(RRTraceEventRingBuffer));
+  context->shared_memory = open_shared_memory(shm_name, (int)rrtrace_shared_region_size(ring_size));
   if (!shared_memory_opened(context->shared_memory)) {
     rb_raise(rb_eRuntimeError, "Failed to create shared memory for rrtrace");
     return Qfalse;
   }
 
-  RRTraceEventRingBuffer *ringbuffer = shared_memory_ptr(&context->shared_memory);
-  rrtrace_event_ringbuffer_init(ringbuffer);
-  context->event_ringbuffer = ringbuffer;
+  RRTraceSharedRegion *region = shared_memory_ptr(&context->shared_memory);
+  rrtrace_shared_region_init(region, ring_size, context->output_mode, flags, retention_ns, max_fps, history_mb, output_path_cstr);
+  context->event_ringbuffer = rrtrace_shared_region_events(region);
+  context->metadata_ringbuffer = &region->metadata;
+  rrtrace_method_table_clear(&context->method_table);
+  publish_names(context);
 
 #ifdef RRTRACE_WRITE_DEBUG_LOG
   fprintf(context->log, "Visualizer: %s\n", visualizer_path_cstr);
@@ -242,29 +823,45 @@ static VALUE rrtrace_native_start(VALUE self, VALUE visualizer) {
   }
   context->visualizer_process_id = pid;
 
-  ThreadData *main_thread_data = malloc(sizeof(ThreadData));
-  main_thread_data->thread_id = 0;
   VALUE thread = rb_thread_current();
-  rb_internal_thread_specific_set(thread, context->thread_data_key, main_thread_data);
-
-  context->trace_call = rb_tracepoint_new(RUBY_Qnil, RUBY_EVENT_CALL | RUBY_EVENT_C_CALL, tracepoint_call_handler, context);
-  rb_gc_register_address(&context->trace_call);
-  context->trace_return = rb_tracepoint_new(RUBY_Qnil, RUBY_EVENT_RETURN | RUBY_EVENT_C_RETURN, tracepoint_return_handler, context);
-  rb_gc_register_address(&context->trace_return);
-  context->trace_gc_start = rb_tracepoint_new(RUBY_Qnil, RUBY_INTERNAL_EVENT_GC_ENTER, tracepoint_gc_start_handler, context);
-  rb_gc_register_address(&context->trace_gc_start);
-  context->trace_gc_end = rb_tracepoint_new(RUBY_Qnil, RUBY_INTERNAL_EVENT_GC_EXIT, tracepoint_gc_end_handler, context);
-  rb_gc_register_address(&context->trace_gc_end);
+  ThreadData *main_thread_data = rb_internal_thread_specific_get(thread, context->thread_data_key);
+  if (main_thread_data == NULL) {
+    main_thread_data = malloc(sizeof(ThreadData));
+    main_thread_data->context_id = 0;
+    main_thread_data->trace_depth = 0;
+    main_thread_data->pending_trace_depth = 0;
+    main_thread_data->profile = NULL;
+    rb_internal_thread_specific_set(thread, context->thread_data_key, main_thread_data);
+  }
+  main_thread_data->thread_id = 0;
+  if (main_thread_data->context_id != 0) push_event(context, event_context(main_thread_data->context_id));
+
+  rb_event_flag_t call_events = (trace_calls ? RUBY_EVENT_CALL : 0) | (trace_c_calls ? RUBY_EVENT_C_CALL : 0);
+  rb_event_flag_t return_events = (trace_calls ? RUBY_EVENT_RETURN : 0) | (trace_c_calls ? RUBY_EVENT_C_RETURN : 0);
+  if (call_events) {
+    context->trace_call = rb_tracepoint_new(RUBY_Qnil, call_events, tracepoint_call_handler, context);
+    rb_gc_register_address(&context->trace_call);
+    context->trace_return = rb_tracepoint_new(RUBY_Qnil, return_events, tracepoint_return_handler, context);
+    rb_gc_register_address(&context->trace_return);
+  }
+  if (trace_gc) {
+    context->trace_gc_start = rb_tracepoint_new(RUBY_Qnil, RUBY_INTERNAL_EVENT_GC_ENTER, tracepoint_gc_start_handler, context);
+    rb_gc_register_address(&context->trace_gc_start);
+    context->trace_gc_end = rb_tracepoint_new(RUBY_Qnil, RUBY_INTERNAL_EVENT_GC_EXIT, tracepoint_gc_end_handler, context);
+    rb_gc_register_address(&context->trace_gc_end);
+  }
   context->thread_start_hook = rb_internal_thread_add_event_hook(thread_start_handler, RUBY_INTERNAL_THREAD_EVENT_STARTED, context);
   context->thread_ready_hook = rb_internal_thread_add_event_hook(thread_ready_handler, RUBY_INTERNAL_THREAD_EVENT_READY, context);
   context->thread_suspended_hook = rb_internal_thread_add_event_hook(thread_suspended_handler, RUBY_INTERNAL_THREAD_EVENT_SUSPENDED, context);
   context->thread_resume_hook = rb_internal_thread_add_event_hook(thread_resume_handler, RUBY_INTERNAL_THREAD_EVENT_RESUMED, context);
   context->thread_exit_hook = rb_internal_thread_add_event_hook(thread_exit_handler, RUBY_INTERNAL_THREAD_EVENT_EXITED, context);
 
-  rb_tracepoint_enable(context->trace_call);
-  rb_tracepoint_enable(context->trace_return);
-  rb_tracepoint_enable(context->trace_gc_start);
-  rb_tracepoint_enable(context->trace_gc_end);
+  if (!NIL_P(context->trace_call)) rb_tracepoint_enable(context->trace_call);
+  if (!NIL_P(context->trace_return)) rb_tracepoint_enable(context->trace_return);
+  if (!NIL_P(context->trace_gc_start)) rb_tracepoint_enable(context->trace_gc_start);
+  if (!NIL_P(context->trace_gc_end)) rb_tracepoint_enable(context->trace_gc_end);
+
+  if (interval_ms > 0) start_sampler(context, interval_ms);
 
   context->started = 1;
   return Qtrue;
@@ -276,6 +873,7 @@ Init_rrtrace(void)
   TraceContext *context = &trace_context;
   context->shared_memory = invalid_shared_memory_handle();
   context->event_ringbuffer = NULL;
+  context->metadata_ringbuffer = NULL;
   context->visualizer_process_id = invalid_process_id();
   context->thread_start_hook = NULL;
   context->thread_ready_hook = NULL;
@@ -289,13 +887,47 @@ Init_rrtrace(void)
   context->thread_data_key = rb_internal_thread_specific_key_create();
   atomic_init(&context->next_thread_id, 1);
   atomic_flag_clear(&context->event_ringbuffer_lock);
+  atomic_flag_clear(&context->metadata_ringbuffer_lock);
+  rrtrace_method_table_init(&context->method_table);
+  context->method_table_holder = TypedData_Wrap_Struct(0, &method_table_holder_type, &context->method_table);
+  rb_gc_register_address(&context->method_table_holder);
+  rrtrace_name_table_init(&context->name_table);
+  atomic_flag_clear(&context->name_table_lock);
+  context->selective = 0;
+  context->defer_trace_depth = 0;
+  context->profiling = 0;
+  context->output_mode = RRTRACE_OUTPUT_WINDOW;
+  context->drop_when_full = 0;
+  context->dropped_events = 0;
+  context->include_filter = Qnil;
+  rb_gc_register_address(&context->include_filter);
+  context->exclude_filter = Qnil;
+  rb_gc_register_address(&context->exclude_filter);
+  context->method_excluded = NULL;
+  context->method_excluded_capacity = 0;
+  context->sampler.active = 0;
+  atomic_init(&context->sampler.running, 0);
+#ifdef HAVE_RB_POSTPONED_JOB_PREREGISTER
+  context->sampler.vm_job = rb_postponed_job_preregister(0, sample_vm, context);
+#endif
   context->started = 0;
 #ifdef RRTRACE_WRITE_DEBUG_LOG
   context->log = fopen("rrtrace.log", "w");
 #endif
 
   VALUE mRrtrace = rb_const_get(rb_cObject, rb_intern("Rrtrace"));
-  rb_define_singleton_method(mRrtrace, "native_start", rrtrace_native_start, 1);
+  rb_define_const(mRrtrace, "C_API", ULL2NUM((uintptr_t)&c_api));
+  rb_define_singleton_method(mRrtrace, "native_start", rrtrace_native_start, 2);
   rb_define_singleton_method(mRrtrace, "native_stop", rrtrace_native_stop, 0);
   rb_define_singleton_method(mRrtrace, "native_started?", rrtrace_native_started_p, 0);
+  rb_define_singleton_method(mRrtrace, "native_span_begin", rrtrace_native_span_begin, 1);
+  rb_define_singleton_method(mRrtrace, "native_span_end", rrtrace_native_span_end, 1);
+  rb_define_singleton_method(mRrtrace, "native_span_end_name", rrtrace_native_span_end_name, 1);
+  rb_define_singleton_method(mRrtrace, "native_mark", rrtrace_native_mark, 1);
+  rb_define_singleton_method(mRrtrace, "native_counter", rrtrace_native_counter, 2);
+  rb_define_singleton_method(mRrtrace, "native_swap_context", rrtrace_native_swap_context, 1);
+  rb_define_singleton_method(mRrtrace, "native_trace_enter", rrtrace_native_trace_enter, 0);
+  rb_define_singleton_method(mRrtrace, "native_trace_exit", rrtrace_native_trace_exit, 0);
+  rb_define_singleton_method(mRrtrace, "native_profile_begin", rrtrace_native_profile_begin, 0);
+  rb_define_singleton_method(mRrtrace, "native_profile_end", rrtrace_native_profile_end, 1);
 }
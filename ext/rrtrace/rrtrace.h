@@ -4,5 +4,19 @@
 #include "ruby.h"
 #include "ruby/debug.h"
 #include "ruby/thread.h"
+#include "rrtrace_api.h"
+
+// Annotations for application-level phases. Other extensions reach these
+// through the rrtrace_api table in rrtrace_api.h. Intern a name once and keep the
+// key; begin, end and mark do not allocate. All of them require the GVL and
+// do nothing while tracing is stopped.
+uint32_t rrtrace_intern_name(const char *name, size_t length);
+void rrtrace_span_begin(uint32_t name_key);
+void rrtrace_span_end(uint32_t name_key);
+void rrtrace_mark(uint32_t name_key);
+// Records a sample of a named time series, such as a queue depth. Unlike
+// the annotations, counters are not tied to the running Ruby thread, so this
+// and rrtrace_intern_name may also be called from native threads.
+void rrtrace_counter(uint32_t name_key, double value);
 
 #endif /* RRTRACE_H */
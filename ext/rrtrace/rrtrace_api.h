@@ -0,0 +1,51 @@
+#ifndef RRTRACE_API_H
+#define RRTRACE_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "ruby.h"
+
+// Function table for other native extensions. The rrtrace extension is
+// built with hidden symbols, so copy this header into your extension and
+// look the table up at runtime instead of linking against rrtrace:
+//
+//     const rrtrace_api *rrtrace = rrtrace_api_get();
+//     uint32_t key = rrtrace ? rrtrace->intern_name("json.encode", 11) : 0;
+//     if (rrtrace) rrtrace->span_begin(key);
+//     ...
+//     if (rrtrace) rrtrace->span_end(key);
+//
+// The functions push into the same event ring as the built-in hooks and do
+// nothing while tracing is stopped. Spans and marks require the GVL; names
+// and counters may also be recorded from native threads.
+//
+// The table lives as long as the process. Members are only ever appended,
+// so check `size` before using a member added after the first version.
+#define RRTRACE_API_VERSION 1
+
+typedef struct {
+    uint32_t version;
+    uint32_t size;
+    uint32_t (*intern_name)(const char *name, size_t length);
+    void (*span_begin)(uint32_t name_key);
+    void (*span_end)(uint32_t name_key);
+    void (*mark)(uint32_t name_key);
+    void (*counter)(uint32_t name_key, double value);
+} rrtrace_api;
+
+// Returns the table of the loaded rrtrace extension, or NULL when rrtrace
+// has not been required or is incompatible. Requires the GVL; call it once
+// and keep the pointer.
+static inline const rrtrace_api *rrtrace_api_get(void) {
+    ID module_id = rb_intern("Rrtrace");
+    if (!rb_const_defined_at(rb_cObject, module_id)) return NULL;
+    VALUE module = rb_const_get_at(rb_cObject, module_id);
+    ID api_id = rb_intern("C_API");
+    if (!rb_const_defined_at(module, api_id)) return NULL;
+    VALUE address = rb_const_get_at(module, api_id);
+    if (!RB_INTEGER_TYPE_P(address)) return NULL;
+    const rrtrace_api *api = (const rrtrace_api *)(uintptr_t)NUM2ULL(address);
+    return api->version == RRTRACE_API_VERSION ? api : NULL;
+}
+
+#endif /* RRTRACE_API_H */
@@ -3,6 +3,7 @@
 
 #include <stdatomic.h>
 #include <stdint.h>
+#include <string.h>
 
 #if defined(_WIN32) || defined(__MINGW32__) || defined(__MINGW64__)
 #include "time_windows.h"
@@ -19,6 +20,11 @@
 #define EVENT_TYPE_THREAD_SUSPENDED 0x6000000000000000ull
 #define EVENT_TYPE_THREAD_RESUME    0x7000000000000000ull
 #define EVENT_TYPE_THREAD_EXIT      0x8000000000000000ull
+#define EVENT_TYPE_SPAN_BEGIN       0x9000000000000000ull
+#define EVENT_TYPE_SPAN_END         0xA000000000000000ull
+#define EVENT_TYPE_MARK             0xB000000000000000ull
+#define EVENT_TYPE_COUNTER          0xC000000000000000ull
+#define EVENT_TYPE_CONTEXT          0xD000000000000000ull
 
 #define EVENT_TYPE_MASK             0xF000000000000000ull
 
@@ -27,17 +33,17 @@ typedef struct {
     uint64_t data;
 } RRTraceEvent;
 
-static inline RRTraceEvent event_call(uint64_t method_id) {
+static inline RRTraceEvent event_call(uint32_t method_key) {
     RRTraceEvent event;
     event.timestamp_and_event_type = now() | EVENT_TYPE_CALL;
-    event.data = method_id;
+    event.data = method_key;
     return event;
 }
 
-static inline RRTraceEvent event_return(uint64_t method_id) {
+static inline RRTraceEvent event_return(uint32_t method_key) {
     RRTraceEvent event;
     event.timestamp_and_event_type = now() | EVENT_TYPE_RETURN;
-    event.data = method_id;
+    event.data = method_key;
     return event;
 }
 
@@ -88,6 +94,51 @@ static inline RRTraceEvent event_thread_exit(uint32_t thread_id) {
     return event;
 }
 
+static inline RRTraceEvent event_span_begin(uint32_t name_key) {
+    RRTraceEvent event;
+    event.timestamp_and_event_type = now() | EVENT_TYPE_SPAN_BEGIN;
+    event.data = name_key;
+    return event;
+}
+
+static inline RRTraceEvent event_span_end(uint32_t name_key) {
+    RRTraceEvent event;
+    event.timestamp_and_event_type = now() | EVENT_TYPE_SPAN_END;
+    event.data = name_key;
+    return event;
+}
+
+static inline RRTraceEvent event_mark(uint32_t name_key) {
+    RRTraceEvent event;
+    event.timestamp_and_event_type = now() | EVENT_TYPE_MARK;
+    event.data = name_key;
+    return event;
+}
+
+// The name key goes in the upper half of data and the value, narrowed to a
+// float, in the lower half.
+static inline RRTraceEvent event_counter(uint32_t name_key, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    RRTraceEvent event;
+    event.timestamp_and_event_type = now() | EVENT_TYPE_COUNTER;
+    event.data = ((uint64_t)name_key << 32) | bits;
+    return event;
+}
+
+// Sets the context id of the current thread until the next context event;
+// 0 means no context.
+static inline RRTraceEvent event_context(uint32_t context_id) {
+    RRTraceEvent event;
+    event.timestamp_and_event_type = now() | EVENT_TYPE_CONTEXT;
+    event.data = context_id;
+    return event;
+}
+
+static inline uint64_t event_timestamp(RRTraceEvent event) {
+    return event.timestamp_and_event_type & ~EVENT_TYPE_MASK;
+}
+
 #undef EVENT_TYPE_CALL
 #undef EVENT_TYPE_RETURN
 #undef EVENT_TYPE_GC_START
@@ -97,6 +148,11 @@ static inline RRTraceEvent event_thread_exit(uint32_t thread_id) {
 #undef EVENT_TYPE_THREAD_SUSPENDED
 #undef EVENT_TYPE_THREAD_RESUME
 #undef EVENT_TYPE_THREAD_EXIT
+#undef EVENT_TYPE_SPAN_BEGIN
+#undef EVENT_TYPE_SPAN_END
+#undef EVENT_TYPE_MARK
+#undef EVENT_TYPE_COUNTER
+#undef EVENT_TYPE_CONTEXT
 #undef EVENT_TYPE_MASK
 
 #endif /* RRTRACE_EVENT_H */
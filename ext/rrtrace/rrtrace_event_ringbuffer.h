@@ -1,13 +1,15 @@
 #ifndef RRTRACE_EVENT_RINGBUFFER_H
 #define RRTRACE_EVENT_RINGBUFFER_H
 
-#include "rrtrace_event.h"
+#include <stdalign.h>
 
-#define SIZE 65536
-#define MASK (SIZE - 1)
+#include "rrtrace_event.h"
 
+// The event storage follows the indices, so the capacity (a power of two)
+// can be chosen when tracing starts. The whole ring lives at the end of the
+// shared region; see rrtrace_shared_region_size.
 typedef struct {
-    RRTraceEvent buffer[SIZE];
+    uint64_t capacity;
     alignas(128) struct {
         atomic_uint_fast64_t write_index;
         uint64_t read_index_cache;
@@ -16,9 +18,12 @@ typedef struct {
         atomic_uint_fast64_t read_index;
         uint64_t write_index_cache;
     } reader;
+    // Aligned so it starts where the visualizer's padded reader ends.
+    alignas(128) RRTraceEvent buffer[];
 } RRTraceEventRingBuffer;
 
-static inline void rrtrace_event_ringbuffer_init(RRTraceEventRingBuffer *rb) {
+static inline void rrtrace_event_ringbuffer_init(RRTraceEventRingBuffer *rb, uint64_t capacity) {
+    rb->capacity = capacity;
     atomic_store_explicit(&rb->writer.write_index, 0, memory_order_relaxed);
     rb->writer.read_index_cache = 0;
     atomic_store_explicit(&rb->reader.read_index, 0, memory_order_relaxed);
@@ -27,19 +32,17 @@ static inline void rrtrace_event_ringbuffer_init(RRTraceEventRingBuffer *rb) {
 
 static inline int rrtrace_event_ringbuffer_push(RRTraceEventRingBuffer *rb, RRTraceEvent event) {
     if (rb == NULL) return 1;
+    uint64_t capacity = rb->capacity;
     uint64_t write_index = atomic_load_explicit(&rb->writer.write_index, memory_order_relaxed);
     uint64_t read_index_cache = rb->writer.read_index_cache;
-    if (write_index - read_index_cache >= SIZE) {
+    if (write_index - read_index_cache >= capacity) {
         read_index_cache = atomic_load_explicit(&rb->reader.read_index, memory_order_acquire);
         rb->writer.read_index_cache = read_index_cache;
-        if (write_index - read_index_cache >= SIZE) return 0;
+        if (write_index - read_index_cache >= capacity) return 0;
     }
-    rb->buffer[write_index & MASK] = event;
+    rb->buffer[write_index & (capacity - 1)] = event;
     atomic_store_explicit(&rb->writer.write_index, write_index + 1, memory_order_release);
     return 1;
 }
 
-#undef MASK
-#undef SIZE
-
 #endif /* RRTRACE_EVENT_RINGBUFFER_H */
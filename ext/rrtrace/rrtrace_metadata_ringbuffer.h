@@ -0,0 +1,82 @@
+#ifndef RRTRACE_METADATA_RINGBUFFER_H
+#define RRTRACE_METADATA_RINGBUFFER_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#define METADATA_KIND_METHOD 1u
+#define METADATA_KIND_NAME 2u
+
+#define SIZE 262144
+#define MASK (SIZE - 1)
+#define MAX_PAYLOAD_LENGTH 4096
+
+typedef struct {
+    uint32_t kind;
+    uint32_t key;
+    uint32_t length;
+    uint32_t reserved;
+} RRTraceMetadataHeader;
+
+typedef struct {
+    uint8_t buffer[SIZE];
+    alignas(128) struct {
+        atomic_uint_fast64_t write_index;
+        uint64_t read_index_cache;
+    } writer;
+    alignas(128) struct {
+        atomic_uint_fast64_t read_index;
+        uint64_t write_index_cache;
+    } reader;
+} RRTraceMetadataRingBuffer;
+
+static inline void rrtrace_metadata_ringbuffer_init(RRTraceMetadataRingBuffer *rb) {
+    atomic_store_explicit(&rb->writer.write_index, 0, memory_order_relaxed);
+    rb->writer.read_index_cache = 0;
+    atomic_store_explicit(&rb->reader.read_index, 0, memory_order_relaxed);
+    rb->reader.write_index_cache = 0;
+}
+
+static inline void rrtrace_metadata_ringbuffer_copy(RRTraceMetadataRingBuffer *rb, uint64_t index, const void *data, size_t length) {
+    size_t offset = index & MASK;
+    size_t first_part = SIZE - offset;
+    if (length <= first_part) {
+        memcpy(&rb->buffer[offset], data, length);
+    } else {
+        memcpy(&rb->buffer[offset], data, first_part);
+        memcpy(&rb->buffer[0], (const uint8_t *)data + first_part, length - first_part);
+    }
+}
+
+// Records are a header followed by the payload, padded to 8 bytes so that
+// every header starts aligned. Payloads longer than MAX_PAYLOAD_LENGTH are
+// truncated.
+static inline int rrtrace_metadata_ringbuffer_push(RRTraceMetadataRingBuffer *rb, uint32_t kind, uint32_t key, const void *payload, size_t length) {
+    if (rb == NULL) return 1;
+    if (length > MAX_PAYLOAD_LENGTH) length = MAX_PAYLOAD_LENGTH;
+    uint64_t record_size = (sizeof(RRTraceMetadataHeader) + length + 7) & ~(uint64_t)7;
+    uint64_t write_index = atomic_load_explicit(&rb->writer.write_index, memory_order_relaxed);
+    uint64_t read_index_cache = rb->writer.read_index_cache;
+    if (write_index + record_size - read_index_cache > SIZE) {
+        read_index_cache = atomic_load_explicit(&rb->reader.read_index, memory_order_acquire);
+        rb->writer.read_index_cache = read_index_cache;
+        if (write_index + record_size - read_index_cache > SIZE) return 0;
+    }
+    RRTraceMetadataHeader header;
+    header.kind = kind;
+    header.key = key;
+    header.length = (uint32_t)length;
+    header.reserved = 0;
+    rrtrace_metadata_ringbuffer_copy(rb, write_index, &header, sizeof(header));
+    rrtrace_metadata_ringbuffer_copy(rb, write_index + sizeof(header), payload, length);
+    atomic_store_explicit(&rb->writer.write_index, write_index + record_size, memory_order_release);
+    return 1;
+}
+
+#undef MAX_PAYLOAD_LENGTH
+#undef MASK
+#undef SIZE
+
+#endif /* RRTRACE_METADATA_RINGBUFFER_H */
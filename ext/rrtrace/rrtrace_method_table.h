@@ -0,0 +1,102 @@
+#ifndef RRTRACE_METHOD_TABLE_H
+#define RRTRACE_METHOD_TABLE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ruby.h"
+
+#define METHOD_KEY_EMPTY UINT32_MAX
+#define INITIAL_CAPACITY 1024
+
+// Maps (defined class, method id) pairs to dense keys starting at 0, so the
+// visualizer can index per-method tables directly with the key carried by
+// call and return events. Only touched while holding the GVL.
+typedef struct {
+    VALUE klass;
+    ID method_id;
+    uint32_t key;
+} RRTraceMethodEntry;
+
+typedef struct {
+    RRTraceMethodEntry *entries;
+    size_t capacity;
+    size_t count;
+} RRTraceMethodTable;
+
+static inline size_t rrtrace_method_table_hash(VALUE klass, ID method_id) {
+    uint64_t hash = (uint64_t)klass * 0x9E3779B97F4A7C15ull ^ (uint64_t)method_id * 0xC2B2AE3D27D4EB4Full;
+    return (size_t)(hash ^ (hash >> 29));
+}
+
+static inline void rrtrace_method_table_clear(RRTraceMethodTable *table) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        table->entries[i].key = METHOD_KEY_EMPTY;
+    }
+    table->count = 0;
+}
+
+static inline void rrtrace_method_table_init(RRTraceMethodTable *table) {
+    table->entries = malloc(sizeof(RRTraceMethodEntry) * INITIAL_CAPACITY);
+    table->capacity = INITIAL_CAPACITY;
+    rrtrace_method_table_clear(table);
+}
+
+static inline RRTraceMethodEntry *rrtrace_method_table_slot(RRTraceMethodEntry *entries, size_t capacity, VALUE klass, ID method_id) {
+    size_t mask = capacity - 1;
+    size_t index = rrtrace_method_table_hash(klass, method_id) & mask;
+    while (entries[index].key != METHOD_KEY_EMPTY && (entries[index].klass != klass || entries[index].method_id != method_id)) {
+        index = (index + 1) & mask;
+    }
+    return &entries[index];
+}
+
+static inline void rrtrace_method_table_grow(RRTraceMethodTable *table) {
+    size_t capacity = table->capacity * 2;
+    RRTraceMethodEntry *entries = malloc(sizeof(RRTraceMethodEntry) * capacity);
+    for (size_t i = 0; i < capacity; i++) {
+        entries[i].key = METHOD_KEY_EMPTY;
+    }
+    for (size_t i = 0; i < table->capacity; i++) {
+        RRTraceMethodEntry *entry = &table->entries[i];
+        if (entry->key == METHOD_KEY_EMPTY) continue;
+        *rrtrace_method_table_slot(entries, capacity, entry->klass, entry->method_id) = *entry;
+    }
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+// Returns the key for the pair, assigning the next free key when the pair is
+// seen for the first time. *inserted tells the caller to publish its name.
+static inline uint32_t rrtrace_method_table_intern(RRTraceMethodTable *table, VALUE klass, ID method_id, int *inserted) {
+    RRTraceMethodEntry *entry = rrtrace_method_table_slot(table->entries, table->capacity, klass, method_id);
+    if (entry->key != METHOD_KEY_EMPTY) {
+        *inserted = 0;
+        return entry->key;
+    }
+    if ((table->count + 1) * 2 > table->capacity) {
+        rrtrace_method_table_grow(table);
+        entry = rrtrace_method_table_slot(table->entries, table->capacity, klass, method_id);
+    }
+    entry->klass = klass;
+    entry->method_id = method_id;
+    entry->key = (uint32_t)table->count++;
+    *inserted = 1;
+    return entry->key;
+}
+
+// Classes are marked (and therefore pinned) so the VALUEs used as hash keys
+// never move under compaction.
+static inline void rrtrace_method_table_mark(const RRTraceMethodTable *table) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->entries[i].key != METHOD_KEY_EMPTY) {
+            rb_gc_mark(table->entries[i].klass);
+        }
+    }
+}
+
+#undef INITIAL_CAPACITY
+#undef METHOD_KEY_EMPTY
+
+#endif /* RRTRACE_METHOD_TABLE_H */
@@ -0,0 +1,101 @@
+#ifndef RRTRACE_NAME_TABLE_H
+#define RRTRACE_NAME_TABLE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NAME_KEY_EMPTY UINT32_MAX
+#define INITIAL_CAPACITY 256
+
+// Maps annotation names to dense keys starting at 0. Names are copied on
+// first use, so later lookups only hash and compare bytes. Keys stay valid
+// for the lifetime of the process, across restarts of tracing. Not thread
+// safe; rrtrace.c guards it with a lock.
+typedef struct {
+    char *name;
+    size_t length;
+    uint64_t hash;
+    uint32_t key;
+} RRTraceNameEntry;
+
+typedef struct {
+    RRTraceNameEntry *entries;
+    size_t capacity;
+    size_t count;
+} RRTraceNameTable;
+
+static inline uint64_t rrtrace_name_table_hash(const char *name, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static inline void rrtrace_name_table_init(RRTraceNameTable *table) {
+    table->entries = malloc(sizeof(RRTraceNameEntry) * INITIAL_CAPACITY);
+    table->capacity = INITIAL_CAPACITY;
+    table->count = 0;
+    for (size_t i = 0; i < table->capacity; i++) {
+        table->entries[i].key = NAME_KEY_EMPTY;
+    }
+}
+
+static inline RRTraceNameEntry *rrtrace_name_table_slot(RRTraceNameEntry *entries, size_t capacity, const char *name, size_t length, uint64_t hash) {
+    size_t mask = capacity - 1;
+    size_t index = (size_t)(hash ^ (hash >> 32)) & mask;
+    while (entries[index].key != NAME_KEY_EMPTY) {
+        RRTraceNameEntry *entry = &entries[index];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->name, name, length) == 0) break;
+        index = (index + 1) & mask;
+    }
+    return &entries[index];
+}
+
+static inline void rrtrace_name_table_grow(RRTraceNameTable *table) {
+    size_t capacity = table->capacity * 2;
+    RRTraceNameEntry *entries = malloc(sizeof(RRTraceNameEntry) * capacity);
+    for (size_t i = 0; i < capacity; i++) {
+        entries[i].key = NAME_KEY_EMPTY;
+    }
+    for (size_t i = 0; i < table->capacity; i++) {
+        RRTraceNameEntry *entry = &table->entries[i];
+        if (entry->key == NAME_KEY_EMPTY) continue;
+        *rrtrace_name_table_slot(entries, capacity, entry->name, entry->length, entry->hash) = *entry;
+    }
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+// Returns the key for the name, assigning the next free key when the name is
+// seen for the first time. *inserted tells the caller to publish it.
+static inline uint32_t rrtrace_name_table_intern(RRTraceNameTable *table, const char *name, size_t length, int *inserted) {
+    uint64_t hash = rrtrace_name_table_hash(name, length);
+    RRTraceNameEntry *entry = rrtrace_name_table_slot(table->entries, table->capacity, name, length, hash);
+    if (entry->key != NAME_KEY_EMPTY) {
+        *inserted = 0;
+        return entry->key;
+    }
+    if ((table->count + 1) * 2 > table->capacity) {
+        rrtrace_name_table_grow(table);
+        entry = rrtrace_name_table_slot(table->entries, table->capacity, name, length, hash);
+    }
+    entry->name = malloc(length > 0 ? length : 1);
+    memcpy(entry->name, name, length);
+    entry->length = length;
+    entry->hash = hash;
+    entry->key = (uint32_t)table->count++;
+    *inserted = 1;
+    return entry->key;
+}
+
+static inline int rrtrace_name_table_occupied(const RRTraceNameTable *table, size_t index) {
+    return table->entries[index].key != NAME_KEY_EMPTY;
+}
+
+#undef INITIAL_CAPACITY
+#undef NAME_KEY_EMPTY
+
+#endif /* RRTRACE_NAME_TABLE_H */
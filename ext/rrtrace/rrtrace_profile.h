@@ -0,0 +1,78 @@
+#ifndef RRTRACE_PROFILE_H
+#define RRTRACE_PROFILE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_FRAMES 64
+#define INITIAL_KEYS 1024
+
+// Per-thread self time by method key, accumulated from the call and return
+// hooks while Rrtrace.self_time runs. Method keys are dense, so the totals
+// are a plain array indexed by key. Returns of frames entered before the
+// profile began are ignored.
+typedef struct {
+    uint32_t key;
+    uint64_t start;
+    uint64_t child_ns;
+} RRTraceProfileFrame;
+
+typedef struct {
+    RRTraceProfileFrame *frames;
+    size_t depth;
+    size_t frame_capacity;
+    uint64_t *self_ns;
+    size_t key_capacity;
+} RRTraceProfile;
+
+static inline RRTraceProfile *rrtrace_profile_new(void) {
+    RRTraceProfile *profile = malloc(sizeof(RRTraceProfile));
+    profile->frames = malloc(sizeof(RRTraceProfileFrame) * INITIAL_FRAMES);
+    profile->depth = 0;
+    profile->frame_capacity = INITIAL_FRAMES;
+    profile->self_ns = calloc(INITIAL_KEYS, sizeof(uint64_t));
+    profile->key_capacity = INITIAL_KEYS;
+    return profile;
+}
+
+static inline void rrtrace_profile_free(RRTraceProfile *profile) {
+    free(profile->frames);
+    free(profile->self_ns);
+    free(profile);
+}
+
+static inline void rrtrace_profile_call(RRTraceProfile *profile, uint32_t key, uint64_t time) {
+    if (profile->depth == profile->frame_capacity) {
+        profile->frame_capacity *= 2;
+        profile->frames = realloc(profile->frames, sizeof(RRTraceProfileFrame) * profile->frame_capacity);
+    }
+    RRTraceProfileFrame *frame = &profile->frames[profile->depth++];
+    frame->key = key;
+    frame->start = time;
+    frame->child_ns = 0;
+}
+
+static inline void rrtrace_profile_return(RRTraceProfile *profile, uint64_t time) {
+    if (profile->depth == 0) return;
+    RRTraceProfileFrame *frame = &profile->frames[--profile->depth];
+    uint64_t elapsed = time - frame->start;
+    if (frame->key >= profile->key_capacity) {
+        size_t capacity = profile->key_capacity;
+        while (frame->key >= capacity) capacity *= 2;
+        profile->self_ns = realloc(profile->self_ns, sizeof(uint64_t) * capacity);
+        memset(profile->self_ns + profile->key_capacity, 0, sizeof(uint64_t) * (capacity - profile->key_capacity));
+        profile->key_capacity = capacity;
+    }
+    profile->self_ns[frame->key] += elapsed - frame->child_ns;
+    if (profile->depth > 0) profile->frames[profile->depth - 1].child_ns += elapsed;
+}
+
+static inline uint64_t rrtrace_profile_self_ns(const RRTraceProfile *profile, uint32_t key) {
+    return key < profile->key_capacity ? profile->self_ns[key] : 0;
+}
+
+#undef INITIAL_KEYS
+#undef INITIAL_FRAMES
+
+#endif /* RRTRACE_PROFILE_H */
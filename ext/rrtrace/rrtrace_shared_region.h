@@ -0,0 +1,58 @@
+#ifndef RRTRACE_SHARED_REGION_H
+#define RRTRACE_SHARED_REGION_H
+
+#include <stdio.h>
+
+#include "rrtrace_event_ringbuffer.h"
+#include "rrtrace_metadata_ringbuffer.h"
+
+#define RRTRACE_OUTPUT_WINDOW 0u
+#define RRTRACE_OUTPUT_RECORD 1u
+#define RRTRACE_OUTPUT_HEADLESS 2u
+#define RRTRACE_OUTPUT_EXPORT 3u
+
+#define RRTRACE_OUTPUT_PATH_MAX 1024
+
+// Bits of `flags`.
+#define RRTRACE_FLAG_COALESCE_RUNS 1u
+
+// Options the tracer validated for the visualizer, written before it is
+// spawned. Visualizers that write a file keep running until the tracer
+// sets `stopped` and they have drained both rings.
+typedef struct {
+    uint32_t output_mode;
+    uint32_t flags;
+    uint64_t retention_ns;
+    uint32_t max_fps;
+    uint32_t history_mb;
+    atomic_uint_fast64_t stopped;
+    char output_path[RRTRACE_OUTPUT_PATH_MAX];
+} RRTraceSharedHeader;
+
+// The event ring, whose size depends on its capacity, directly follows.
+typedef struct {
+    RRTraceSharedHeader header;
+    RRTraceMetadataRingBuffer metadata;
+} RRTraceSharedRegion;
+
+static inline size_t rrtrace_shared_region_size(uint64_t event_capacity) {
+    return sizeof(RRTraceSharedRegion) + sizeof(RRTraceEventRingBuffer) + event_capacity * sizeof(RRTraceEvent);
+}
+
+static inline RRTraceEventRingBuffer *rrtrace_shared_region_events(RRTraceSharedRegion *region) {
+    return (RRTraceEventRingBuffer *)(region + 1);
+}
+
+static inline void rrtrace_shared_region_init(RRTraceSharedRegion *region, uint64_t event_capacity, uint32_t output_mode, uint32_t flags, uint64_t retention_ns, uint32_t max_fps, uint32_t history_mb, const char *output_path) {
+    region->header.output_mode = output_mode;
+    region->header.flags = flags;
+    region->header.retention_ns = retention_ns;
+    region->header.max_fps = max_fps;
+    region->header.history_mb = history_mb;
+    atomic_store_explicit(&region->header.stopped, 0, memory_order_relaxed);
+    snprintf(region->header.output_path, sizeof(region->header.output_path), "%s", output_path);
+    rrtrace_metadata_ringbuffer_init(&region->metadata);
+    rrtrace_event_ringbuffer_init(rrtrace_shared_region_events(region), event_capacity);
+}
+
+#endif /* RRTRACE_SHARED_REGION_H */
@@ -0,0 +1,120 @@
+#ifndef RRTRACE_SAMPLER_POSIX_H
+#define RRTRACE_SAMPLER_POSIX_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef pthread_t sampler_thread;
+
+typedef struct {
+    void (*body)(void *);
+    void *arg;
+} sampler_thread_start;
+
+static void *sampler_thread_main(void *ptr) {
+    sampler_thread_start start = *(sampler_thread_start *)ptr;
+    free(ptr);
+    start.body(start.arg);
+    return NULL;
+}
+
+static inline int start_sampler_thread(sampler_thread *thread, void (*body)(void *), void *arg) {
+    sampler_thread_start *start = malloc(sizeof(sampler_thread_start));
+    start->body = body;
+    start->arg = arg;
+    if (pthread_create(thread, NULL, sampler_thread_main, start) != 0) {
+        free(start);
+        return 0;
+    }
+    return 1;
+}
+
+static inline void join_sampler_thread(sampler_thread thread) {
+    pthread_join(thread, NULL);
+}
+
+static inline void sleep_milliseconds(uint32_t milliseconds) {
+    struct timespec duration = {milliseconds / 1000, (long)(milliseconds % 1000) * 1000000l};
+    while (nanosleep(&duration, &duration) != 0) {
+    }
+}
+
+typedef struct {
+    int statm_fd;
+    uint64_t page_size;
+    uint64_t clock_ticks;
+} process_stats;
+
+static inline void process_stats_open(process_stats *stats) {
+    stats->statm_fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    stats->page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    long clock_ticks = sysconf(_SC_CLK_TCK);
+    stats->clock_ticks = clock_ticks > 0 ? (uint64_t)clock_ticks : 100;
+}
+
+static inline void process_stats_close(process_stats *stats) {
+    if (stats->statm_fd >= 0) close(stats->statm_fd);
+    stats->statm_fd = -1;
+}
+
+static inline ssize_t read_proc_file(int fd, char *buffer, size_t size) {
+    ssize_t length = pread(fd, buffer, size - 1, 0);
+    if (length < 0) return -1;
+    buffer[length] = '\0';
+    return length;
+}
+
+static inline int read_process_memory(process_stats *stats, uint64_t *resident_bytes, uint64_t *virtual_bytes) {
+    if (stats->statm_fd < 0) return 0;
+    char buffer[128];
+    if (read_proc_file(stats->statm_fd, buffer, sizeof(buffer)) <= 0) return 0;
+    unsigned long long size, resident;
+    if (sscanf(buffer, "%llu %llu", &size, &resident) != 2) return 0;
+    *virtual_bytes = size * stats->page_size;
+    *resident_bytes = resident * stats->page_size;
+    return 1;
+}
+
+typedef void (*thread_cpu_callback)(void *arg, uint64_t thread, const char *name, uint64_t cpu_ns);
+
+// Reports the user plus system CPU time consumed so far by every thread of
+// the process, named after the thread name the kernel knows.
+static inline void read_thread_cpu(process_stats *stats, thread_cpu_callback callback, void *arg) {
+    DIR *tasks = opendir("/proc/self/task");
+    if (tasks == NULL) return;
+    struct dirent *entry;
+    while ((entry = readdir(tasks)) != NULL) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/task/%s/stat", entry->d_name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        char buffer[512];
+        ssize_t length = read_proc_file(fd, buffer, sizeof(buffer));
+        close(fd);
+        if (length <= 0) continue;
+
+        // "<tid> (<comm>) <state> ..." where comm may itself contain spaces
+        // and parentheses; utime and stime are the 12th and 13th fields
+        // after the closing parenthesis.
+        char *name_start = strchr(buffer, '(');
+        char *name_end = strrchr(buffer, ')');
+        if (name_start == NULL || name_end == NULL || name_end < name_start) continue;
+        *name_end = '\0';
+        unsigned long long utime, stime;
+        if (sscanf(name_end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) continue;
+        uint64_t ticks = utime + stime;
+        uint64_t cpu_ns = ticks / stats->clock_ticks * 1000000000ull + ticks % stats->clock_ticks * 1000000000ull / stats->clock_ticks;
+        callback(arg, strtoull(entry->d_name, NULL, 10), name_start + 1, cpu_ns);
+    }
+    closedir(tasks);
+}
+
+#endif /* RRTRACE_SAMPLER_POSIX_H */
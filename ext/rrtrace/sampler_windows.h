@@ -0,0 +1,76 @@
+#ifndef RRTRACE_SAMPLER_WINDOWS_H
+#define RRTRACE_SAMPLER_WINDOWS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <psapi.h>
+
+typedef HANDLE sampler_thread;
+
+typedef struct {
+    void (*body)(void *);
+    void *arg;
+} sampler_thread_start;
+
+static DWORD WINAPI sampler_thread_main(LPVOID ptr) {
+    sampler_thread_start start = *(sampler_thread_start *)ptr;
+    free(ptr);
+    start.body(start.arg);
+    return 0;
+}
+
+static inline int start_sampler_thread(sampler_thread *thread, void (*body)(void *), void *arg) {
+    sampler_thread_start *start = malloc(sizeof(sampler_thread_start));
+    start->body = body;
+    start->arg = arg;
+    *thread = CreateThread(NULL, 0, sampler_thread_main, start, 0, NULL);
+    if (*thread == NULL) {
+        free(start);
+        return 0;
+    }
+    return 1;
+}
+
+static inline void join_sampler_thread(sampler_thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+static inline void sleep_milliseconds(uint32_t milliseconds) {
+    Sleep(milliseconds);
+}
+
+typedef struct {
+    int unused;
+} process_stats;
+
+static inline void process_stats_open(process_stats *stats) {
+    (void)stats;
+}
+
+static inline void process_stats_close(process_stats *stats) {
+    (void)stats;
+}
+
+static inline int read_process_memory(process_stats *stats, uint64_t *resident_bytes, uint64_t *virtual_bytes) {
+    (void)stats;
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    *resident_bytes = counters.WorkingSetSize;
+    *virtual_bytes = counters.PagefileUsage;
+    return 1;
+}
+
+typedef void (*thread_cpu_callback)(void *arg, uint64_t thread, const char *name, uint64_t cpu_ns);
+
+// Per-thread CPU time is only sampled on Linux.
+static inline void read_thread_cpu(process_stats *stats, thread_cpu_callback callback, void *arg) {
+    (void)stats;
+    (void)callback;
+    (void)arg;
+}
+
+#endif /* RRTRACE_SAMPLER_WINDOWS_H */
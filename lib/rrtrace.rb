@@ -3,15 +3,26 @@
 require "rbconfig"
 
 require_relative "rrtrace/version"
+require_relative "rrtrace/options"
 
 module Rrtrace
+  # Context ids `with_context` accepts; 0 means no context.
+  CONTEXT_IDS = (1..0xFFFF_FFFF).freeze
+
   class << self
     def visualizer_path
       @visualizer_path ||= default_visualizer_path
     end
 
-    def start
-      native_start(visualizer_path)
+    # Takes an `Rrtrace::Options` or its keywords; see there for the rest.
+    # With `sample_interval_ms`, a background thread records process memory,
+    # per-thread CPU usage and GC/VM statistics as counters at that interval.
+    # With `selective: true`, method calls are only recorded on threads inside
+    # `Rrtrace.trace`.
+    def start(options = nil, **kwargs)
+      raise ArgumentError, "pass either an Rrtrace::Options or keywords" if options && !kwargs.empty?
+
+      native_start(visualizer_path, options || Options.new(**kwargs))
     end
 
     def stop
@@ -22,6 +33,84 @@ module Rrtrace
       native_started?
     end
 
+    # Records the block as a named span in the annotation lane of the current
+    # thread. Pass a Symbol or a frozen String to keep this allocation-free.
+    def span(name)
+      key = native_span_begin(name)
+      begin
+        yield
+      ensure
+        native_span_end(key)
+      end
+    end
+
+    # Begins a span that `span_end(name)` ends on the same thread, for
+    # instrumentation with separate start and finish callbacks.
+    def span_begin(name)
+      native_span_begin(name)
+      nil
+    end
+
+    def span_end(name)
+      native_span_end_name(name)
+    end
+
+    # Records a point in time in the annotation lane of the current thread.
+    def mark(name)
+      native_mark(name)
+      nil
+    end
+
+    # Records the method calls of the current thread during the block when
+    # tracing was started with `selective: true`. Blocks may nest. If tracing
+    # is not running yet, it is started in selective mode and keeps running,
+    # so repeated blocks add to the same session.
+    def trace
+      start(selective: true) unless started?
+      native_trace_enter
+      begin
+        yield
+      ensure
+        native_trace_exit
+      end
+    end
+
+    # Returns the `top` methods by self time on the current thread during
+    # the block, as ["Class#method", nanoseconds] pairs, the most first. Only
+    # recorded calls are counted, so in selective mode call this inside
+    # `trace`.
+    def self_time(top: 10)
+      native_profile_begin
+      methods = nil
+      begin
+        yield
+      ensure
+        methods = native_profile_end(top)
+      end
+      methods.map { |klass, method_name, self_ns| ["#{klass.inspect}##{method_name}", self_ns] }
+    end
+
+    # Attributes everything the current thread does inside the block to the
+    # context `id`, such as a request id, until the block returns. `id` is an
+    # Integer in `CONTEXT_IDS`, since 0 means no context. Contexts nest.
+    def with_context(id)
+      raise ArgumentError, "context id must be an Integer in #{CONTEXT_IDS}: #{id.inspect}" unless id.is_a?(Integer) && CONTEXT_IDS.cover?(id)
+
+      previous = native_swap_context(id)
+      begin
+        yield
+      ensure
+        native_swap_context(previous)
+      end
+    end
+
+    # Records a sample of the time series `name`, drawn as a line graph
+    # along the time axis. Values are stored as single-precision floats.
+    def counter(name, value)
+      native_counter(name, value)
+      nil
+    end
+
     private
 
     def default_visualizer_path
@@ -34,7 +123,10 @@ end
 require "rrtrace/rrtrace"
 
 module Rrtrace
-  private_class_method :native_start, :native_stop, :native_started?
+  private_class_method :native_start, :native_stop, :native_started?,
+    :native_span_begin, :native_span_end, :native_span_end_name, :native_mark, :native_counter,
+    :native_swap_context, :native_trace_enter, :native_trace_exit,
+    :native_profile_begin, :native_profile_end
 end
 
 Kernel.at_exit { Rrtrace.stop }
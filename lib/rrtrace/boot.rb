@@ -0,0 +1,237 @@
+# frozen_string_literal: true
+
+require "rrtrace"
+
+module Rrtrace
+  # Times `require`, `require_relative`, `load` and autoload while an
+  # application boots:
+  #
+  #   require "rrtrace/boot"
+  #   Rrtrace::Boot.start(stop_at: "Rails::Application#initialize!")
+  #
+  # Every file loaded becomes a span named after its feature path. When the
+  # boot ends, the require tree is written as a text report with inclusive
+  # and self time per file, and as folded stacks for flame graph tools such
+  # as flamegraph.pl or speedscope.
+  #
+  # `stop_at` names a method as "Const#method" or "Const.method"; the boot
+  # ends when it first returns. The hook is installed as soon as a require
+  # has defined the method, without triggering autoloads. Without `stop_at`
+  # the boot ends with `Rrtrace::Boot.stop`.
+  #
+  # Unless tracing is already running it is started in selective mode, so
+  # only the spans are recorded and the timings stay close to those of an
+  # untraced boot. Pass `calls: true` to record every method call as well.
+  # A session started here is stopped when the boot ends, so its hooks do
+  # not keep running in the booted application.
+  module Boot
+    Node = Struct.new(:path, :started_at, :inclusive_ns, :children) do
+      def self_ns
+        inclusive_ns - children.sum(&:inclusive_ns)
+      end
+    end
+
+    STOP_AT_FORMAT = /\A[A-Z]\w*(?:::[A-Z]\w*)*[#.]\w+[?!=]?\z/
+    REPORT_LIMIT = 30
+    # Files below this inclusive time are left out of the report tree, but
+    # not out of the flame graph.
+    REPORT_TREE_THRESHOLD_NS = 1_000_000
+
+    @active = false
+    @mutex = Mutex.new
+
+    class << self
+      def active?
+        @active
+      end
+
+      # Returns false if a boot is already being profiled.
+      def start(stop_at: nil, output: "rrtrace-boot", calls: false)
+        if stop_at && !STOP_AT_FORMAT.match?(stop_at)
+          raise ArgumentError, "stop_at must look like \"Const#method\" or \"Const.method\": #{stop_at.inspect}"
+        end
+
+        @mutex.synchronize do
+          return false if @active
+
+          @owns_session = !Rrtrace.started?
+          Rrtrace.start(selective: !calls) if @owns_session
+          install_kernel_hooks
+          @stop_at = stop_at
+          @stop_hook_installed = false
+          @output = output
+          @root = Node.new("boot", now, nil, [])
+          @active = true
+        end
+        install_stop_hook
+        true
+      end
+
+      # Ends the boot, writes the report and stops tracing if `start` began
+      # it. Files still being loaded on the calling thread, such as the one
+      # that called `stop_at`, are closed at this point. Returns false if no
+      # boot was being profiled.
+      def stop
+        @mutex.synchronize do
+          return false unless @active
+
+          @active = false
+          finished_at = now
+          stack = Thread.current[:rrtrace_boot_stack] || []
+          stack.each { |node| node.inclusive_ns = finished_at - node.started_at }
+          stack.each_cons(2) { |parent, node| parent.children << node }
+          @root.children << stack.first unless stack.empty?
+          @root.inclusive_ns = finished_at - @root.started_at
+        end
+        write_report
+        Rrtrace.stop if @owns_session
+        true
+      end
+
+      # Called by the Kernel hooks around the original method. Files that
+      # were already loaded or failed to load are not added to the tree.
+      def measure(path)
+        path = File.path(path)
+        stack = (Thread.current[:rrtrace_boot_stack] ||= [])
+        node = Node.new(path, now, nil, [])
+        stack.push(node)
+        Rrtrace.span_begin(path)
+        loaded = false
+        begin
+          loaded = yield
+        ensure
+          Rrtrace.span_end(path)
+          stack.pop
+          # A node that `stop` closed is already in the tree.
+          if loaded && node.inclusive_ns.nil?
+            node.inclusive_ns = now - node.started_at
+            if stack.empty?
+              @mutex.synchronize { @root.children << node }
+            else
+              stack.last.children << node
+            end
+          end
+        end
+        install_stop_hook unless @stop_hook_installed
+        loaded
+      end
+
+      private
+
+      def now
+        Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+      end
+
+      # The hooks stay in place after the boot and only pass through, since
+      # libraries such as Zeitwerk wrap `require` again on top of them.
+      # Autoload calls `Kernel#require` and is measured through it.
+      def install_kernel_hooks
+        return if ::Kernel.private_method_defined?(:rrtrace_boot_original_require)
+
+        ::Kernel.module_eval do
+          alias_method :rrtrace_boot_original_require, :require
+          alias_method :rrtrace_boot_original_require_relative, :require_relative
+          alias_method :rrtrace_boot_original_load, :load
+
+          private def require(path)
+            return rrtrace_boot_original_require(path) unless Rrtrace::Boot.active?
+            Rrtrace::Boot.measure(path) { rrtrace_boot_original_require(path) }
+          end
+
+          # The original would resolve `path` against this file, so the
+          # caller's directory is resolved here.
+          private def require_relative(path)
+            base = caller_locations(1, 1).first&.absolute_path
+            raise LoadError, "cannot infer basepath" unless base
+            require(File.expand_path(File.path(path), File.dirname(base)))
+          end
+
+          private def load(path, wrap = false)
+            return rrtrace_boot_original_load(path, wrap) unless Rrtrace::Boot.active?
+            Rrtrace::Boot.measure(path) { rrtrace_boot_original_load(path, wrap) }
+          end
+        end
+      end
+
+      def install_stop_hook
+        return if @stop_at.nil? || @stop_hook_installed
+
+        owner_path, separator, method_name = @stop_at.rpartition(/[#.]/)
+        owner = resolve_constant(owner_path)
+        return unless owner.is_a?(Module)
+
+        owner = owner.singleton_class if separator == "."
+        return unless owner.method_defined?(method_name) || owner.private_method_defined?(method_name)
+
+        @stop_hook_installed = true
+        owner.prepend(Module.new do
+          define_method(method_name) do |*args, **kwargs, &block|
+            super(*args, **kwargs, &block)
+          ensure
+            Rrtrace::Boot.stop
+          end
+        end)
+      end
+
+      # Returns nil instead of loading constants that are still autoloads.
+      def resolve_constant(path)
+        path.split("::").reduce(Object) do |scope, name|
+          return nil unless scope.is_a?(Module)
+          return nil if scope.autoload?(name, false) || !scope.const_defined?(name, false)
+          scope.const_get(name, false)
+        end
+      end
+
+      def write_report
+        report_path = "#{@output}.txt"
+        folded_path = "#{@output}.folded"
+        File.write(report_path, report)
+        File.open(folded_path, "w") { |file| write_folded(file, @root, []) }
+        $stderr.puts format("rrtrace: boot took %.3f s; report in %s, flame graph stacks in %s",
+          @root.inclusive_ns / 1e9, report_path, folded_path)
+      end
+
+      def report
+        nodes = []
+        each_descendant(@root) { |node| nodes << node }
+
+        lines = []
+        lines << format("Boot: %.3f s, %d files loaded", @root.inclusive_ns / 1e9, nodes.size)
+        lines << ""
+        lines << "Slowest files by self time:"
+        lines << format("%12s %12s  %s", "self ms", "inclusive ms", "path")
+        nodes.max_by(REPORT_LIMIT, &:self_ns).each do |node|
+          lines << format("%12.1f %12.1f  %s", node.self_ns / 1e6, node.inclusive_ns / 1e6, node.path)
+        end
+        lines << ""
+        lines << "Require tree (files over #{REPORT_TREE_THRESHOLD_NS / 1_000_000} ms inclusive):"
+        lines << format("%12s %12s  %s", "inclusive ms", "self ms", "path")
+        append_tree(lines, @root, 0)
+        lines.join("\n") << "\n"
+      end
+
+      def each_descendant(node, &block)
+        node.children.each do |child|
+          yield child
+          each_descendant(child, &block)
+        end
+      end
+
+      def append_tree(lines, node, depth)
+        lines << format("%12.1f %12.1f  %s%s", node.inclusive_ns / 1e6, node.self_ns / 1e6, "  " * depth, node.path)
+        node.children.each do |child|
+          append_tree(lines, child, depth + 1) if child.inclusive_ns >= REPORT_TREE_THRESHOLD_NS
+        end
+      end
+
+      # One "root;parent;file microseconds" line per file with self time.
+      def write_folded(file, node, stack)
+        stack.push(node.path.tr(";", "_"))
+        self_us = node.self_ns / 1000
+        file.puts "#{stack.join(";")} #{self_us}" if self_us > 0
+        node.children.each { |child| write_folded(file, child, stack) }
+        stack.pop
+      end
+    end
+  end
+end
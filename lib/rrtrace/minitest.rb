@@ -0,0 +1,22 @@
+# frozen_string_literal: true
+
+require "minitest"
+require "rrtrace/test_profiler"
+
+module Rrtrace
+  class TestProfiler
+    # Profiles every Minitest test with Rrtrace::TestProfiler.default.
+    # Require it from test_helper.rb.
+    module Minitest
+      def run
+        result = nil
+        location = self.class.instance_method(name).source_location&.join(":")
+        TestProfiler.default.measure("#{self.class.name}##{name}", location) { result = super }
+        result
+      end
+    end
+  end
+end
+
+Minitest::Test.prepend(Rrtrace::TestProfiler::Minitest)
+Minitest.after_run { Rrtrace::TestProfiler.default.finish }
@@ -0,0 +1,51 @@
+# frozen_string_literal: true
+
+require "rrtrace"
+require "active_support/notifications"
+
+module Rrtrace
+  # Records ActiveSupport::Notifications events as spans in the annotation
+  # lane, so SQL, cache, view and job time lines up with the call boxes:
+  #
+  #   require "rrtrace/notifications"
+  #   Rrtrace::Notifications.subscribe
+  #
+  # The subscriber implements `start` and `finish`, which run on the
+  # instrumenting thread when the event begins and ends. The span timestamps
+  # therefore come from the same clock as every other rrtrace event, and no
+  # event object or payload is built for it. Only the event name is recorded;
+  # each name is interned once.
+  module Notifications
+    DEFAULT_PATTERN = /
+      \A(?:
+        sql\.active_record |
+        instantiation\.active_record |
+        cache_\w+\.active_support |
+        render_\w+\.action_view |
+        process_action\.action_controller |
+        perform\.active_job |
+        enqueue\w*\.active_job
+      )\z
+    /x
+
+    class Subscriber
+      def start(name, _id, _payload)
+        Rrtrace.span_begin(name)
+      end
+
+      def finish(name, _id, _payload)
+        Rrtrace.span_end(name)
+      end
+    end
+
+    # Subscribes to the events matching `pattern` and returns the
+    # subscription for `unsubscribe`.
+    def self.subscribe(pattern = DEFAULT_PATTERN)
+      ::ActiveSupport::Notifications.subscribe(pattern, Subscriber.new)
+    end
+
+    def self.unsubscribe(subscription)
+      ::ActiveSupport::Notifications.unsubscribe(subscription)
+    end
+  end
+end
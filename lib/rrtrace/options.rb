@@ -0,0 +1,129 @@
+# frozen_string_literal: true
+
+module Rrtrace
+  # The configuration of a tracing session, validated before anything is
+  # started. `Rrtrace.start` builds one from its keywords, and
+  # `Options.from_env` from the RRTRACE_OPTS environment variable:
+  #
+  #   RRTRACE_OPTS="output=headless exclude=^(Kernel|BasicObject)# events=call,gc"
+  class Options
+    EVENTS = %i[call c_call gc].freeze
+    OUTPUTS = %i[window record headless export].freeze
+    BACKPRESSURES = %i[block drop].freeze
+    DEFAULT_OUTPUT_PATHS = {
+      record: "rrtrace.rec",
+      headless: "rrtrace-summary.txt",
+      export: "rrtrace-trace.json"
+    }.freeze
+    DEFAULT_RING_SIZE = 65_536
+    RING_SIZES = (1024..2**24).freeze
+    # The visualizer always keeps the last 5 seconds on screen.
+    MIN_RETENTION = 5.0
+    DEFAULT_MAX_FPS = 60
+    MAX_FPS = (1..1000).freeze
+    DEFAULT_HISTORY_MB = 256
+    HISTORY_MB = (0..65_536).freeze
+    # Including the terminating NUL of the path in shared memory.
+    OUTPUT_PATH_MAX = 1024
+
+    attr_reader :events, :sample_interval_ms, :selective, :ring_size, :backpressure,
+      :include, :exclude, :output, :output_path, :retention, :coalesce, :max_fps,
+      :history_mb
+
+    # `events` selects what is recorded besides thread scheduling: Ruby
+    # method calls, C method calls and GC runs. `ring_size` is the number of
+    # events the shared ring holds, a power of two. When the visualizer falls
+    # behind, `backpressure: :block` waits for it and `:drop` drops events
+    # and reports how many when tracing stops. `include` and `exclude` are
+    # matched against "Class#method" when a method is first called; calls to
+    # excluded methods are not recorded. `output` is where the session goes:
+    # the visualizer window, a recording, a headless per-method summary or a
+    # Chrome trace JSON file, the last three written to `output_path`.
+    # `retention` is how many seconds of history the visualizer keeps.
+    # `coalesce` draws a run of identical sibling calls without children,
+    # like the calls in a tight loop, as one striped box. `max_fps` caps how
+    # often the visualizer window redraws. `history_mb` is the memory the
+    # visualizer keeps older data in, compressed, for scrolling back past the
+    # retention; 0 turns that off.
+    def initialize(events: EVENTS, sample_interval_ms: nil, selective: false, ring_size: DEFAULT_RING_SIZE,
+      backpressure: :block, include: nil, exclude: nil, output: :window, output_path: nil, retention: MIN_RETENTION,
+      coalesce: true, max_fps: DEFAULT_MAX_FPS, history_mb: DEFAULT_HISTORY_MB)
+      @events = Array(events).map(&:to_sym).uniq.freeze
+      unknown = @events - EVENTS
+      raise ArgumentError, "unknown events: #{unknown.join(", ")}; expected some of #{EVENTS.join(", ")}" unless unknown.empty?
+
+      @sample_interval_ms = sample_interval_ms && Integer(sample_interval_ms)
+      if @sample_interval_ms && @sample_interval_ms <= 0
+        raise ArgumentError, "sample_interval_ms must be positive: #{@sample_interval_ms}"
+      end
+
+      @selective = selective ? true : false
+
+      @ring_size = Integer(ring_size)
+      unless RING_SIZES.cover?(@ring_size) && (@ring_size & (@ring_size - 1)).zero?
+        raise ArgumentError, "ring_size must be a power of two in #{RING_SIZES}: #{@ring_size}"
+      end
+
+      @backpressure = choice(:backpressure, backpressure, BACKPRESSURES)
+      @include = pattern(include)
+      @exclude = pattern(exclude)
+      @output = choice(:output, output, OUTPUTS)
+
+      @output_path = output_path && File.expand_path(output_path)
+      @output_path ||= File.expand_path(DEFAULT_OUTPUT_PATHS[@output]) unless @output == :window
+      if @output_path && @output_path.bytesize >= OUTPUT_PATH_MAX
+        raise ArgumentError, "output_path must be shorter than #{OUTPUT_PATH_MAX} bytes"
+      end
+      @output_path&.freeze
+
+      @retention = Float(retention)
+      raise ArgumentError, "retention must be at least #{MIN_RETENTION} seconds: #{@retention}" if @retention < MIN_RETENTION
+
+      @coalesce = coalesce ? true : false
+
+      @max_fps = Integer(max_fps)
+      raise ArgumentError, "max_fps must be in #{MAX_FPS}: #{@max_fps}" unless MAX_FPS.cover?(@max_fps)
+
+      @history_mb = Integer(history_mb)
+      raise ArgumentError, "history_mb must be in #{HISTORY_MB}: #{@history_mb}" unless HISTORY_MB.cover?(@history_mb)
+
+      freeze
+    end
+
+    # Parses space-separated "key=value" pairs, with comma-separated values
+    # for `events`. A key without a value is true.
+    def self.parse(string)
+      kwargs = string.split.to_h do |pair|
+        key, separator, value = pair.partition("=")
+        key = key.to_sym
+        raise ArgumentError, "unknown option in #{string.inspect}: #{key}" unless instance_method(:initialize).parameters.any? { |_, name| name == key }
+
+        value = separator.empty? ? true : value
+        value = value.split(",") if key == :events
+        value = %w[true 1 yes].include?(value) if %i[selective coalesce].include?(key) && value.is_a?(String)
+        [key, value]
+      end
+      new(**kwargs)
+    end
+
+    def self.from_env(env = ENV)
+      parse(env.fetch("RRTRACE_OPTS", ""))
+    end
+
+    private
+
+    def choice(name, value, choices)
+      value = value.to_sym
+      raise ArgumentError, "#{name} must be one of #{choices.join(", ")}: #{value}" unless choices.include?(value)
+      value
+    end
+
+    def pattern(value)
+      case value
+      when nil, Regexp then value
+      when String then Regexp.new(value)
+      else raise ArgumentError, "expected a Regexp or String pattern: #{value.inspect}"
+      end
+    end
+  end
+end
@@ -0,0 +1,58 @@
+# frozen_string_literal: true
+
+require "rrtrace"
+
+module Rrtrace
+  # Rack middleware that traces a sampled subset of requests. Start tracing
+  # with `Rrtrace.start(selective: true)` so that only the sampled requests
+  # record method calls:
+  #
+  #   Rrtrace.start(selective: true)
+  #   use Rrtrace::Rack, every: 100, header: "X-Rrtrace", path: %r{\A/checkout}
+  #
+  # A request is sampled when it carries `header`, when its path matches
+  # `path`, or otherwise one in `every` requests at random. Without any
+  # option every request is sampled. Sampled requests are wrapped in a
+  # "rack.request" span and get their own context id, so the visualizer can
+  # show them one at a time. Unsampled requests only pay for the decision.
+  class Rack
+    SPAN_NAME = :"rack.request"
+    MAX_CONTEXT_ID = 0xFFFF_FFFF
+
+    def initialize(app, every: nil, header: nil, path: nil)
+      raise ArgumentError, "every must be a positive Integer: #{every.inspect}" unless every.nil? || (every.is_a?(Integer) && every.positive?)
+
+      @app = app
+      @every = every
+      @header_key = header && "HTTP_#{header.upcase.tr("-", "_")}"
+      @path = path
+      @next_context_id = 0
+      @mutex = Mutex.new
+    end
+
+    def call(env)
+      return @app.call(env) unless Rrtrace.started? && sampled?(env)
+
+      Rrtrace.with_context(next_context_id) do
+        Rrtrace.trace do
+          Rrtrace.span(SPAN_NAME) { @app.call(env) }
+        end
+      end
+    end
+
+    private
+
+    def sampled?(env)
+      return true if @header_key && env.key?(@header_key)
+      return true if @path&.match?(env["PATH_INFO"].to_s)
+      return rand(@every).zero? if @every
+      !@header_key && !@path
+    end
+
+    def next_context_id
+      @mutex.synchronize do
+        @next_context_id = @next_context_id % MAX_CONTEXT_ID + 1
+      end
+    end
+  end
+end
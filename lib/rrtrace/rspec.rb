@@ -0,0 +1,15 @@
+# frozen_string_literal: true
+
+require "rspec/core"
+require "rrtrace/test_profiler"
+
+# Profiles every example with Rrtrace::TestProfiler.default. Require it from
+# spec_helper.rb or with `rspec -r rrtrace/rspec`.
+RSpec.configure do |config|
+  profiler = Rrtrace::TestProfiler.default
+  config.before(:suite) { profiler.start }
+  config.around(:each) do |example|
+    profiler.measure(example.full_description, example.location) { example.run }
+  end
+  config.after(:suite) { profiler.finish }
+end
@@ -2,4 +2,4 @@
 
 require "rrtrace"
 
-Rrtrace.start
+Rrtrace.start(Rrtrace::Options.from_env)
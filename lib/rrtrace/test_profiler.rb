@@ -0,0 +1,83 @@
+# frozen_string_literal: true
+
+require "rrtrace"
+
+module Rrtrace
+  # Per-test time, GC time, allocations and slowest methods, shared by the
+  # RSpec and Minitest integrations in "rrtrace/rspec" and
+  # "rrtrace/minitest".
+  #
+  # Tracing runs in selective mode and is only enabled inside tests, so code
+  # between tests is not recorded. Each test is a span named after it in the
+  # visualizer. At the end of the run the slowest tests are written to
+  # `output` with the methods that took the most self time in each.
+  class TestProfiler
+    Result = Struct.new(:name, :location, :wall_ns, :gc_ms, :allocations, :methods)
+
+    def self.default
+      @default ||= new
+    end
+
+    def initialize(output: "rrtrace-tests.txt", limit: 50, top_methods: 5)
+      @output = output
+      @limit = limit
+      @top_methods = top_methods
+      @results = []
+      @mutex = Mutex.new
+    end
+
+    def start
+      Rrtrace.start(selective: true) unless Rrtrace.started?
+    end
+
+    # GC time and allocations are process-wide, so tests running in parallel
+    # threads see each other's.
+    def measure(name, location)
+      gc_ms = GC.stat(:time)
+      allocations = GC.stat(:total_allocated_objects)
+      started_at = Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond)
+      methods = Rrtrace.trace do
+        Rrtrace.span(name) do
+          Rrtrace.self_time(top: @top_methods) { yield }
+        end
+      end
+      result = Result.new(
+        name,
+        location,
+        Process.clock_gettime(Process::CLOCK_MONOTONIC, :nanosecond) - started_at,
+        GC.stat(:time) - gc_ms,
+        GC.stat(:total_allocated_objects) - allocations,
+        methods
+      )
+      @mutex.synchronize { @results << result }
+    end
+
+    def finish
+      results = @mutex.synchronize { @results.dup }
+      return if results.empty?
+
+      File.write(@output, report(results))
+      $stderr.puts "rrtrace: test profile for #{results.size} tests written to #{@output}"
+    end
+
+    private
+
+    def report(results)
+      total_ns = results.sum(&:wall_ns)
+      lines = []
+      lines << format("%d tests, %.3f s in tests, %.3f s in GC, %d objects allocated",
+        results.size, total_ns / 1e9, results.sum(&:gc_ms) / 1e3, results.sum(&:allocations))
+      lines << ""
+      lines << "Slowest tests:"
+      lines << format("%10s %8s %12s  %s", "time ms", "gc ms", "allocations", "test")
+      results.max_by(@limit, &:wall_ns).each do |result|
+        lines << format("%10.1f %8d %12d  %s (%s)",
+          result.wall_ns / 1e6, result.gc_ms, result.allocations, result.name, result.location)
+        result.methods.each do |method_name, self_ns|
+          lines << format("%33.1f ms self  %s", self_ns / 1e6, method_name)
+        end
+      end
+      lines.join("\n") << "\n"
+    end
+  end
+end
@@ -0,0 +1,241 @@
+use crate::metadata::Metadata;
+use crate::ringbuffer::{RRTraceEvent, RRTraceEventType};
+use crate::symbol_table::SymbolTable;
+use std::collections::HashMap;
+use std::fmt::Write;
+
+const REPORT_LIMIT: usize = 100;
+
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct MethodStats {
+    pub calls: u64,
+    /// Time between call and return. Recursive calls count at every level.
+    pub total_ns: u64,
+    pub self_ns: u64,
+}
+
+#[derive(Debug)]
+struct Frame {
+    key: u32,
+    start: u64,
+    child_ns: u64,
+}
+
+/// Per-method totals for the headless output mode, which keeps no events.
+#[derive(Debug)]
+pub struct Aggregate {
+    symbols: SymbolTable,
+    methods: Vec<MethodStats>,
+    stacks: HashMap<u32, Vec<Frame>>,
+    current_thread: Option<u32>,
+    gc_start: Option<u64>,
+    gc_ns: u64,
+    gc_count: u64,
+    first_time: Option<u64>,
+    last_time: u64,
+}
+
+impl Aggregate {
+    pub fn new() -> Aggregate {
+        Aggregate {
+            symbols: SymbolTable::new(),
+            methods: Vec::new(),
+            stacks: HashMap::new(),
+            // Tracing starts on the main thread, whose id is 0.
+            current_thread: Some(0),
+            gc_start: None,
+            gc_ns: 0,
+            gc_count: 0,
+            first_time: None,
+            last_time: 0,
+        }
+    }
+
+    pub fn metadata(&mut self, metadata: Metadata) {
+        match metadata {
+            Metadata::Method(info) => {
+                self.symbols.insert_method(info);
+            }
+            Metadata::Name(info) => self.symbols.insert_name(info.key, info.name),
+        }
+    }
+
+    pub fn record(&mut self, events: &[RRTraceEvent]) {
+        for event in events {
+            let time = event.timestamp();
+            self.first_time.get_or_insert(time);
+            self.last_time = self.last_time.max(time);
+            match event.event_type() {
+                RRTraceEventType::Call => {
+                    if let Some(thread) = self.current_thread {
+                        self.stacks.entry(thread).or_default().push(Frame {
+                            key: event.data() as u32,
+                            start: time,
+                            child_ns: 0,
+                        });
+                    }
+                }
+                RRTraceEventType::Return => {
+                    if let Some(thread) = self.current_thread {
+                        self.pop(thread, time);
+                    }
+                }
+                RRTraceEventType::GCStart => self.gc_start = Some(time),
+                RRTraceEventType::GCEnd => {
+                    if let Some(start) = self.gc_start.take() {
+                        self.gc_ns += time.saturating_sub(start);
+                        self.gc_count += 1;
+                    }
+                }
+                RRTraceEventType::ThreadResume => self.current_thread = Some(event.data() as u32),
+                RRTraceEventType::ThreadSuspended => self.current_thread = None,
+                _ => {}
+            }
+        }
+    }
+
+    /// Ignores returns from frames entered before tracing started.
+    fn pop(&mut self, thread: u32, time: u64) {
+        let Some(stack) = self.stacks.get_mut(&thread) else {
+            return;
+        };
+        let Some(frame) = stack.pop() else {
+            return;
+        };
+        let elapsed = time.saturating_sub(frame.start);
+        if let Some(parent) = stack.last_mut() {
+            parent.child_ns += elapsed;
+        }
+        let index = frame.key as usize;
+        if self.methods.len() <= index {
+            self.methods.resize(index + 1, MethodStats::default());
+        }
+        let stats = &mut self.methods[index];
+        stats.calls += 1;
+        stats.total_ns += elapsed;
+        stats.self_ns += elapsed.saturating_sub(frame.child_ns);
+    }
+
+    /// Ends the frames still open at the last event, such as the methods
+    /// that called `Rrtrace.stop`.
+    pub fn finish(&mut self) {
+        let threads = self.stacks.keys().copied().collect::<Vec<_>>();
+        for thread in threads {
+            while self.stacks[&thread].last().is_some() {
+                self.pop(thread, self.last_time);
+            }
+        }
+    }
+
+    pub fn method(&self, key: u32) -> Option<&MethodStats> {
+        self.methods.get(key as usize)
+    }
+
+    pub fn report(&self) -> String {
+        let traced_ns = self.last_time - self.first_time.unwrap_or(self.last_time);
+        let calls = self.methods.iter().map(|stats| stats.calls).sum::<u64>();
+        let mut report = String::new();
+        writeln!(
+            report,
+            "{:.3} s traced, {} calls, {:.3} s in {} GC runs",
+            traced_ns as f64 / 1e9,
+            calls,
+            self.gc_ns as f64 / 1e9,
+            self.gc_count
+        )
+        .unwrap();
+        writeln!(report).unwrap();
+        writeln!(
+            report,
+            "{:>12} {:>12} {:>10}  method",
+            "self ms", "total ms", "calls"
+        )
+        .unwrap();
+        let mut keys = (0..self.methods.len() as u32)
+            .filter(|&key| self.methods[key as usize].calls > 0)
+            .collect::<Vec<_>>();
+        keys.sort_unstable_by_key(|&key| std::cmp::Reverse(self.methods[key as usize].self_ns));
+        for key in keys.into_iter().take(REPORT_LIMIT) {
+            let stats = &self.methods[key as usize];
+            let name = self.symbols.method(key).map_or_else(
+                || format!("method {key}"),
+                |symbol| symbol.name().to_owned(),
+            );
+            writeln!(
+                report,
+                "{:>12.3} {:>12.3} {:>10}  {}",
+                stats.self_ns as f64 / 1e6,
+                stats.total_ns as f64 / 1e6,
+                stats.calls,
+                name
+            )
+            .unwrap();
+        }
+        report
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::metadata::MethodInfo;
+
+    #[test]
+    fn self_time_excludes_children_per_thread() {
+        let mut aggregate = Aggregate::new();
+        aggregate.metadata(Metadata::Method(MethodInfo {
+            key: 0,
+            class_path: "Foo".to_owned(),
+            method_name: "outer".to_owned(),
+            source_path: String::new(),
+        }));
+        aggregate.record(&[
+            RRTraceEvent::new(RRTraceEventType::Call, 100, 0),
+            RRTraceEvent::new(RRTraceEventType::Call, 120, 1),
+            // Thread 1 runs while thread 0 is suspended inside key 1.
+            RRTraceEvent::new(RRTraceEventType::ThreadSuspended, 130, 0),
+            RRTraceEvent::new(RRTraceEventType::ThreadResume, 130, 1),
+            RRTraceEvent::new(RRTraceEventType::Call, 135, 1),
+            RRTraceEvent::new(RRTraceEventType::Return, 145, 1),
+            RRTraceEvent::new(RRTraceEventType::ThreadSuspended, 150, 1),
+            RRTraceEvent::new(RRTraceEventType::ThreadResume, 150, 0),
+            RRTraceEvent::new(RRTraceEventType::Return, 160, 1),
+            RRTraceEvent::new(RRTraceEventType::Return, 200, 0),
+            // Returns from before tracing started are ignored.
+            RRTraceEvent::new(RRTraceEventType::Return, 210, 7),
+        ]);
+        aggregate.finish();
+
+        assert_eq!(
+            aggregate.method(0),
+            Some(&MethodStats {
+                calls: 1,
+                total_ns: 100,
+                self_ns: 60,
+            })
+        );
+        assert_eq!(
+            aggregate.method(1),
+            Some(&MethodStats {
+                calls: 2,
+                total_ns: 50,
+                self_ns: 50,
+            })
+        );
+        assert!(aggregate.report().contains("Foo#outer"));
+    }
+
+    #[test]
+    fn finish_closes_open_frames_at_the_last_event() {
+        let mut aggregate = Aggregate::new();
+        aggregate.record(&[
+            RRTraceEvent::new(RRTraceEventType::Call, 10, 3),
+            RRTraceEvent::new(RRTraceEventType::GCStart, 20, 0),
+            RRTraceEvent::new(RRTraceEventType::GCEnd, 50, 0),
+        ]);
+        aggregate.finish();
+
+        assert_eq!(aggregate.method(3).map(|stats| stats.total_ns), Some(40));
+        assert!(aggregate.report().contains("0.000 s in 1 GC runs"));
+    }
+}
@@ -0,0 +1,292 @@
+use crate::metadata::Metadata;
+use crate::ringbuffer::{RRTraceEvent, RRTraceEventType};
+use crate::symbol_table::SymbolTable;
+use std::collections::HashMap;
+use std::io::{self, Write};
+
+/// Streams a session as Chrome trace event JSON for the export output mode,
+/// which chrome://tracing, Perfetto and speedscope open.
+///
+/// Calls and GC become duration events on the thread they ran on. Spans
+/// become async events there instead, since they begin and end in different
+/// method frames while duration events must nest. Marks become instant
+/// events and counters become counter events. Timestamps are in
+/// microseconds since the tracer started.
+pub struct ChromeTraceExport<W: Write> {
+    out: W,
+    symbols: SymbolTable,
+    first_event: bool,
+    current_thread: Option<u32>,
+    /// Open duration events per thread, so returns from frames entered
+    /// before tracing started are dropped instead of unbalancing the thread.
+    depths: HashMap<u32, usize>,
+    /// Open spans per thread and name, for the same reason.
+    spans: HashMap<(u32, u32), usize>,
+}
+
+impl<W: Write> ChromeTraceExport<W> {
+    pub fn new(mut out: W) -> io::Result<ChromeTraceExport<W>> {
+        out.write_all(b"{\"displayTimeUnit\":\"ns\",\"traceEvents\":[")?;
+        let mut export = ChromeTraceExport {
+            out,
+            symbols: SymbolTable::new(),
+            first_event: true,
+            current_thread: None,
+            depths: HashMap::new(),
+            spans: HashMap::new(),
+        };
+        export.resume(0)?;
+        Ok(export)
+    }
+
+    pub fn metadata(&mut self, metadata: Metadata) {
+        match metadata {
+            Metadata::Method(info) => {
+                self.symbols.insert_method(info);
+            }
+            Metadata::Name(info) => self.symbols.insert_name(info.key, info.name),
+        }
+    }
+
+    pub fn record(&mut self, events: &[RRTraceEvent]) -> io::Result<()> {
+        for event in events {
+            let time = event.timestamp();
+            let key = event.data() as u32;
+            match event.event_type() {
+                RRTraceEventType::Call => {
+                    let name = self.symbols.method(key).map_or_else(
+                        || format!("method {key}"),
+                        |symbol| symbol.name().to_owned(),
+                    );
+                    self.begin(&name, "ruby", time)?;
+                }
+                RRTraceEventType::SpanBegin => self.span(key, 'b', time)?,
+                RRTraceEventType::SpanEnd => self.span(key, 'e', time)?,
+                RRTraceEventType::GCStart => self.begin("GC", "gc", time)?,
+                RRTraceEventType::Return | RRTraceEventType::GCEnd => self.end(time)?,
+                RRTraceEventType::Mark => {
+                    if let Some(thread) = self.current_thread {
+                        let name = self.name(key);
+                        self.write_event(format_args!(
+                            "\"ph\":\"i\",\"s\":\"t\",\"name\":{},\"cat\":\"annotation\",\"tid\":{thread},\"ts\":{}",
+                            JsonString(&name),
+                            Micros(time)
+                        ))?;
+                    }
+                }
+                RRTraceEventType::Counter => {
+                    let name = self.name((event.data() >> 32) as u32);
+                    let value = f32::from_bits(event.data() as u32);
+                    // JSON has no NaN or infinity.
+                    if value.is_finite() {
+                        self.write_event(format_args!(
+                            "\"ph\":\"C\",\"name\":{},\"tid\":0,\"ts\":{},\"args\":{{\"value\":{value}}}",
+                            JsonString(&name),
+                            Micros(time)
+                        ))?;
+                    }
+                }
+                RRTraceEventType::ThreadResume => self.resume(key)?,
+                RRTraceEventType::ThreadSuspended => self.current_thread = None,
+                RRTraceEventType::ThreadStart
+                | RRTraceEventType::ThreadReady
+                | RRTraceEventType::ThreadExit
+                | RRTraceEventType::Context => {}
+            }
+        }
+        Ok(())
+    }
+
+    pub fn finish(mut self) -> io::Result<W> {
+        self.out.write_all(b"\n]}\n")?;
+        self.out.flush()?;
+        Ok(self.out)
+    }
+
+    fn name(&self, key: u32) -> String {
+        self.symbols
+            .name(key)
+            .map_or_else(|| format!("name {key}"), str::to_owned)
+    }
+
+    /// Names the thread the first time it runs.
+    fn resume(&mut self, thread: u32) -> io::Result<()> {
+        self.current_thread = Some(thread);
+        if self.depths.contains_key(&thread) {
+            return Ok(());
+        }
+        self.depths.insert(thread, 0);
+        let name = if thread == 0 {
+            "main thread".to_owned()
+        } else {
+            format!("thread {thread}")
+        };
+        self.write_event(format_args!(
+            "\"ph\":\"M\",\"name\":\"thread_name\",\"tid\":{thread},\"args\":{{\"name\":\"{name}\"}}"
+        ))
+    }
+
+    fn begin(&mut self, name: &str, category: &str, time: u64) -> io::Result<()> {
+        let Some(thread) = self.current_thread else {
+            return Ok(());
+        };
+        *self.depths.entry(thread).or_default() += 1;
+        self.write_event(format_args!(
+            "\"ph\":\"B\",\"name\":{},\"cat\":\"{category}\",\"tid\":{thread},\"ts\":{}",
+            JsonString(name),
+            Micros(time)
+        ))
+    }
+
+    fn end(&mut self, time: u64) -> io::Result<()> {
+        let Some(thread) = self.current_thread else {
+            return Ok(());
+        };
+        let depth = self.depths.entry(thread).or_default();
+        if *depth == 0 {
+            return Ok(());
+        }
+        *depth -= 1;
+        self.write_event(format_args!(
+            "\"ph\":\"E\",\"tid\":{thread},\"ts\":{}",
+            Micros(time)
+        ))
+    }
+
+    /// Begins (`b`) or ends (`e`) a span, identified by its thread and name.
+    fn span(&mut self, key: u32, phase: char, time: u64) -> io::Result<()> {
+        let Some(thread) = self.current_thread else {
+            return Ok(());
+        };
+        let open = self.spans.entry((thread, key)).or_default();
+        if phase == 'b' {
+            *open += 1;
+        } else if *open == 0 {
+            return Ok(());
+        } else {
+            *open -= 1;
+        }
+        let name = self.name(key);
+        self.write_event(format_args!(
+            "\"ph\":\"{phase}\",\"name\":{},\"cat\":\"annotation\",\"id\":\"{thread}:{key}\",\"tid\":{thread},\"ts\":{}",
+            JsonString(&name),
+            Micros(time)
+        ))
+    }
+
+    fn write_event(&mut self, fields: std::fmt::Arguments) -> io::Result<()> {
+        let separator = if std::mem::replace(&mut self.first_event, false) {
+            "\n"
+        } else {
+            ",\n"
+        };
+        write!(self.out, "{separator}{{\"pid\":1,{fields}}}")
+    }
+}
+
+struct Micros(u64);
+
+impl std::fmt::Display for Micros {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(f, "{}.{:03}", self.0 / 1000, self.0 % 1000)
+    }
+}
+
+struct JsonString<'a>(&'a str);
+
+impl std::fmt::Display for JsonString<'_> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.write_str("\"")?;
+        for c in self.0.chars() {
+            match c {
+                '"' => f.write_str("\\\"")?,
+                '\\' => f.write_str("\\\\")?,
+                c if (c as u32) < 0x20 => write!(f, "\\u{:04x}", c as u32)?,
+                c => write!(f, "{c}")?,
+            }
+        }
+        f.write_str("\"")
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::metadata::NameInfo;
+
+    #[test]
+    fn writes_balanced_duration_events_per_thread() {
+        let mut export = ChromeTraceExport::new(Vec::new()).unwrap();
+        export.metadata(Metadata::Name(NameInfo {
+            key: 1,
+            name: "say \"hi\"".to_owned(),
+        }));
+        export
+            .record(&[
+                RRTraceEvent::new(RRTraceEventType::Return, 1_000, 0),
+                RRTraceEvent::new(RRTraceEventType::Call, 1_500, 5),
+                RRTraceEvent::new(RRTraceEventType::Mark, 1_750, 1),
+                RRTraceEvent::new(RRTraceEventType::ThreadSuspended, 2_000, 0),
+                RRTraceEvent::new(RRTraceEventType::ThreadResume, 2_000, 1),
+                RRTraceEvent::new(RRTraceEventType::Return, 2_500, 5),
+                RRTraceEvent::new(
+                    RRTraceEventType::Counter,
+                    3_000,
+                    1 << 32 | 1.5f32.to_bits() as u64,
+                ),
+            ])
+            .unwrap();
+        let json = String::from_utf8(export.finish().unwrap()).unwrap();
+
+        let expected = [
+            r#"{"displayTimeUnit":"ns","traceEvents":["#,
+            r#"{"pid":1,"ph":"M","name":"thread_name","tid":0,"args":{"name":"main thread"}},"#,
+            r#"{"pid":1,"ph":"B","name":"method 5","cat":"ruby","tid":0,"ts":1.500},"#,
+            r#"{"pid":1,"ph":"i","s":"t","name":"say \"hi\"","cat":"annotation","tid":0,"ts":1.750},"#,
+            r#"{"pid":1,"ph":"M","name":"thread_name","tid":1,"args":{"name":"thread 1"}},"#,
+            r#"{"pid":1,"ph":"C","name":"say \"hi\"","tid":0,"ts":3.000,"args":{"value":1.5}}"#,
+            "]}",
+            "",
+        ]
+        .join("\n");
+        assert_eq!(json, expected);
+    }
+
+    #[test]
+    fn spans_are_async_events_independent_of_method_frames() {
+        let mut export = ChromeTraceExport::new(Vec::new()).unwrap();
+        export.metadata(Metadata::Name(NameInfo {
+            key: 1,
+            name: "request".to_owned(),
+        }));
+        // The span begins inside one call and ends inside another; a span
+        // end without its begin is dropped.
+        export
+            .record(&[
+                RRTraceEvent::new(RRTraceEventType::Call, 1_000, 5),
+                RRTraceEvent::new(RRTraceEventType::SpanBegin, 1_100, 1),
+                RRTraceEvent::new(RRTraceEventType::Return, 1_200, 5),
+                RRTraceEvent::new(RRTraceEventType::Call, 1_300, 6),
+                RRTraceEvent::new(RRTraceEventType::SpanEnd, 1_400, 1),
+                RRTraceEvent::new(RRTraceEventType::Return, 1_500, 6),
+                RRTraceEvent::new(RRTraceEventType::SpanEnd, 1_600, 1),
+            ])
+            .unwrap();
+        let json = String::from_utf8(export.finish().unwrap()).unwrap();
+
+        let expected = [
+            r#"{"displayTimeUnit":"ns","traceEvents":["#,
+            r#"{"pid":1,"ph":"M","name":"thread_name","tid":0,"args":{"name":"main thread"}},"#,
+            r#"{"pid":1,"ph":"B","name":"method 5","cat":"ruby","tid":0,"ts":1.000},"#,
+            r#"{"pid":1,"ph":"b","name":"request","cat":"annotation","id":"0:1","tid":0,"ts":1.100},"#,
+            r#"{"pid":1,"ph":"E","tid":0,"ts":1.200},"#,
+            r#"{"pid":1,"ph":"B","name":"method 6","cat":"ruby","tid":0,"ts":1.300},"#,
+            r#"{"pid":1,"ph":"e","name":"request","cat":"annotation","id":"0:1","tid":0,"ts":1.400},"#,
+            r#"{"pid":1,"ph":"E","tid":0,"ts":1.500}"#,
+            "]}",
+            "",
+        ]
+        .join("\n");
+        assert_eq!(json, expected);
+    }
+}
@@ -0,0 +1,63 @@
+use crate::trace_state::SlowTrace;
+use std::collections::HashMap;
+
+/// Totals of one `Rrtrace.with_context` id, such as a request.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct ContextSummary {
+    pub first_time: u64,
+    pub last_time: u64,
+    /// Time any thread spent running inside the context.
+    pub running_ns: u64,
+    pub calls: u64,
+}
+
+impl ContextSummary {
+    pub fn wall_ns(&self) -> u64 {
+        self.last_time - self.first_time
+    }
+}
+
+#[derive(Debug, Default)]
+pub struct ContextStats {
+    contexts: HashMap<u32, ContextSummary>,
+}
+
+impl ContextStats {
+    pub fn new() -> ContextStats {
+        ContextStats::default()
+    }
+
+    pub fn record(&mut self, trace: &SlowTrace) {
+        for period in trace.data().iter().flat_map(|data| data.context_periods()) {
+            let summary = self
+                .contexts
+                .entry(period.context())
+                .or_insert(ContextSummary {
+                    first_time: period.start_time(),
+                    last_time: period.end_time(),
+                    running_ns: 0,
+                    calls: 0,
+                });
+            summary.first_time = summary.first_time.min(period.start_time());
+            summary.last_time = summary.last_time.max(period.end_time());
+            summary.running_ns += period.end_time() - period.start_time();
+            summary.calls += period.calls() as u64;
+        }
+    }
+
+    /// Forgets contexts that were last active before `time`.
+    pub fn evict_before(&mut self, time: u64) {
+        self.contexts.retain(|_, summary| summary.last_time >= time);
+    }
+
+    pub fn get(&self, context: u32) -> Option<&ContextSummary> {
+        self.contexts.get(&context)
+    }
+
+    /// Context ids, most recently active first.
+    pub fn recent(&self) -> Vec<u32> {
+        let mut ids = self.contexts.keys().copied().collect::<Vec<_>>();
+        ids.sort_unstable_by_key(|id| std::cmp::Reverse((self.contexts[id].last_time, *id)));
+        ids
+    }
+}
@@ -0,0 +1,305 @@
+use crate::trace_state::SlowTrace;
+use crate::varint;
+use std::collections::{BTreeMap, VecDeque};
+
+const BLOCK_LEN: usize = 256;
+/// Samples newer than this stay uncompressed, so batches finished out of
+/// order by the parallel trace workers can still be merged in order.
+const SEAL_DELAY: u64 = 100_000_000;
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Sample {
+    pub time: u64,
+    pub value: f32,
+}
+
+/// Summary of the samples falling into one time bucket. Drawing the range
+/// plus the first and last value keeps spikes visible at any zoom level.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Bucket {
+    pub min: f32,
+    pub max: f32,
+    pub first: f32,
+    pub last: f32,
+}
+
+impl Bucket {
+    fn new(value: f32) -> Bucket {
+        Bucket {
+            min: value,
+            max: value,
+            first: value,
+            last: value,
+        }
+    }
+
+    /// Appends `later`, which covers samples after the ones in `self`.
+    fn extend(&mut self, later: Bucket) {
+        self.min = self.min.min(later.min);
+        self.max = self.max.max(later.max);
+        self.last = later.last;
+    }
+}
+
+fn add_to(bucket: &mut Option<Bucket>, later: Bucket) {
+    match bucket {
+        Some(bucket) => bucket.extend(later),
+        None => *bucket = Some(later),
+    }
+}
+
+/// Up to `BLOCK_LEN` samples. After the first, each sample is stored as the
+/// varint time delta followed by the XOR with the previous value's bits,
+/// bit-reversed so that the usual changes in sign, exponent and high
+/// mantissa bits end up in the low bits and encode in one or two bytes.
+#[derive(Debug)]
+struct Block {
+    first: Sample,
+    last: Sample,
+    min: f32,
+    max: f32,
+    len: usize,
+    bytes: Box<[u8]>,
+}
+
+impl Block {
+    fn encode(samples: &[Sample]) -> Block {
+        let mut bytes = Vec::new();
+        let mut min = f32::INFINITY;
+        let mut max = f32::NEG_INFINITY;
+        let mut previous = samples[0];
+        for sample in samples {
+            min = min.min(sample.value);
+            max = max.max(sample.value);
+            varint::write(&mut bytes, sample.time - previous.time);
+            let xor = sample.value.to_bits() ^ previous.value.to_bits();
+            varint::write(&mut bytes, xor.reverse_bits() as u64);
+            previous = *sample;
+        }
+        Block {
+            first: samples[0],
+            last: samples[samples.len() - 1],
+            min,
+            max,
+            len: samples.len(),
+            bytes: bytes.into_boxed_slice(),
+        }
+    }
+
+    fn decode(&self, out: &mut Vec<Sample>) {
+        let mut position = 0;
+        let mut previous = self.first;
+        for _ in 0..self.len {
+            let time = previous.time + varint::read(&self.bytes, &mut position);
+            let xor = (varint::read(&self.bytes, &mut position) as u32).reverse_bits();
+            let sample = Sample {
+                time,
+                value: f32::from_bits(previous.value.to_bits() ^ xor),
+            };
+            out.push(sample);
+            previous = sample;
+        }
+    }
+
+    fn summary(&self) -> Bucket {
+        Bucket {
+            min: self.min,
+            max: self.max,
+            first: self.first.value,
+            last: self.last.value,
+        }
+    }
+}
+
+#[derive(Debug, Default)]
+pub struct CounterSeries {
+    blocks: VecDeque<Block>,
+    recent: Vec<Sample>,
+}
+
+impl CounterSeries {
+    /// Samples older than the compressed part of the series arrived too late
+    /// to be placed and are dropped.
+    pub fn insert(&mut self, sample: Sample) {
+        if let Some(block) = self.blocks.back()
+            && sample.time < block.last.time
+        {
+            return;
+        }
+        match self.recent.last() {
+            Some(last) if sample.time < last.time => {
+                let index = self.recent.partition_point(|s| s.time <= sample.time);
+                self.recent.insert(index, sample);
+            }
+            _ => self.recent.push(sample),
+        }
+        while self.recent.len() >= BLOCK_LEN
+            && self.recent[BLOCK_LEN - 1].time + SEAL_DELAY <= self.recent.last().unwrap().time
+        {
+            self.blocks
+                .push_back(Block::encode(&self.recent[..BLOCK_LEN]));
+            self.recent.drain(..BLOCK_LEN);
+        }
+    }
+
+    pub fn evict_before(&mut self, time: u64) {
+        while self
+            .blocks
+            .front()
+            .is_some_and(|block| block.last.time < time)
+        {
+            self.blocks.pop_front();
+        }
+        if self.blocks.is_empty() {
+            self.recent.retain(|sample| sample.time >= time);
+        }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.blocks.is_empty() && self.recent.is_empty()
+    }
+
+    /// Fills `buckets[i]` with the samples in
+    /// `start + i * bucket_ns .. start + (i + 1) * bucket_ns`. Blocks that fall
+    /// into a single bucket are merged from their header without decoding.
+    pub fn downsample(&self, start: u64, bucket_ns: u64, buckets: &mut [Option<Bucket>]) {
+        let end = start + bucket_ns * buckets.len() as u64;
+        let bucket_of = |time: u64| ((time - start) / bucket_ns) as usize;
+        let mut decoded = Vec::with_capacity(BLOCK_LEN);
+        for block in &self.blocks {
+            if block.last.time < start || block.first.time >= end {
+                continue;
+            }
+            if block.first.time >= start
+                && block.last.time < end
+                && bucket_of(block.first.time) == bucket_of(block.last.time)
+            {
+                add_to(&mut buckets[bucket_of(block.first.time)], block.summary());
+                continue;
+            }
+            decoded.clear();
+            block.decode(&mut decoded);
+            for sample in &decoded {
+                if (start..end).contains(&sample.time) {
+                    add_to(
+                        &mut buckets[bucket_of(sample.time)],
+                        Bucket::new(sample.value),
+                    );
+                }
+            }
+        }
+        let first = self.recent.partition_point(|sample| sample.time < start);
+        for sample in &self.recent[first..] {
+            if sample.time >= end {
+                break;
+            }
+            add_to(
+                &mut buckets[bucket_of(sample.time)],
+                Bucket::new(sample.value),
+            );
+        }
+    }
+}
+
+/// All counter series by interned name key.
+#[derive(Debug, Default)]
+pub struct Counters {
+    series: BTreeMap<u32, CounterSeries>,
+}
+
+impl Counters {
+    pub fn new() -> Counters {
+        Counters::default()
+    }
+
+    pub fn record(&mut self, trace: &SlowTrace) {
+        for sample in trace.counters() {
+            self.series
+                .entry(sample.name_key())
+                .or_default()
+                .insert(Sample {
+                    time: sample.time(),
+                    value: sample.value(),
+                });
+        }
+    }
+
+    pub fn evict_before(&mut self, time: u64) {
+        self.series.retain(|_, series| {
+            series.evict_before(time);
+            !series.is_empty()
+        });
+    }
+
+    pub fn series(&self) -> impl Iterator<Item = (u32, &CounterSeries)> {
+        self.series.iter().map(|(&key, series)| (key, series))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn series(samples: impl IntoIterator<Item = (u64, f32)>) -> CounterSeries {
+        let mut series = CounterSeries::default();
+        for (time, value) in samples {
+            series.insert(Sample { time, value });
+        }
+        series
+    }
+
+    #[test]
+    fn blocks_round_trip() {
+        let samples = (0..BLOCK_LEN as u64)
+            .map(|i| Sample {
+                time: 1000 + i * 37,
+                value: [0.0, -1.5, 3.0, 1e9, f32::MIN_POSITIVE][i as usize % 5],
+            })
+            .collect::<Vec<_>>();
+        let block = Block::encode(&samples);
+        let mut decoded = Vec::new();
+        block.decode(&mut decoded);
+        assert_eq!(decoded, samples);
+        assert_eq!((block.min, block.max), (-1.5, 1e9));
+    }
+
+    #[test]
+    fn downsampling_matches_raw_samples() {
+        let step = SEAL_DELAY / 64;
+        let series = series((0..4000u64).map(|i| (i * step, (i % 97) as f32)));
+        assert!(series.blocks.len() > 10);
+
+        let bucket_ns = step * 300;
+        let mut buckets = vec![None; 10];
+        series.downsample(step * 50, bucket_ns, &mut buckets);
+        for (i, bucket) in buckets.iter().enumerate() {
+            let values = (0..4000u64)
+                .filter(|j| (j * step).saturating_sub(step * 50) / bucket_ns == i as u64)
+                .filter(|j| *j >= 50)
+                .map(|j| (j % 97) as f32)
+                .collect::<Vec<_>>();
+            let bucket = bucket.unwrap();
+            assert_eq!(bucket.first, values[0]);
+            assert_eq!(bucket.last, *values.last().unwrap());
+            assert_eq!(bucket.min, values.iter().copied().fold(f32::MAX, f32::min));
+            assert_eq!(bucket.max, values.iter().copied().fold(f32::MIN, f32::max));
+        }
+    }
+
+    #[test]
+    fn late_samples_are_merged_in_order() {
+        let series = series([(10, 1.0), (30, 3.0), (20, 2.0)]);
+        let mut buckets = vec![None; 2];
+        series.downsample(0, 20, &mut buckets);
+        assert_eq!(buckets[0], Some(Bucket::new(1.0)));
+        assert_eq!(
+            buckets[1],
+            Some(Bucket {
+                min: 2.0,
+                max: 3.0,
+                first: 2.0,
+                last: 3.0,
+            })
+        );
+    }
+}
@@ -0,0 +1,87 @@
+use std::time::{Duration, Instant};
+
+/// How often the window is redrawn only to scroll the timeline, and how
+/// often the trace queue is checked while nothing arrives.
+pub const SCROLL_INTERVAL: Duration = Duration::from_millis(100);
+
+/// Decides when the visualizer wakes up and when it redraws, so it does not
+/// take CPU time from the process it traces. Frames are drawn when data
+/// arrived or the view changed, at most `max_fps` times a second, and only
+/// every `SCROLL_INTERVAL` while the timeline merely scrolls.
+#[derive(Debug)]
+pub struct FrameScheduler {
+    frame_interval: Duration,
+    next_tick: Instant,
+    last_redraw: Instant,
+    dirty: bool,
+}
+
+impl FrameScheduler {
+    pub fn new(max_fps: u32, now: Instant) -> FrameScheduler {
+        FrameScheduler {
+            frame_interval: Duration::from_secs(1) / max_fps.max(1),
+            next_tick: now,
+            last_redraw: now,
+            dirty: true,
+        }
+    }
+
+    /// When the trace queue should be checked next.
+    pub fn next_tick(&self) -> Instant {
+        self.next_tick
+    }
+
+    /// Requests a redraw as soon as the frame rate cap allows, for changes
+    /// to the view.
+    pub fn invalidate(&mut self) {
+        self.dirty = true;
+        self.next_tick = self.next_tick.min(self.last_redraw + self.frame_interval);
+    }
+
+    /// Called at `next_tick` after checking the trace queue, with whether
+    /// new data was taken from it and whether anything is on screen to
+    /// scroll. Returns whether to redraw.
+    pub fn tick(&mut self, now: Instant, updated: bool, scrolling: bool) -> bool {
+        self.dirty |= updated;
+        let redraw = self.dirty || (scrolling && now >= self.last_redraw + SCROLL_INTERVAL);
+        if redraw {
+            self.dirty = false;
+            self.last_redraw = now;
+        }
+        let interval = if updated {
+            self.frame_interval
+        } else {
+            SCROLL_INTERVAL
+        };
+        self.next_tick = now + interval;
+        redraw
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn redraws_on_changes_at_the_cap_and_scrolls_slowly() {
+        let start = Instant::now();
+        let mut frames = FrameScheduler::new(50, start);
+        assert!(frames.tick(start, false, false));
+
+        // Data keeps the queue checked at the frame rate.
+        let at = |ms| start + Duration::from_millis(ms);
+        assert!(frames.tick(at(100), true, true));
+        assert_eq!(frames.next_tick(), at(120));
+
+        // Without data, only scrolling redraws, at the scroll interval.
+        assert!(!frames.tick(at(120), false, true));
+        assert_eq!(frames.next_tick(), at(220));
+        assert!(frames.tick(at(220), false, true));
+        assert!(!frames.tick(at(320), false, false));
+
+        // View changes wait for the cap, not the scroll interval.
+        frames.invalidate();
+        assert_eq!(frames.next_tick(), at(240));
+        assert!(frames.tick(at(420), false, false));
+    }
+}
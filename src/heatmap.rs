@@ -0,0 +1,254 @@
+use crate::trace_state::SlowTrace;
+use std::collections::HashMap;
+
+pub const ROWS: usize = 64;
+pub const COLUMNS: usize = 1024;
+pub const LEVELS: usize = 4;
+const BASE_BUCKET_NS: u64 = 10_000_000;
+const LEVEL_FACTOR: u64 = 16;
+
+#[derive(Debug, Clone, Copy)]
+struct Counter {
+    key: u32,
+    weight: u64,
+}
+
+/// Space-Saving sketch over busy time. Each counter owns one heatmap row, so
+/// a method keeps its row for as long as it stays among the heavy hitters.
+#[derive(Debug, Default)]
+struct HeavyHitters {
+    counters: Vec<Counter>,
+    index: HashMap<u32, usize>,
+}
+
+impl HeavyHitters {
+    /// Returns the row assigned to `key` and whether it was taken over from
+    /// another method and therefore has to be cleared.
+    fn offer(&mut self, key: u32, weight: u64) -> (usize, bool) {
+        if let Some(&row) = self.index.get(&key) {
+            self.counters[row].weight += weight;
+            return (row, false);
+        }
+        if self.counters.len() < ROWS {
+            self.counters.push(Counter { key, weight });
+            self.index.insert(key, self.counters.len() - 1);
+            return (self.counters.len() - 1, false);
+        }
+        let (row, min) = self
+            .counters
+            .iter()
+            .copied()
+            .enumerate()
+            .min_by_key(|(_, counter)| counter.weight)
+            .unwrap();
+        self.index.remove(&min.key);
+        self.index.insert(key, row);
+        self.counters[row] = Counter {
+            key,
+            weight: min.weight + weight,
+        };
+        (row, true)
+    }
+}
+
+/// Ring of `COLUMNS` buckets per row. `head` is the absolute index of the
+/// newest bucket, the oldest visible one is `head + 1 - COLUMNS`.
+#[derive(Debug)]
+struct Level {
+    bucket_ns: u64,
+    head: u64,
+    cells: Box<[f32]>,
+}
+
+impl Level {
+    fn new(bucket_ns: u64) -> Level {
+        Level {
+            bucket_ns,
+            head: 0,
+            cells: vec![0.0; ROWS * COLUMNS].into_boxed_slice(),
+        }
+    }
+
+    fn advance(&mut self, bucket: u64) {
+        if bucket <= self.head {
+            return;
+        }
+        let cleared = (bucket - self.head).min(COLUMNS as u64);
+        for b in bucket + 1 - cleared..=bucket {
+            let column = (b % COLUMNS as u64) as usize;
+            for row in 0..ROWS {
+                self.cells[row * COLUMNS + column] = 0.0;
+            }
+        }
+        self.head = bucket;
+    }
+
+    fn clear_row(&mut self, row: usize) {
+        self.cells[row * COLUMNS..(row + 1) * COLUMNS].fill(0.0);
+    }
+
+    fn add(&mut self, row: usize, start: u64, end: u64) {
+        let first = start / self.bucket_ns;
+        let last = (end - 1) / self.bucket_ns;
+        self.advance(last);
+        let oldest = (self.head + 1).saturating_sub(COLUMNS as u64);
+        if last < oldest {
+            return;
+        }
+        let cells = &mut self.cells[row * COLUMNS..(row + 1) * COLUMNS];
+        if first == last {
+            cells[(first % COLUMNS as u64) as usize] += (end - start) as f32;
+            return;
+        }
+        if first >= oldest {
+            let first_end = (first + 1) * self.bucket_ns;
+            cells[(first % COLUMNS as u64) as usize] += (first_end - start) as f32;
+        }
+        cells[(last % COLUMNS as u64) as usize] += (end - last * self.bucket_ns) as f32;
+
+        // Buckets strictly between the first and the last are fully covered.
+        // The ring splits them into at most two contiguous runs, which the
+        // compiler turns into vector adds.
+        let full_start = (first + 1).max(oldest);
+        if full_start >= last {
+            return;
+        }
+        let full = self.bucket_ns as f32;
+        let begin = (full_start % COLUMNS as u64) as usize;
+        let end = begin + (last - full_start) as usize;
+        if end <= COLUMNS {
+            add_to_all(&mut cells[begin..end], full);
+        } else {
+            add_to_all(&mut cells[begin..], full);
+            add_to_all(&mut cells[..end - COLUMNS], full);
+        }
+    }
+}
+
+#[inline(always)]
+fn add_to_all(cells: &mut [f32], value: f32) {
+    for cell in cells {
+        *cell += value;
+    }
+}
+
+/// Methods x time buckets of busy time, for the top `ROWS` methods by total
+/// busy time. Level 0 uses 10 ms buckets and every further level is 16 times
+/// coarser, so a fixed amount of memory covers from seconds up to hours.
+#[derive(Debug)]
+pub struct Heatmap {
+    heavy_hitters: HeavyHitters,
+    levels: Vec<Level>,
+    dirty: bool,
+}
+
+impl Heatmap {
+    pub fn new() -> Heatmap {
+        Heatmap {
+            heavy_hitters: HeavyHitters::default(),
+            levels: (0..LEVELS as u32)
+                .map(|level| Level::new(BASE_BUCKET_NS * LEVEL_FACTOR.pow(level)))
+                .collect(),
+            dirty: false,
+        }
+    }
+
+    pub fn record(&mut self, trace: &SlowTrace) {
+        for thread_data in trace.data() {
+            for call_box in thread_data.call_boxes() {
+                let start = call_box.start_time_ns();
+                let end = call_box.end_time_ns();
+                if end <= start {
+                    continue;
+                }
+                let (row, replaced) = self.heavy_hitters.offer(call_box.method_id(), end - start);
+                for level in &mut self.levels {
+                    if replaced {
+                        level.clear_row(row);
+                    }
+                    level.add(row, start, end);
+                }
+                self.dirty = true;
+            }
+        }
+    }
+
+    /// Returns whether anything was recorded since the last call.
+    pub fn take_dirty(&mut self) -> bool {
+        std::mem::take(&mut self.dirty)
+    }
+
+    pub fn cells(&self, level: usize) -> &[f32] {
+        &self.levels[level].cells
+    }
+
+    pub fn head(&self, level: usize) -> u64 {
+        self.levels[level].head
+    }
+
+    pub fn bucket_ns(&self, level: usize) -> u64 {
+        self.levels[level].bucket_ns
+    }
+
+    /// Method key per row, with `u32::MAX` for unused rows.
+    pub fn row_keys(&self) -> [u32; ROWS] {
+        let mut keys = [u32::MAX; ROWS];
+        for (row, counter) in self.heavy_hitters.counters.iter().enumerate() {
+            keys[row] = counter.key;
+        }
+        keys
+    }
+
+    /// Rows ordered by descending busy time.
+    pub fn row_order(&self) -> [u32; ROWS] {
+        let mut order: [u32; ROWS] = std::array::from_fn(|row| row as u32);
+        let counters = &self.heavy_hitters.counters;
+        order.sort_by_key(|&row| {
+            std::cmp::Reverse(counters.get(row as usize).map_or(0, |c| c.weight))
+        });
+        order
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn interval_is_split_across_buckets() {
+        let mut level = Level::new(10);
+        level.add(0, 5, 42);
+        assert_eq!(&level.cells[..5], &[5.0, 10.0, 10.0, 10.0, 2.0]);
+        assert_eq!(level.head, 4);
+    }
+
+    #[test]
+    fn advancing_clears_reused_columns() {
+        let mut level = Level::new(10);
+        level.add(0, 0, 10);
+        level.add(0, COLUMNS as u64 * 10, COLUMNS as u64 * 10 + 3);
+        assert_eq!(level.cells[0], 3.0);
+    }
+
+    #[test]
+    fn full_buckets_wrap_around_the_ring() {
+        let mut level = Level::new(1);
+        level.advance(COLUMNS as u64 - 2);
+        level.add(1, COLUMNS as u64 - 2, COLUMNS as u64 + 2);
+        let row = &level.cells[COLUMNS..2 * COLUMNS];
+        assert_eq!(row[COLUMNS - 2..], [1.0, 1.0]);
+        assert_eq!(row[..2], [1.0, 1.0]);
+        assert_eq!(row.iter().sum::<f32>(), 4.0);
+    }
+
+    #[test]
+    fn heavy_hitters_replace_the_lightest_row() {
+        let mut heavy_hitters = HeavyHitters::default();
+        for key in 0..ROWS as u32 {
+            heavy_hitters.offer(key, 100 + key as u64);
+        }
+        assert_eq!(heavy_hitters.offer(5, 1), (5, false));
+        assert_eq!(heavy_hitters.offer(1000, 1), (0, true));
+        assert_eq!(heavy_hitters.counters[0].weight, 101);
+    }
+}
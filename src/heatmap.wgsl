@@ -0,0 +1,56 @@
+const COLUMNS: u32 = 1024u;
+const ROWS: u32 = 64u;
+const QUAD_MIN: vec2<f32> = vec2<f32>(-0.95, -0.95);
+const QUAD_MAX: vec2<f32> = vec2<f32>(0.95, -0.55);
+
+struct HeatmapParams {
+    head_column: u32,
+    bucket_ns: f32,
+    _padding: vec2<u32>,
+    rows: array<vec4<u32>, ROWS>, // x: texture row, y: method key
+}
+
+struct PaletteEntry {
+    color: u32, // rgba8, r in the lowest byte
+    category: u32,
+}
+
+@group(0) @binding(0)
+var<uniform> params: HeatmapParams;
+
+@group(0) @binding(1)
+var cells: texture_2d<f32>;
+
+@group(1) @binding(0)
+var<storage, read> palette: array<PaletteEntry>;
+
+struct VertexOutput {
+    @builtin(position) clip_position: vec4<f32>,
+    @location(0) uv: vec2<f32>,
+}
+
+@vertex
+fn vs_heatmap(@builtin(vertex_index) index: u32) -> VertexOutput {
+    let uv = vec2<f32>(f32(index & 1u), f32(index >> 1u));
+
+    var out: VertexOutput;
+    out.uv = uv;
+    out.clip_position = vec4<f32>(mix(QUAD_MIN, QUAD_MAX, uv), 0.0, 1.0);
+    return out;
+}
+
+@fragment
+fn fs_heatmap(in: VertexOutput) -> @location(0) vec4<f32> {
+    // Heaviest method on top, newest bucket on the right.
+    let display_row = min(u32((1.0 - in.uv.y) * f32(ROWS)), ROWS - 1u);
+    let offset = min(u32(in.uv.x * f32(COLUMNS)), COLUMNS - 1u);
+    let column = (params.head_column + 1u + offset) % COLUMNS;
+    let row = params.rows[display_row];
+
+    let busy = textureLoad(cells, vec2<u32>(column, row.x), 0).r / params.bucket_ns;
+    var color = vec3<f32>(0.6, 0.6, 0.6);
+    if (row.y < arrayLength(&palette) && palette[row.y].color != 0u) {
+        color = unpack4x8unorm(palette[row.y].color).rgb;
+    }
+    return vec4<f32>(color * clamp(busy, 0.0, 1.0), 0.85);
+}
@@ -0,0 +1,321 @@
+use crate::lod;
+use crate::trace_state::{CallBox, SlowTrace, decode_time};
+use crate::varint;
+use std::collections::BTreeMap;
+
+/// What the renderer draws of one batch.
+#[derive(Debug, Clone, PartialEq)]
+pub struct Batch {
+    pub end_time: u64,
+    pub max_depth: u32,
+    pub threads: Vec<BatchThread>,
+    pub gc_events: Vec<u64>,
+}
+
+#[derive(Debug, Clone, PartialEq)]
+pub struct BatchThread {
+    pub thread_id: u32,
+    /// Boxes per `lod` level, `None` above level 0 where the level is the
+    /// same as the finer one.
+    pub levels: Vec<Option<Vec<CallBox>>>,
+    pub annotation_boxes: Vec<CallBox>,
+    pub marks: Vec<u64>,
+    pub line_start: u64,
+    pub line_end: u64,
+}
+
+impl Batch {
+    pub fn from_trace(trace: &SlowTrace) -> Batch {
+        Batch {
+            end_time: trace.end_time(),
+            max_depth: trace.max_depth(),
+            threads: trace
+                .data()
+                .iter()
+                .map(|data| BatchThread {
+                    thread_id: data.thread_id(),
+                    levels: (0..lod::LEVELS)
+                        .map(|level| data.lod_boxes(level).map(<[CallBox]>::to_vec))
+                        .collect(),
+                    annotation_boxes: data.annotation_boxes().to_vec(),
+                    marks: data.marks().iter().map(|mark| mark.time()).collect(),
+                    line_start: decode_time(data.thread_line().start_time()),
+                    line_end: decode_time(data.thread_line().end_time()),
+                })
+                .collect(),
+            gc_events: trace.gc_events().to_vec(),
+        }
+    }
+
+    pub fn start_time(&self) -> u64 {
+        self.threads
+            .iter()
+            .map(|thread| thread.line_start)
+            .chain(self.gc_events.iter().copied())
+            .min()
+            .unwrap_or(self.end_time)
+            .min(self.end_time)
+    }
+
+    /// Varints with times as deltas from the previous time, which takes
+    /// about a quarter of the size of the boxes.
+    pub fn encode(&self) -> Vec<u8> {
+        let mut bytes = Vec::new();
+        varint::write(&mut bytes, self.end_time);
+        varint::write(&mut bytes, self.max_depth as u64);
+        varint::write(&mut bytes, self.threads.len() as u64);
+        for thread in &self.threads {
+            varint::write(&mut bytes, thread.thread_id as u64);
+            varint::write(&mut bytes, thread.line_start);
+            varint::write(&mut bytes, thread.line_end - thread.line_start);
+            for level in &thread.levels {
+                match level {
+                    Some(boxes) => {
+                        varint::write(&mut bytes, boxes.len() as u64 + 1);
+                        write_boxes(&mut bytes, boxes);
+                    }
+                    None => varint::write(&mut bytes, 0),
+                }
+            }
+            varint::write(&mut bytes, thread.annotation_boxes.len() as u64);
+            write_boxes(&mut bytes, &thread.annotation_boxes);
+            write_times(&mut bytes, &thread.marks);
+        }
+        write_times(&mut bytes, &self.gc_events);
+        bytes.shrink_to_fit();
+        bytes
+    }
+
+    pub fn decode(bytes: &[u8]) -> Batch {
+        let mut position = 0;
+        let mut read = || varint::read(bytes, &mut position);
+        let end_time = read();
+        let max_depth = read() as u32;
+        let threads = (0..read())
+            .map(|_| {
+                let thread_id = read() as u32;
+                let line_start = read();
+                let line_end = line_start + read();
+                let levels = (0..lod::LEVELS)
+                    .map(|_| match read() {
+                        0 => None,
+                        len => Some(read_boxes(&mut read, len - 1)),
+                    })
+                    .collect();
+                let len = read();
+                let annotation_boxes = read_boxes(&mut read, len);
+                let marks = read_times(&mut read);
+                BatchThread {
+                    thread_id,
+                    levels,
+                    annotation_boxes,
+                    marks,
+                    line_start,
+                    line_end,
+                }
+            })
+            .collect();
+        let gc_events = read_times(&mut read);
+        Batch {
+            end_time,
+            max_depth,
+            threads,
+            gc_events,
+        }
+    }
+}
+
+fn zigzag(delta: i64) -> u64 {
+    ((delta << 1) ^ (delta >> 63)) as u64
+}
+
+fn unzigzag(value: u64) -> i64 {
+    (value >> 1) as i64 ^ -((value & 1) as i64)
+}
+
+fn write_boxes(bytes: &mut Vec<u8>, boxes: &[CallBox]) {
+    let mut previous = 0;
+    for call_box in boxes {
+        let start = call_box.start_time_ns();
+        varint::write(bytes, zigzag(start.wrapping_sub(previous) as i64));
+        varint::write(bytes, call_box.end_time_ns() - start);
+        varint::write(bytes, call_box.method_id() as u64);
+        varint::write(bytes, call_box.depth() as u64);
+        varint::write(bytes, call_box.context() as u64);
+        varint::write(bytes, call_box.count() as u64);
+        varint::write(bytes, call_box.busy_time() as u64);
+        previous = start;
+    }
+}
+
+fn read_boxes(read: &mut impl FnMut() -> u64, len: u64) -> Vec<CallBox> {
+    let mut previous = 0u64;
+    (0..len)
+        .map(|_| {
+            let start = previous.wrapping_add(unzigzag(read()) as u64);
+            let end = start + read();
+            let method_id = read() as u32;
+            let depth = read() as u32;
+            let context = read() as u32;
+            let count = read() as u32;
+            let busy_time = read() as u32;
+            previous = start;
+            CallBox::new(start, end, method_id, depth, context).with_run(count, busy_time)
+        })
+        .collect()
+}
+
+fn write_times(bytes: &mut Vec<u8>, times: &[u64]) {
+    varint::write(bytes, times.len() as u64);
+    let mut previous = 0;
+    for &time in times {
+        varint::write(bytes, zigzag(time.wrapping_sub(previous) as i64));
+        previous = time;
+    }
+}
+
+fn read_times(read: &mut impl FnMut() -> u64) -> Vec<u64> {
+    let mut previous = 0u64;
+    (0..read())
+        .map(|_| {
+            previous = previous.wrapping_add(unzigzag(read()) as u64);
+            previous
+        })
+        .collect()
+}
+
+#[derive(Debug)]
+struct StoredBatch {
+    start_time: u64,
+    bytes: Box<[u8]>,
+}
+
+/// Identifies a stored batch by its end time and the order it was stored
+/// in.
+pub type BatchKey = (u64, u64);
+
+/// Encoded batches that are not on the GPU, kept so that the renderer can
+/// upload them again when the view is scrolled back to them. They are
+/// sorted by end time whatever order they arrive in, and the oldest are
+/// dropped when the total size exceeds the budget.
+#[derive(Debug)]
+pub struct History {
+    batches: BTreeMap<BatchKey, StoredBatch>,
+    next_sequence: u64,
+    bytes: usize,
+    budget: usize,
+}
+
+impl History {
+    pub fn new(budget: usize) -> History {
+        History {
+            batches: BTreeMap::new(),
+            next_sequence: 0,
+            bytes: 0,
+            budget,
+        }
+    }
+
+    pub fn is_enabled(&self) -> bool {
+        self.budget > 0
+    }
+
+    pub fn push(&mut self, start_time: u64, end_time: u64, bytes: Box<[u8]>) {
+        self.bytes += bytes.len();
+        self.batches.insert(
+            (end_time, self.next_sequence),
+            StoredBatch { start_time, bytes },
+        );
+        self.next_sequence += 1;
+        while self.bytes > self.budget
+            && let Some((_, batch)) = self.batches.pop_first()
+        {
+            self.bytes -= batch.bytes.len();
+        }
+    }
+
+    /// Start of the oldest batch.
+    pub fn start_time(&self) -> Option<u64> {
+        self.batches
+            .first_key_value()
+            .map(|(_, batch)| batch.start_time)
+    }
+
+    /// Keys of the batches overlapping `start..end`, in key order.
+    pub fn overlapping(&self, start: u64, end: u64) -> Vec<BatchKey> {
+        self.batches
+            .range((start, 0)..)
+            .take_while(|(_, batch)| batch.start_time < end)
+            .map(|(&key, _)| key)
+            .collect()
+    }
+
+    pub fn get(&self, key: BatchKey) -> Option<Batch> {
+        Some(Batch::decode(&self.batches.get(&key)?.bytes))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn batch(end_time: u64) -> Batch {
+        let mut coalesced = CallBox::new(end_time - 900, end_time - 500, 7, 1, 2);
+        coalesced = coalesced.with_run(4, 300);
+        Batch {
+            end_time,
+            max_depth: 2,
+            threads: vec![BatchThread {
+                thread_id: 3,
+                levels: vec![
+                    Some(vec![
+                        CallBox::new(end_time - 1000, end_time, 5, 0, 0),
+                        coalesced,
+                        CallBox::new(end_time - 950, end_time - 920, 6, 1, 0),
+                    ]),
+                    None,
+                    Some(vec![CallBox::new(end_time - 1000, end_time, 5, 0, 0)]),
+                    None,
+                ],
+                annotation_boxes: vec![CallBox::new(end_time - 800, end_time - 100, 9, 0, 0)],
+                marks: vec![end_time - 10, end_time - 20],
+                line_start: end_time - 1000,
+                line_end: end_time,
+            }],
+            gc_events: vec![end_time - 50],
+        }
+    }
+
+    #[test]
+    fn batches_round_trip_through_their_encoding() {
+        let batch = batch(1_000_000_000);
+
+        let bytes = batch.encode();
+
+        assert_eq!(Batch::decode(&bytes), batch);
+        assert_eq!(batch.start_time(), 1_000_000_000 - 1000);
+        assert!(bytes.len() < size_of::<CallBox>() * 5);
+    }
+
+    #[test]
+    fn history_drops_the_oldest_batches_beyond_its_budget() {
+        let mut history = History::new(30);
+        // Batches skipped during a backlog can be stored before older ones.
+        for end_time in [1000, 3000, 2000] {
+            history.push(end_time - 1000, end_time, vec![0; 10].into());
+        }
+        assert_eq!(
+            history.overlapping(500, 2500),
+            [(1000, 0), (2000, 2), (3000, 1)]
+        );
+        assert_eq!(history.overlapping(2500, 2600), [(3000, 1)]);
+
+        history.push(3000, 4000, vec![0; 10].into());
+        assert_eq!(history.start_time(), Some(1000));
+        assert_eq!(
+            history.overlapping(0, 5000),
+            [(2000, 2), (3000, 1), (4000, 3)]
+        );
+        assert!(history.get((1000, 0)).is_none());
+    }
+}
@@ -0,0 +1,161 @@
+use crate::trace_state::CallBox;
+use smallvec::SmallVec;
+use std::collections::HashMap;
+
+/// Number of detail levels per batch, level 0 being the call boxes
+/// themselves.
+pub const LEVELS: usize = 4;
+const FINEST_BUCKET_NS: u64 = 50_000;
+const LEVEL_FACTOR: u64 = 8;
+
+/// Width of the time buckets of a level above 0: 50 µs, 400 µs and 3.2 ms.
+pub fn bucket_ns(level: usize) -> u64 {
+    debug_assert!((1..LEVELS).contains(&level));
+    FINEST_BUCKET_NS * LEVEL_FACTOR.pow(level as u32 - 1)
+}
+
+/// The coarsest level whose buckets still fit in one pixel, so the merged
+/// boxes are no wider than a pixel.
+pub fn level_for(ns_per_pixel: f64) -> usize {
+    (1..LEVELS)
+        .rev()
+        .find(|&level| bucket_ns(level) as f64 <= ns_per_pixel)
+        .unwrap_or(0)
+}
+
+#[derive(Debug)]
+struct Bucket {
+    start_time: u64,
+    end_time: u64,
+    /// Busy time per method in the bucket.
+    methods: SmallVec<[(u32, u64); 4]>,
+}
+
+/// Merges the boxes shorter than `bucket_ns` that start in the same bucket
+/// at the same depth and context into one box, colored by the method with
+/// the most time in it. Longer boxes are kept as they are. Returns `None`
+/// when nothing would be merged, so the finer level can be drawn instead.
+pub fn coarsen(boxes: &[CallBox], bucket_ns: u64) -> Option<Vec<CallBox>> {
+    let mut coarse = Vec::new();
+    let mut buckets = HashMap::<(u32, u32, u64), Bucket>::new();
+    for call_box in boxes {
+        let start_time = call_box.start_time_ns();
+        let end_time = call_box.end_time_ns();
+        let duration = end_time.saturating_sub(start_time);
+        if duration >= bucket_ns {
+            coarse.push(*call_box);
+            continue;
+        }
+        let bucket = buckets
+            .entry((call_box.depth(), call_box.context(), start_time / bucket_ns))
+            .or_insert_with(|| Bucket {
+                start_time,
+                end_time,
+                methods: SmallVec::new(),
+            });
+        bucket.start_time = bucket.start_time.min(start_time);
+        bucket.end_time = bucket.end_time.max(end_time);
+        match bucket
+            .methods
+            .iter_mut()
+            .find(|(method_id, _)| *method_id == call_box.method_id())
+        {
+            Some((_, busy)) => *busy += duration,
+            None => bucket.methods.push((call_box.method_id(), duration)),
+        }
+    }
+    if coarse.len() + buckets.len() == boxes.len() {
+        return None;
+    }
+    coarse.extend(buckets.into_iter().map(|((depth, context, _), bucket)| {
+        let (method_id, _) = bucket
+            .methods
+            .iter()
+            .copied()
+            .max_by_key(|&(method_id, busy)| (busy, std::cmp::Reverse(method_id)))
+            .unwrap();
+        CallBox::new(
+            bucket.start_time,
+            bucket.end_time,
+            method_id,
+            depth,
+            context,
+        )
+    }));
+    coarse.sort_unstable_by_key(|call_box| (call_box.start_time_ns(), call_box.depth()));
+    Some(coarse)
+}
+
+/// Levels 1 and up of a thread's boxes in a batch. Each level is `None`
+/// where it would be the same as the level below.
+pub fn build(boxes: &[CallBox]) -> Vec<Option<Vec<CallBox>>> {
+    (1..LEVELS)
+        .map(|level| coarsen(boxes, bucket_ns(level)))
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn short_siblings_merge_into_the_dominant_method() {
+        let boxes = [
+            CallBox::new(0, 100_000, 1, 0, 0),
+            CallBox::new(1_000, 2_000, 2, 1, 0),
+            CallBox::new(2_000, 2_500, 3, 1, 0),
+            CallBox::new(3_000, 4_000, 2, 1, 0),
+            // Another context is never merged with the rest.
+            CallBox::new(4_000, 5_000, 2, 1, 7),
+            CallBox::new(60_000, 61_000, 3, 1, 0),
+        ];
+
+        let coarse = coarsen(&boxes, 50_000).unwrap();
+
+        let coarse = coarse
+            .iter()
+            .map(|b| {
+                (
+                    b.start_time_ns(),
+                    b.end_time_ns(),
+                    b.method_id(),
+                    b.depth(),
+                    b.context(),
+                )
+            })
+            .collect::<Vec<_>>();
+        assert_eq!(
+            coarse,
+            [
+                (0, 100_000, 1, 0, 0),
+                (1_000, 4_000, 2, 1, 0),
+                (4_000, 5_000, 2, 1, 7),
+                (60_000, 61_000, 3, 1, 0),
+            ]
+        );
+    }
+
+    #[test]
+    fn levels_without_merges_fall_back_to_the_finer_one() {
+        let boxes = [
+            CallBox::new(0, 10_000_000, 1, 0, 0),
+            CallBox::new(100, 200, 2, 1, 0),
+            CallBox::new(300, 400, 2, 1, 0),
+        ];
+
+        let levels = build(&boxes);
+
+        assert_eq!(levels.len(), LEVELS - 1);
+        assert_eq!(levels[0].as_ref().map(Vec::len), Some(2));
+        assert_eq!(levels[2].as_ref().map(Vec::len), Some(2));
+        assert!(build(&boxes[..1]).iter().all(Option::is_none));
+    }
+
+    #[test]
+    fn level_for_picks_the_coarsest_bucket_within_a_pixel() {
+        assert_eq!(level_for(10_000.0), 0);
+        assert_eq!(level_for(50_000.0), 1);
+        assert_eq!(level_for(1_000_000.0), 2);
+        assert_eq!(level_for(100_000_000.0), 3);
+    }
+}
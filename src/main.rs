@@ -1,7 +1,10 @@
+use crate::frame_scheduler::FrameScheduler;
+use crate::metadata::{Metadata, MetadataRingBuffer};
 use crate::object_scatter::ObjectScatter;
 use crate::oneshot_channel::{OneshotReceiver, OneshotSender};
 use crate::renderer::Renderer;
 use crate::ringbuffer::{EventRingBuffer, RRTraceEvent};
+use crate::shared_region::{OutputMode, RRTraceSharedRegion};
 use crate::trace_state::{FastTrace, SlowTrace};
 use crate::universal_notifier::UniversalNotifier;
 use std::collections::VecDeque;
@@ -9,41 +12,159 @@ use std::ffi::CString;
 use std::num::NonZeroUsize;
 use std::sync::{Arc, OnceLock};
 use std::time::{Duration, Instant};
-use std::{env, mem, thread};
+use std::{env, mem, process, thread};
 use winit::application::ApplicationHandler;
 use winit::event::*;
 use winit::event_loop::{ControlFlow, EventLoop};
+use winit::keyboard::{Key, NamedKey};
 use winit::window::Window;
 
+mod aggregate;
+mod chrome_trace;
+mod context_stats;
+mod counters;
+mod frame_scheduler;
+mod heatmap;
+mod history;
+mod lod;
+mod metadata;
 mod object_scatter;
+mod occurrence_index;
 mod oneshot_channel;
+mod output;
+mod recorder;
 mod renderer;
 mod ringbuffer;
+mod search;
+mod shared_region;
 #[cfg_attr(unix, path = "shm_unix.rs")]
 #[cfg_attr(windows, path = "shm_windows.rs")]
 mod shm;
+mod symbol_table;
 mod trace_state;
 mod universal_notifier;
+mod varint;
 
 struct App {
     window: Option<Arc<Window>>,
     renderer: Renderer,
+    frames: FrameScheduler,
+    /// Search pattern being typed after `/`.
+    search_input: Option<String>,
+    search: Option<String>,
+    title: String,
 }
 
 impl App {
-    fn new(renderer: Renderer) -> Self {
+    fn new(renderer: Renderer, max_fps: u32) -> Self {
         Self {
             window: None,
             renderer,
+            frames: FrameScheduler::new(max_fps, Instant::now()),
+            search_input: None,
+            search: None,
+            title: TITLE.to_owned(),
+        }
+    }
+
+    fn key_pressed(&mut self, event_loop: &winit::event_loop::ActiveEventLoop, key: Key) {
+        if let Some(input) = &mut self.search_input {
+            match key {
+                Key::Named(NamedKey::Enter) => {
+                    self.search = self.search_input.take().filter(|s| !s.is_empty());
+                }
+                Key::Named(NamedKey::Escape) => {
+                    self.search_input = None;
+                    self.renderer.set_search(self.search.as_deref());
+                }
+                Key::Named(NamedKey::Backspace) => {
+                    input.pop();
+                    self.renderer.set_search(Some(input.as_str()));
+                }
+                Key::Character(c) => {
+                    input.push_str(&c);
+                    self.renderer.set_search(Some(input.as_str()));
+                }
+                _ => return,
+            }
+            self.update_title();
+            return;
+        }
+        match key {
+            Key::Named(NamedKey::Escape) if self.search.is_some() => {
+                self.search = None;
+                self.renderer.set_search(None);
+            }
+            Key::Named(NamedKey::Escape) => event_loop.exit(),
+            Key::Character(c) if c.as_str() == "/" => self.search_input = Some(String::new()),
+            Key::Character(c) if c.as_str() == "h" => self.renderer.cycle_heatmap(),
+            Key::Character(c) if c.as_str() == "c" => self.renderer.cycle_context_filter(),
+            Key::Named(NamedKey::Space) => self.renderer.toggle_pause(),
+            Key::Named(NamedKey::ArrowLeft) => self.renderer.scroll(-1),
+            Key::Named(NamedKey::ArrowRight) => self.renderer.scroll(1),
+            Key::Character(c) if c.as_str() == "+" || c.as_str() == "=" => {
+                self.renderer.zoom_by(2.0)
+            }
+            Key::Character(c) if c.as_str() == "-" => self.renderer.zoom_by(0.5),
+            Key::Character(c) if c.as_str() == "n" => {
+                self.renderer.jump_to_match(true);
+            }
+            Key::Character(c) if c.as_str() == "N" => {
+                self.renderer.jump_to_match(false);
+            }
+            Key::Character(c) if c.as_str() == "l" => {
+                self.renderer.cycle_longest_match(true);
+            }
+            Key::Character(c) if c.as_str() == "L" => {
+                self.renderer.cycle_longest_match(false);
+            }
+            _ => return,
+        }
+        self.update_title();
+    }
+
+    /// Refreshes the window title, which shows the search, the selected
+    /// context with its totals and where the view is.
+    fn update_title(&mut self) {
+        let Some(window) = self.window.as_ref() else {
+            return;
+        };
+        let mut title = match (&self.search_input, &self.search) {
+            (Some(input), _) => format!("{TITLE} - /{input}"),
+            (None, Some(search)) => format!("{TITLE} - search: {search}"),
+            (None, None) => TITLE.to_owned(),
+        };
+        if let Some((rank, duration)) = self.renderer.longest_match() {
+            title += &format!(
+                " - longest call {rank}: {:.3} ms",
+                duration.as_secs_f64() * 1e3
+            );
+        }
+        if let Some((context, summary)) = self.renderer.context_filter() {
+            title += &format!(
+                " - context {context}: {:.1} ms running, {:.1} ms wall, {} calls",
+                summary.running_ns as f64 / 1e6,
+                summary.wall_ns() as f64 / 1e6,
+                summary.calls,
+            );
+        }
+        if let Some((behind, zoom)) = self.renderer.view_status() {
+            title += &format!(" - {:.1} s ago, {zoom}x", behind.as_secs_f64());
+        }
+        if title != self.title {
+            window.set_title(&title);
+            self.title = title;
         }
     }
 }
 
+const TITLE: &str = "rrtrace visualizer";
+
 impl ApplicationHandler for App {
     fn resumed(&mut self, event_loop: &winit::event_loop::ActiveEventLoop) {
         let window = Arc::new(
             event_loop
-                .create_window(Window::default_attributes().with_title("rrtrace visualizer"))
+                .create_window(Window::default_attributes().with_title(TITLE))
                 .unwrap(),
         );
         self.renderer.set_window(window.clone());
@@ -61,18 +182,22 @@ impl ApplicationHandler for App {
         };
 
         match event {
-            WindowEvent::CloseRequested
-            | WindowEvent::KeyboardInput {
+            WindowEvent::CloseRequested => event_loop.exit(),
+            WindowEvent::KeyboardInput {
                 event:
                     KeyEvent {
                         state: ElementState::Pressed,
-                        logical_key: winit::keyboard::Key::Named(winit::keyboard::NamedKey::Escape),
+                        logical_key,
                         ..
                     },
                 ..
-            } => event_loop.exit(),
+            } => {
+                self.key_pressed(event_loop, logical_key);
+                self.frames.invalidate();
+            }
             WindowEvent::Resized(physical_size) => {
                 self.renderer.resize(physical_size);
+                self.frames.invalidate();
             }
             WindowEvent::RedrawRequested => match self.renderer.render() {
                 Ok(_) => {}
@@ -84,11 +209,20 @@ impl ApplicationHandler for App {
         }
     }
 
-    fn about_to_wait(&mut self, _event_loop: &winit::event_loop::ActiveEventLoop) {
-        self.renderer.sync();
-        if let Some(window) = self.window.as_ref() {
-            window.request_redraw();
+    fn about_to_wait(&mut self, event_loop: &winit::event_loop::ActiveEventLoop) {
+        let now = Instant::now();
+        if now >= self.frames.next_tick() {
+            let updated = self.renderer.sync();
+            if updated {
+                self.update_title();
+            }
+            if self.frames.tick(now, updated, self.renderer.has_data())
+                && let Some(window) = self.window.as_ref()
+            {
+                window.request_redraw();
+            }
         }
+        event_loop.set_control_flow(ControlFlow::WaitUntil(self.frames.next_tick()));
     }
 }
 
@@ -98,31 +232,54 @@ fn main() {
     BASE_TIME.set(Instant::now()).unwrap();
     assert_eq!(env::args().len(), 2, "Usage: rrtrace <shm_name>");
     let shm_name = env::args().nth(1).unwrap();
+    let shm = Arc::new(unsafe { shm::SharedMemory::open(CString::new(shm_name).unwrap()) });
+    let options = unsafe { RRTraceSharedRegion::options(shm.as_ptr()) };
+    if options.output_mode != OutputMode::Window {
+        if let Err(error) = output::write(shm, &options) {
+            eprintln!(
+                "rrtrace: failed to write {}: {error}",
+                options.output_path.display()
+            );
+            process::exit(1);
+        }
+        return;
+    }
 
     let (instance, adapter, device, queue) = pollster::block_on(init_gpu());
     let event_queue = Arc::new(crossbeam_queue::SegQueue::new());
     let result_queue = Arc::new(crossbeam_queue::SegQueue::new());
+    let metadata_queue = Arc::new(crossbeam_queue::SegQueue::new());
     thread::Builder::new()
         .name("queue pipe".to_owned())
-        .spawn(queue_pipe_thread(shm_name, Arc::clone(&event_queue)))
+        .spawn(queue_pipe_thread(
+            shm,
+            Arc::clone(&event_queue),
+            Arc::clone(&metadata_queue),
+        ))
         .unwrap();
     thread::Builder::new()
         .name("trace".to_owned())
         .spawn(trace_thread(
             Arc::clone(&event_queue),
             Arc::clone(&result_queue),
+            options.coalesce_runs,
         ))
         .unwrap();
 
     let event_loop = EventLoop::new().unwrap();
-    event_loop.set_control_flow(ControlFlow::Poll);
-    let mut app = App::new(Renderer::new(
-        instance,
-        adapter,
-        device,
-        queue,
-        result_queue,
-    ));
+    let mut app = App::new(
+        Renderer::new(
+            instance,
+            adapter,
+            device,
+            queue,
+            result_queue,
+            metadata_queue,
+            options.retention,
+            options.history_budget,
+        ),
+        options.max_fps,
+    );
     event_loop.run_app(&mut app).unwrap();
 }
 
@@ -139,7 +296,7 @@ async fn init_gpu() -> (wgpu::Instance, wgpu::Adapter, wgpu::Device, wgpu::Queue
     let (device, queue) = adapter
         .request_device(&wgpu::DeviceDescriptor {
             label: None,
-            required_features: wgpu::Features::empty(),
+            required_features: adapter.features() & wgpu::Features::INDIRECT_FIRST_INSTANCE,
             required_limits: wgpu::Limits::default(),
             experimental_features: Default::default(),
             memory_hints: Default::default(),
@@ -151,22 +308,26 @@ async fn init_gpu() -> (wgpu::Instance, wgpu::Adapter, wgpu::Device, wgpu::Queue
 }
 
 fn queue_pipe_thread(
-    shm_name: String,
+    shm: Arc<shm::SharedMemory>,
     event_queue: Arc<crossbeam_queue::SegQueue<Arc<[RRTraceEvent]>>>,
+    metadata_queue: Arc<crossbeam_queue::SegQueue<Metadata>>,
 ) -> impl FnOnce() + Send + 'static {
     move || {
-        let shm = unsafe {
-            shm::SharedMemory::open(
-                CString::new(shm_name).unwrap(),
-                mem::size_of::<ringbuffer::RRTraceEventRingBuffer>(),
-            )
+        let region = shm.as_ptr::<RRTraceSharedRegion>();
+        let mut ringbuffer = unsafe {
+            let shm = Arc::clone(&shm);
+            EventRingBuffer::new(RRTraceSharedRegion::events(region), move || drop(shm))
         };
-        let mut ringbuffer = unsafe { EventRingBuffer::new(shm.as_ptr(), move || drop(shm)) };
+        let mut metadata =
+            unsafe { MetadataRingBuffer::new(&raw mut (*region).metadata, move || drop(shm)) };
         let mut buffer = vec![Default::default(); 65536];
         let mut offset = 0;
         let mut before_send_time = 0;
         loop {
             let count = ringbuffer.read(&mut buffer[offset..]);
+            // Metadata is published before the events that refer to it, so
+            // draining it after the events keeps names ahead of their uses.
+            metadata.read(|record| metadata_queue.push(record));
             if count > 0 {
                 offset += count;
                 let chunk = &mut buffer[..offset];
@@ -186,6 +347,7 @@ fn queue_pipe_thread(
 fn trace_thread(
     event_queue: Arc<crossbeam_queue::SegQueue<Arc<[RRTraceEvent]>>>,
     result_queue: Arc<crossbeam_queue::SegQueue<SlowTrace>>,
+    coalesce_runs: bool,
 ) -> impl FnOnce() + Send + 'static {
     move || {
         let parallel_trace_threads = thread::available_parallelism()
@@ -220,7 +382,12 @@ fn trace_thread(
                             }
                             if let Some(data) = second_stage_receiver.try_receive() {
                                 let (start_time, fast_trace, events) = *data;
-                                let trace = SlowTrace::trace(start_time, &fast_trace, &events);
+                                let trace = SlowTrace::trace(
+                                    start_time,
+                                    &fast_trace,
+                                    &events,
+                                    coalesce_runs,
+                                );
                                 result_queue.push(trace);
                                 continue;
                             }
@@ -0,0 +1,214 @@
+use std::sync::atomic::{self, AtomicU64};
+
+const METADATA_KIND_METHOD: u32 = 1;
+const METADATA_KIND_NAME: u32 = 2;
+
+const SIZE: usize = 262_144;
+const MASK: usize = SIZE - 1;
+const HEADER_SIZE: usize = 16;
+
+#[repr(C, align(128))]
+struct RRTraceMetadataRingBufferWriter {
+    write_index: AtomicU64,
+    read_index_cache: u64,
+}
+
+#[repr(C, align(128))]
+struct RRTraceMetadataRingBufferReader {
+    read_index: AtomicU64,
+    write_index_cache: u64,
+}
+
+#[repr(C)]
+pub struct RRTraceMetadataRingBuffer {
+    buffer: [u8; SIZE],
+    writer: RRTraceMetadataRingBufferWriter,
+    reader: RRTraceMetadataRingBufferReader,
+}
+
+impl RRTraceMetadataRingBuffer {
+    unsafe fn copy_out(this: *mut Self, index: u64, out: &mut [u8]) {
+        unsafe {
+            let offset = index as usize & MASK;
+            let first_part_len = (&(*this).buffer)[offset..].len();
+            if out.len() <= first_part_len {
+                out.copy_from_slice(&(&(*this).buffer)[offset..][..out.len()]);
+            } else {
+                out[..first_part_len].copy_from_slice(&(&(*this).buffer)[offset..]);
+                let rest = out.len() - first_part_len;
+                out[first_part_len..].copy_from_slice(&(&(*this).buffer)[..rest]);
+            }
+        }
+    }
+
+    unsafe fn read(this: *mut Self, mut f: impl FnMut(u32, u32, Vec<u8>)) -> usize {
+        unsafe {
+            let read_index = (*this).reader.read_index.load(atomic::Ordering::Acquire);
+            (*this).reader.write_index_cache =
+                (*this).writer.write_index.load(atomic::Ordering::Acquire);
+            let write_index = (*this).reader.write_index_cache;
+
+            let mut index = read_index;
+            let mut count = 0;
+            while index < write_index {
+                let mut header = [0u8; HEADER_SIZE];
+                Self::copy_out(this, index, &mut header);
+                let kind = u32::from_ne_bytes(header[0..4].try_into().unwrap());
+                let key = u32::from_ne_bytes(header[4..8].try_into().unwrap());
+                let length = u32::from_ne_bytes(header[8..12].try_into().unwrap()) as usize;
+                let mut payload = vec![0u8; length];
+                Self::copy_out(this, index + HEADER_SIZE as u64, &mut payload);
+                index += (HEADER_SIZE + length).next_multiple_of(8) as u64;
+                count += 1;
+                f(kind, key, payload);
+            }
+
+            (*this)
+                .reader
+                .read_index
+                .store(index, atomic::Ordering::Release);
+            count
+        }
+    }
+}
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct MethodInfo {
+    pub key: u32,
+    pub class_path: String,
+    pub method_name: String,
+    pub source_path: String,
+}
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct NameInfo {
+    pub key: u32,
+    pub name: String,
+}
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum Metadata {
+    Method(MethodInfo),
+    Name(NameInfo),
+}
+
+impl Metadata {
+    pub fn decode(kind: u32, key: u32, payload: &[u8]) -> Option<Metadata> {
+        match kind {
+            METADATA_KIND_METHOD => {
+                let mut fields = payload
+                    .split(|&b| b == 0)
+                    .map(|field| String::from_utf8_lossy(field).into_owned());
+                Some(Metadata::Method(MethodInfo {
+                    key,
+                    class_path: fields.next().unwrap_or_default(),
+                    method_name: fields.next().unwrap_or_default(),
+                    source_path: fields.next().unwrap_or_default(),
+                }))
+            }
+            METADATA_KIND_NAME => Some(Metadata::Name(NameInfo {
+                key,
+                name: String::from_utf8_lossy(payload).into_owned(),
+            })),
+            _ => None,
+        }
+    }
+
+    /// The kind, key and payload of the record, as `decode` takes them.
+    pub fn encode(&self) -> (u32, u32, Vec<u8>) {
+        match self {
+            Metadata::Method(info) => {
+                let mut payload = Vec::with_capacity(
+                    info.class_path.len() + info.method_name.len() + info.source_path.len() + 2,
+                );
+                payload.extend_from_slice(info.class_path.as_bytes());
+                payload.push(0);
+                payload.extend_from_slice(info.method_name.as_bytes());
+                payload.push(0);
+                payload.extend_from_slice(info.source_path.as_bytes());
+                (METADATA_KIND_METHOD, info.key, payload)
+            }
+            Metadata::Name(info) => (METADATA_KIND_NAME, info.key, info.name.as_bytes().to_vec()),
+        }
+    }
+}
+
+pub struct MetadataRingBuffer {
+    ringbuffer: *mut RRTraceMetadataRingBuffer,
+    drop: Option<Box<dyn FnOnce()>>,
+}
+
+impl MetadataRingBuffer {
+    pub unsafe fn new(
+        ringbuffer: *mut RRTraceMetadataRingBuffer,
+        drop: impl FnOnce() + 'static,
+    ) -> Self {
+        MetadataRingBuffer {
+            ringbuffer,
+            drop: Some(Box::new(drop)),
+        }
+    }
+
+    pub fn read(&mut self, mut f: impl FnMut(Metadata)) -> usize {
+        unsafe {
+            RRTraceMetadataRingBuffer::read(self.ringbuffer, |kind, key, payload| {
+                if let Some(metadata) = Metadata::decode(kind, key, &payload) {
+                    f(metadata);
+                }
+            })
+        }
+    }
+}
+
+impl Drop for MetadataRingBuffer {
+    fn drop(&mut self) {
+        self.drop.take().unwrap()();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn decode_method_record() {
+        let metadata = Metadata::decode(
+            METADATA_KIND_METHOD,
+            7,
+            b"ActiveRecord::Base\0find\0/gems/activerecord-7.1.0/lib/base.rb",
+        );
+        assert_eq!(
+            metadata,
+            Some(Metadata::Method(MethodInfo {
+                key: 7,
+                class_path: "ActiveRecord::Base".to_owned(),
+                method_name: "find".to_owned(),
+                source_path: "/gems/activerecord-7.1.0/lib/base.rb".to_owned(),
+            }))
+        );
+    }
+
+    #[test]
+    fn decode_name_record() {
+        let metadata = Metadata::decode(METADATA_KIND_NAME, 3, b"GET /users");
+        assert_eq!(
+            metadata,
+            Some(Metadata::Name(NameInfo {
+                key: 3,
+                name: "GET /users".to_owned(),
+            }))
+        );
+    }
+
+    #[test]
+    fn encode_is_the_inverse_of_decode() {
+        let metadata = Metadata::Method(MethodInfo {
+            key: 4,
+            class_path: "Foo".to_owned(),
+            method_name: "bar".to_owned(),
+            source_path: "/app/foo.rb".to_owned(),
+        });
+        let (kind, key, payload) = metadata.encode();
+        assert_eq!(Metadata::decode(kind, key, &payload), Some(metadata));
+    }
+}
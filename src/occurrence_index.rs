@@ -0,0 +1,344 @@
+use crate::varint;
+use std::cmp::Reverse;
+use std::collections::{BinaryHeap, HashMap};
+
+/// Number of occurrences per compressed block. Lookups binary search the
+/// block headers and decode a single block.
+const BLOCK_LEN: usize = 128;
+pub const LONGEST_CALLS: usize = 100;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+pub struct Occurrence {
+    pub start_time: u64,
+    pub duration: u64,
+}
+
+impl Occurrence {
+    pub fn end_time(&self) -> u64 {
+        self.start_time + self.duration
+    }
+}
+
+#[derive(Debug, Clone, Copy)]
+struct BlockHeader {
+    first_start: u64,
+    last_start: u64,
+    offset: usize,
+    len: usize,
+}
+
+/// Occurrences sorted by start time, stored as varint deltas between
+/// consecutive start times followed by the duration.
+#[derive(Debug, Default)]
+struct Run {
+    blocks: Vec<BlockHeader>,
+    bytes: Vec<u8>,
+    len: usize,
+}
+
+impl Run {
+    fn encode(sorted: &[Occurrence]) -> Run {
+        let mut run = Run {
+            blocks: Vec::with_capacity(sorted.len().div_ceil(BLOCK_LEN)),
+            bytes: Vec::new(),
+            len: sorted.len(),
+        };
+        for chunk in sorted.chunks(BLOCK_LEN) {
+            run.blocks.push(BlockHeader {
+                first_start: chunk[0].start_time,
+                last_start: chunk[chunk.len() - 1].start_time,
+                offset: run.bytes.len(),
+                len: chunk.len(),
+            });
+            let mut previous = chunk[0].start_time;
+            for occurrence in chunk {
+                varint::write(&mut run.bytes, occurrence.start_time - previous);
+                varint::write(&mut run.bytes, occurrence.duration);
+                previous = occurrence.start_time;
+            }
+        }
+        run.bytes.shrink_to_fit();
+        run
+    }
+
+    fn decode_block(&self, block: usize, out: &mut Vec<Occurrence>) {
+        let header = self.blocks[block];
+        let mut position = header.offset;
+        let mut start_time = header.first_start;
+        for _ in 0..header.len {
+            start_time += varint::read(&self.bytes, &mut position);
+            let duration = varint::read(&self.bytes, &mut position);
+            out.push(Occurrence {
+                start_time,
+                duration,
+            });
+        }
+    }
+
+    fn decode(&self) -> Vec<Occurrence> {
+        let mut out = Vec::with_capacity(self.len);
+        for block in 0..self.blocks.len() {
+            self.decode_block(block, &mut out);
+        }
+        out
+    }
+
+    fn last_start(&self) -> u64 {
+        self.blocks.last().map_or(0, |block| block.last_start)
+    }
+
+    fn next_after(&self, time: u64) -> Option<Occurrence> {
+        let block = self
+            .blocks
+            .partition_point(|block| block.last_start <= time);
+        if block == self.blocks.len() {
+            return None;
+        }
+        let mut occurrences = Vec::with_capacity(BLOCK_LEN);
+        self.decode_block(block, &mut occurrences);
+        occurrences.into_iter().find(|o| o.start_time > time)
+    }
+
+    fn prev_before(&self, time: u64) -> Option<Occurrence> {
+        let block = self
+            .blocks
+            .partition_point(|block| block.first_start < time);
+        if block == 0 {
+            return None;
+        }
+        let mut occurrences = Vec::with_capacity(BLOCK_LEN);
+        self.decode_block(block - 1, &mut occurrences);
+        occurrences.into_iter().rev().find(|o| o.start_time < time)
+    }
+}
+
+fn merge_sorted(a: Vec<Occurrence>, b: Vec<Occurrence>) -> Vec<Occurrence> {
+    let mut merged = Vec::with_capacity(a.len() + b.len());
+    let mut a = a.into_iter().peekable();
+    let mut b = b.into_iter().peekable();
+    while let (Some(x), Some(y)) = (a.peek(), b.peek()) {
+        if x <= y {
+            merged.push(a.next().unwrap());
+        } else {
+            merged.push(b.next().unwrap());
+        }
+    }
+    merged.extend(a);
+    merged.extend(b);
+    merged
+}
+
+/// Calls complete in return order, which is not start order, so occurrences
+/// are collected in a small unsorted tail and sealed into sorted runs. Runs
+/// of equal size are merged like a binary counter, which keeps the number of
+/// runs logarithmic in the number of occurrences.
+#[derive(Debug, Default)]
+struct MethodOccurrences {
+    runs: Vec<Run>,
+    tail: Vec<Occurrence>,
+    longest: BinaryHeap<Reverse<(u64, u64)>>,
+}
+
+impl MethodOccurrences {
+    fn insert(&mut self, occurrence: Occurrence) {
+        let entry = Reverse((occurrence.duration, occurrence.start_time));
+        if self.longest.len() < LONGEST_CALLS {
+            self.longest.push(entry);
+        } else if self
+            .longest
+            .peek()
+            .is_some_and(|shortest| entry < *shortest)
+        {
+            self.longest.pop();
+            self.longest.push(entry);
+        }
+
+        self.tail.push(occurrence);
+        if self.tail.len() < BLOCK_LEN {
+            return;
+        }
+        let mut sorted = std::mem::take(&mut self.tail);
+        sorted.sort_unstable();
+        while let Some(last) = self.runs.last()
+            && last.len <= sorted.len()
+        {
+            let last = self.runs.pop().unwrap();
+            sorted = merge_sorted(last.decode(), sorted);
+        }
+        self.runs.push(Run::encode(&sorted));
+    }
+
+    fn next_after(&self, time: u64) -> Option<Occurrence> {
+        let tail = self.tail.iter().copied().filter(|o| o.start_time > time);
+        self.runs
+            .iter()
+            .filter_map(|run| run.next_after(time))
+            .chain(tail)
+            .min()
+    }
+
+    fn prev_before(&self, time: u64) -> Option<Occurrence> {
+        let tail = self.tail.iter().copied().filter(|o| o.start_time < time);
+        self.runs
+            .iter()
+            .filter_map(|run| run.prev_before(time))
+            .chain(tail)
+            .max()
+    }
+
+    fn evict_before(&mut self, time: u64) {
+        self.runs.retain(|run| run.last_start() >= time);
+        self.tail.retain(|o| o.start_time >= time);
+        self.longest
+            .retain(|&Reverse((_, start_time))| start_time >= time);
+    }
+
+    fn is_empty(&self) -> bool {
+        self.runs.is_empty() && self.tail.is_empty()
+    }
+}
+
+/// Inverted index from method key to the calls of that method, for jumping
+/// between calls and listing the longest ones without scanning the trace.
+#[derive(Debug, Default)]
+pub struct OccurrenceIndex {
+    methods: HashMap<u32, MethodOccurrences>,
+}
+
+impl OccurrenceIndex {
+    pub fn new() -> OccurrenceIndex {
+        OccurrenceIndex::default()
+    }
+
+    pub fn insert(&mut self, method_key: u32, start_time: u64, end_time: u64) {
+        self.methods
+            .entry(method_key)
+            .or_default()
+            .insert(Occurrence {
+                start_time,
+                duration: end_time.saturating_sub(start_time),
+            });
+    }
+
+    /// The first call of `method_key` starting strictly after `time`.
+    pub fn next_after(&self, method_key: u32, time: u64) -> Option<Occurrence> {
+        self.methods.get(&method_key)?.next_after(time)
+    }
+
+    /// The last call of `method_key` starting strictly before `time`.
+    pub fn prev_before(&self, method_key: u32, time: u64) -> Option<Occurrence> {
+        self.methods.get(&method_key)?.prev_before(time)
+    }
+
+    /// Up to `LONGEST_CALLS` calls of the methods in `method_keys` together,
+    /// longest first.
+    pub fn longest(&self, method_keys: impl IntoIterator<Item = u32>) -> Vec<Occurrence> {
+        let mut longest = method_keys
+            .into_iter()
+            .filter_map(|key| self.methods.get(&key))
+            .flat_map(|method| &method.longest)
+            .map(|&Reverse((duration, start_time))| Occurrence {
+                start_time,
+                duration,
+            })
+            .collect::<Vec<_>>();
+        longest.sort_unstable_by_key(|o| Reverse((o.duration, o.start_time)));
+        longest.truncate(LONGEST_CALLS);
+        longest
+    }
+
+    /// Drops calls that started before `time`. Sorted runs are released as
+    /// a whole once their newest call is older than `time`, so some older
+    /// calls may survive until the rest of their run expires.
+    pub fn evict_before(&mut self, time: u64) {
+        self.methods.retain(|_, method| {
+            method.evict_before(time);
+            !method.is_empty()
+        });
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn index_with(starts: impl IntoIterator<Item = u64>) -> OccurrenceIndex {
+        let mut index = OccurrenceIndex::new();
+        for start in starts {
+            index.insert(1, start, start + start % 7);
+        }
+        index
+    }
+
+    #[test]
+    fn next_and_prev_span_runs_and_tail() {
+        // Completion order differs from start order.
+        let starts = (0..1000u64).map(|i| (i * 7919) % 1000 * 10);
+        let index = index_with(starts);
+        let method = &index.methods[&1];
+        assert!(method.runs.len() > 1);
+        assert!(!method.tail.is_empty());
+
+        for time in [0, 5, 10, 4990, 9985] {
+            let expected_next = (time / 10 + 1) * 10;
+            assert_eq!(
+                index.next_after(1, time).map(|o| o.start_time),
+                (expected_next < 10000).then_some(expected_next)
+            );
+            let expected_prev = time.div_ceil(10).checked_sub(1).map(|i| i * 10);
+            assert_eq!(
+                index.prev_before(1, time).map(|o| o.start_time),
+                expected_prev
+            );
+        }
+        assert_eq!(index.next_after(2, 0), None);
+    }
+
+    #[test]
+    fn longest_keeps_the_top_calls() {
+        let mut index = OccurrenceIndex::new();
+        for i in 0..1000u64 {
+            index.insert(3, i * 100, i * 100 + (i * 37) % 1000);
+        }
+        let longest = index.longest([3]);
+        assert_eq!(longest.len(), LONGEST_CALLS);
+        assert_eq!(longest[0].duration, 999);
+        assert!(longest.windows(2).all(|w| w[0].duration >= w[1].duration));
+        assert_eq!(longest[LONGEST_CALLS - 1].duration, 900);
+    }
+
+    #[test]
+    fn longest_merges_methods() {
+        let mut index = OccurrenceIndex::new();
+        for i in 0..200u64 {
+            index.insert(1, i * 10, i * 10 + i);
+            index.insert(2, i * 10 + 5, i * 10 + 5 + i * 2);
+        }
+        let longest = index.longest([1, 2, 9]);
+        assert_eq!(longest.len(), LONGEST_CALLS);
+        assert_eq!(
+            longest[0],
+            Occurrence {
+                start_time: 1995,
+                duration: 398
+            }
+        );
+        assert!(longest.windows(2).all(|w| w[0].duration >= w[1].duration));
+        // Calls of method 1 last at most 199, and method 2 has more than
+        // `LONGEST_CALLS` calls at least that long.
+        assert!(longest.iter().all(|o| o.start_time % 10 == 5));
+        assert!(index.longest([]).is_empty());
+    }
+
+    #[test]
+    fn eviction_drops_expired_runs() {
+        let mut index = index_with((0..300).map(|i| i * 10));
+        index.evict_before(10_000);
+        assert!(index.methods.is_empty());
+
+        let mut index = index_with((0..300).map(|i| i * 10));
+        index.evict_before(1500);
+        assert_eq!(index.next_after(1, 2000).unwrap().start_time, 2010);
+        assert!(index.longest([1]).iter().all(|o| o.start_time >= 1500));
+    }
+}
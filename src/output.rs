@@ -0,0 +1,124 @@
+use crate::aggregate::Aggregate;
+use crate::chrome_trace::ChromeTraceExport;
+use crate::metadata::{Metadata, MetadataRingBuffer};
+use crate::recorder::Recorder;
+use crate::ringbuffer::{EventRingBuffer, RRTraceEvent};
+use crate::shared_region::{OutputMode, RRTraceSharedRegion, SessionOptions};
+use crate::shm::SharedMemory;
+use std::fs::File;
+use std::io::{self, BufWriter, Write};
+use std::path::PathBuf;
+use std::sync::Arc;
+use std::thread;
+use std::time::Duration;
+
+/// Where the output modes other than the window send the session.
+trait Output {
+    fn metadata(&mut self, metadata: Metadata) -> io::Result<()>;
+    fn record(&mut self, events: &[RRTraceEvent]) -> io::Result<()>;
+    fn finish(self: Box<Self>) -> io::Result<()>;
+}
+
+impl<W: Write> Output for Recorder<W> {
+    fn metadata(&mut self, metadata: Metadata) -> io::Result<()> {
+        Recorder::metadata(self, &metadata)
+    }
+
+    fn record(&mut self, events: &[RRTraceEvent]) -> io::Result<()> {
+        Recorder::record(self, events)
+    }
+
+    fn finish(self: Box<Self>) -> io::Result<()> {
+        Recorder::finish(*self).map(drop)
+    }
+}
+
+impl<W: Write> Output for ChromeTraceExport<W> {
+    fn metadata(&mut self, metadata: Metadata) -> io::Result<()> {
+        ChromeTraceExport::metadata(self, metadata);
+        Ok(())
+    }
+
+    fn record(&mut self, events: &[RRTraceEvent]) -> io::Result<()> {
+        ChromeTraceExport::record(self, events)
+    }
+
+    fn finish(self: Box<Self>) -> io::Result<()> {
+        ChromeTraceExport::finish(*self).map(drop)
+    }
+}
+
+struct Summary {
+    aggregate: Aggregate,
+    path: PathBuf,
+}
+
+impl Output for Summary {
+    fn metadata(&mut self, metadata: Metadata) -> io::Result<()> {
+        self.aggregate.metadata(metadata);
+        Ok(())
+    }
+
+    fn record(&mut self, events: &[RRTraceEvent]) -> io::Result<()> {
+        self.aggregate.record(events);
+        Ok(())
+    }
+
+    fn finish(mut self: Box<Self>) -> io::Result<()> {
+        self.aggregate.finish();
+        std::fs::write(&self.path, self.aggregate.report())
+    }
+}
+
+/// Drains the rings into the output file until the tracer has stopped,
+/// without opening a window.
+pub fn write(shm: Arc<SharedMemory>, options: &SessionOptions) -> io::Result<()> {
+    let region = shm.as_ptr::<RRTraceSharedRegion>();
+    let mut output: Box<dyn Output> = match options.output_mode {
+        OutputMode::Window => unreachable!("the window mode writes no file"),
+        OutputMode::Record => Box::new(Recorder::new(BufWriter::new(File::create(
+            &options.output_path,
+        )?))?),
+        OutputMode::Export => Box::new(ChromeTraceExport::new(BufWriter::new(File::create(
+            &options.output_path,
+        )?))?),
+        // Created early so that an unwritable path fails before tracing.
+        OutputMode::Headless => {
+            File::create(&options.output_path)?;
+            Box::new(Summary {
+                aggregate: Aggregate::new(),
+                path: options.output_path.clone(),
+            })
+        }
+    };
+    let mut ringbuffer = unsafe {
+        let shm = Arc::clone(&shm);
+        EventRingBuffer::new(RRTraceSharedRegion::events(region), move || drop(shm))
+    };
+    let mut metadata =
+        unsafe { MetadataRingBuffer::new(&raw mut (*region).metadata, move || drop(shm)) };
+    let mut buffer = vec![Default::default(); 65536];
+    loop {
+        // Checked before reading, so the events published before the flag
+        // are all drained.
+        let stopped = unsafe { RRTraceSharedRegion::stopped(region) };
+        let count = ringbuffer.read(&mut buffer);
+        let mut result = Ok(());
+        metadata.read(|record| {
+            if result.is_ok() {
+                result = output.metadata(record);
+            }
+        });
+        result?;
+        if count > 0 {
+            let chunk = &mut buffer[..count];
+            chunk.sort_by_key(RRTraceEvent::timestamp);
+            output.record(chunk)?;
+        } else if stopped {
+            break;
+        } else {
+            thread::sleep(Duration::from_millis(1));
+        }
+    }
+    output.finish()
+}
@@ -0,0 +1,93 @@
+use crate::metadata::Metadata;
+use crate::ringbuffer::RRTraceEvent;
+use std::io::{self, Write};
+
+const MAGIC: &[u8; 8] = b"RRTRACE\0";
+const VERSION: u32 = 1;
+const TAG_METADATA: u8 = 1;
+const TAG_EVENTS: u8 = 2;
+
+/// Writes a session to a file for the record output mode.
+///
+/// The file starts with `MAGIC` and `VERSION` as a u32, followed by
+/// records that each begin with a tag byte. All integers are little-endian.
+/// - `TAG_METADATA`: kind, key and payload length as u32, then the payload
+///   as it appears in the metadata ring.
+/// - `TAG_EVENTS`: the event count as u32, then the events as two u64
+///   words each, as they appear in the event ring.
+///
+/// Metadata is always written before the events that refer to it.
+pub struct Recorder<W: Write> {
+    out: W,
+}
+
+impl<W: Write> Recorder<W> {
+    pub fn new(mut out: W) -> io::Result<Recorder<W>> {
+        out.write_all(MAGIC)?;
+        out.write_all(&VERSION.to_le_bytes())?;
+        Ok(Recorder { out })
+    }
+
+    pub fn metadata(&mut self, metadata: &Metadata) -> io::Result<()> {
+        let (kind, key, payload) = metadata.encode();
+        self.out.write_all(&[TAG_METADATA])?;
+        self.out.write_all(&kind.to_le_bytes())?;
+        self.out.write_all(&key.to_le_bytes())?;
+        self.out.write_all(&(payload.len() as u32).to_le_bytes())?;
+        self.out.write_all(&payload)
+    }
+
+    pub fn record(&mut self, events: &[RRTraceEvent]) -> io::Result<()> {
+        for chunk in events.chunks(u32::MAX as usize) {
+            self.out.write_all(&[TAG_EVENTS])?;
+            self.out.write_all(&(chunk.len() as u32).to_le_bytes())?;
+            for event in chunk {
+                let [timestamp_and_event_type, data] = event.to_raw();
+                self.out
+                    .write_all(&timestamp_and_event_type.to_le_bytes())?;
+                self.out.write_all(&data.to_le_bytes())?;
+            }
+        }
+        Ok(())
+    }
+
+    pub fn finish(mut self) -> io::Result<W> {
+        self.out.flush()?;
+        Ok(self.out)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::metadata::NameInfo;
+    use crate::ringbuffer::RRTraceEventType;
+
+    #[test]
+    fn writes_tagged_records_after_the_header() {
+        let mut recorder = Recorder::new(Vec::new()).unwrap();
+        recorder
+            .metadata(&Metadata::Name(NameInfo {
+                key: 2,
+                name: "job".to_owned(),
+            }))
+            .unwrap();
+        recorder
+            .record(&[RRTraceEvent::new(RRTraceEventType::SpanBegin, 0x10, 2)])
+            .unwrap();
+        let bytes = recorder.finish().unwrap();
+
+        let mut expected = b"RRTRACE\0".to_vec();
+        expected.extend_from_slice(&1u32.to_le_bytes());
+        expected.push(1);
+        expected.extend_from_slice(&2u32.to_le_bytes());
+        expected.extend_from_slice(&2u32.to_le_bytes());
+        expected.extend_from_slice(&3u32.to_le_bytes());
+        expected.extend_from_slice(b"job");
+        expected.push(2);
+        expected.extend_from_slice(&1u32.to_le_bytes());
+        expected.extend_from_slice(&0x9000_0000_0000_0010u64.to_le_bytes());
+        expected.extend_from_slice(&2u64.to_le_bytes());
+        assert_eq!(bytes, expected);
+    }
+}
@@ -1,19 +1,42 @@
 use crate::BASE_TIME;
+use crate::context_stats::{ContextStats, ContextSummary};
+use crate::history::{Batch, BatchKey, History};
+use crate::lod;
+use crate::metadata::Metadata;
+use crate::occurrence_index::{Occurrence, OccurrenceIndex};
+use crate::renderer::counter_view::CounterView;
+use crate::renderer::heatmap_view::HeatmapView;
+use crate::renderer::highlight::Highlight;
+use crate::renderer::instance_draws::InstanceDraws;
+use crate::renderer::lanes::{LaneBuffer, SlotAllocator};
+use crate::renderer::paged_arena::PagedArena;
+use crate::renderer::palette::{Palette, PaletteEntry};
 use crate::renderer::vertex_arena::{AllocationId, VertexArena};
+use crate::renderer::view::View;
+use crate::search::Pattern;
+use crate::symbol_table::SymbolTable;
 use crate::trace_state::{CallBox, SlowTrace, VISIBLE_DURATION, encode_time};
 use glam::camera::rh::{proj::directx::perspective, view::look_at_mat4};
-use glam::{Mat4, Vec3};
+use glam::{Mat4, Vec2, Vec3, Vec4};
 use std::cmp::{Ordering, Reverse};
 use std::collections::btree_map::Entry;
-use std::collections::{BTreeMap, BinaryHeap};
+use std::collections::{BTreeMap, BinaryHeap, VecDeque};
 use std::fmt::{Debug, Formatter};
 use std::sync::Arc;
-use std::time::Instant;
+use std::time::{Duration, Instant};
 use std::{fmt, iter};
 use wgpu::BufferUsages;
-use wgpu::util::DeviceExt;
-
+use wgpu::util::{DeviceExt, StagingBelt};
+
+mod counter_view;
+mod heatmap_view;
+mod highlight;
+mod instance_draws;
+mod lanes;
+mod paged_arena;
+mod palette;
 mod vertex_arena;
+mod view;
 
 #[repr(C)]
 #[derive(Copy, Clone, Debug, bytemuck::Pod, bytemuck::Zeroable)]
@@ -67,6 +90,26 @@ impl CallBox {
                     shader_location: 4,
                     format: wgpu::VertexFormat::Uint32,
                 },
+                wgpu::VertexAttribute {
+                    offset: 24,
+                    shader_location: 5,
+                    format: wgpu::VertexFormat::Uint32,
+                },
+                wgpu::VertexAttribute {
+                    offset: 28,
+                    shader_location: 6,
+                    format: wgpu::VertexFormat::Uint32,
+                },
+                wgpu::VertexAttribute {
+                    offset: 32,
+                    shader_location: 7,
+                    format: wgpu::VertexFormat::Uint32,
+                },
+                wgpu::VertexAttribute {
+                    offset: 36,
+                    shader_location: 8,
+                    format: wgpu::VertexFormat::Uint32,
+                },
             ],
         }
     }
@@ -171,12 +214,15 @@ struct LineSegment {
     end_pos: [f32; 3],
     color: [f32; 4],
     kind: u32,
-    _padding: [u32; 3],
+    /// Lane slot of a `KIND_THREAD` segment, whose z is within the lane.
+    lane: u32,
+    _padding: [u32; 2],
 }
 
 impl LineSegment {
     const KIND_THREAD: u32 = 0;
     const KIND_WORLD: u32 = 1;
+    const KIND_GRAPH: u32 = 2;
 
     fn desc() -> wgpu::VertexBufferLayout<'static> {
         wgpu::VertexBufferLayout {
@@ -213,6 +259,11 @@ impl LineSegment {
                     shader_location: 6,
                     format: wgpu::VertexFormat::Uint32,
                 },
+                wgpu::VertexAttribute {
+                    offset: 60,
+                    shader_location: 7,
+                    format: wgpu::VertexFormat::Uint32,
+                },
             ],
         }
     }
@@ -222,6 +273,16 @@ const LINE_VERTICES: &[LineVertex] = &[LineVertex { position: 0.0 }, LineVertex
 
 const AXIS_LINE_COLOR: [f32; 4] = [0.35, 0.4, 0.5, 1.0];
 const THREAD_LINE_COLOR: [f32; 4] = [0.45, 0.7, 1.0, 1.0];
+const MARK_COLOR: [f32; 4] = [1.0, 0.85, 0.3, 1.0];
+/// Marks are drawn through the first three levels of the annotation lane
+/// (`ANNOTATION_LEVEL_HEIGHT` in shader.wgsl) up to the call boxes.
+const MARK_HEIGHT: f32 = 0.12;
+/// Size of the staging buffers that arena uploads are written through.
+/// Larger uploads get a buffer of their own.
+const STAGING_CHUNK_SIZE: wgpu::BufferAddress = 1 << 20;
+/// Time per frame spent turning traces into boxes. The rest waits for the
+/// next frame, so a backlog does not stall rendering.
+const SYNC_BUDGET: Duration = Duration::from_millis(4);
 const AXIS_LINE_INSTANCES: &[LineSegment] = &[
     LineSegment {
         start_time: [0, 0],
@@ -230,7 +291,8 @@ const AXIS_LINE_INSTANCES: &[LineSegment] = &[
         end_pos: [VISIBLE_DURATION as f32 / 500000000.0, 0.0, 0.0],
         color: AXIS_LINE_COLOR,
         kind: LineSegment::KIND_WORLD,
-        _padding: [0; 3],
+        lane: 0,
+        _padding: [0; 2],
     },
     LineSegment {
         start_time: [0, 0],
@@ -239,7 +301,8 @@ const AXIS_LINE_INSTANCES: &[LineSegment] = &[
         end_pos: [0.0, 1.0, 0.0],
         color: AXIS_LINE_COLOR,
         kind: LineSegment::KIND_WORLD,
-        _padding: [0; 3],
+        lane: 0,
+        _padding: [0; 2],
     },
     LineSegment {
         start_time: [0, 0],
@@ -248,7 +311,8 @@ const AXIS_LINE_INSTANCES: &[LineSegment] = &[
         end_pos: [0.0, 0.0, 1.0],
         color: AXIS_LINE_COLOR,
         kind: LineSegment::KIND_WORLD,
-        _padding: [0; 3],
+        lane: 0,
+        _padding: [0; 2],
     },
 ];
 
@@ -258,13 +322,11 @@ struct CameraUniform {
     view_proj: [[f32; 4]; 4],
     base_time: [u32; 2],
     max_depth: u32,
-    num_threads: u32,
-}
-
-#[repr(C)]
-#[derive(Copy, Clone, Debug, bytemuck::Pod, bytemuck::Zeroable)]
-struct ThreadInfo {
-    lane_id: u32,
+    /// Total depth of the thread lanes, see `lanes::layout`.
+    lane_depth: f32,
+    /// Only boxes of this `Rrtrace.with_context` id are drawn; 0 draws all.
+    context_filter: u32,
+    _padding: [u32; 3],
 }
 
 struct SurfaceState {
@@ -273,22 +335,40 @@ struct SurfaceState {
     render_pipeline: wgpu::RenderPipeline,
     line_pipeline: wgpu::RenderPipeline,
     gc_pipeline: wgpu::RenderPipeline,
+    annotation_pipeline: wgpu::RenderPipeline,
+    heatmap_pipeline: wgpu::RenderPipeline,
     depth_texture: wgpu::TextureView,
 }
 
 #[derive(Debug)]
-struct ThreadArena {
+struct ThreadLane {
     used_segments: usize,
-    vertex: VertexArena<CallBox>,
+    slot: u32,
+    /// End of the last batch in which the thread made calls.
+    last_active: u64,
+}
+
+#[derive(Debug, Eq, PartialEq)]
+struct ThreadBatch {
+    thread_id: u32,
+    /// Per `lod` level, `None` where the level is empty or the same as the
+    /// finer one.
+    call_boxes: [Option<AllocationId>; lod::LEVELS],
+    annotation_boxes: Option<AllocationId>,
 }
 
 #[derive(Debug, Eq, PartialEq)]
 struct TraceBatch {
     end_time: u64,
-    thread_data: Vec<(u32, Option<AllocationId>)>,
+    thread_data: Vec<ThreadBatch>,
     line_data: Option<AllocationId>,
     gc_data: Option<AllocationId>,
     max_depth: u32,
+    /// Start time and encoding of the batch, moved to `History` when it is
+    /// evicted.
+    history: Option<(u64, Box<[u8]>)>,
+    /// Whether the boxes are in `Renderer::restored_boxes`.
+    restored: bool,
 }
 
 impl PartialOrd for TraceBatch {
@@ -319,14 +399,54 @@ pub struct Renderer {
     num_indices: u32,
     camera_uniform: CameraUniform,
     camera_buffer: wgpu::Buffer,
+    camera_bind_group_layout: wgpu::BindGroupLayout,
     camera_bind_group: wgpu::BindGroup,
-    lane_alignment: u32,
+    method_bind_group_layout: wgpu::BindGroupLayout,
+    method_bind_group: wgpu::BindGroup,
     trace_queue: Arc<crossbeam_queue::SegQueue<SlowTrace>>,
-    data_per_thread: BTreeMap<u32, ThreadArena>,
+    /// Traces taken from `trace_queue` that did not fit in a frame's
+    /// `SYNC_BUDGET`, oldest first.
+    pending_traces: VecDeque<SlowTrace>,
+    metadata_queue: Arc<crossbeam_queue::SegQueue<Metadata>>,
+    symbols: SymbolTable,
+    palette: Palette,
+    highlight: Highlight,
+    search: Option<Pattern>,
+    /// Rank among the longest calls matching the search and the call the
+    /// view was last centered on by `cycle_longest_match`.
+    longest_match: Option<(usize, Occurrence)>,
+    heatmap_view: HeatmapView,
+    counter_view: CounterView,
+    occurrences: OccurrenceIndex,
+    context_stats: ContextStats,
+    context_filter: Option<u32>,
+    data_per_thread: BTreeMap<u32, ThreadLane>,
+    lane_slots: SlotAllocator,
+    lanes: LaneBuffer,
+    /// Boxes of the batches in `thread_queue`, freed batch by batch in the
+    /// order they were added, which paged arenas handle without
+    /// fragmenting.
+    boxes: BoxArenas,
+    /// Boxes of the batches in `restored`, which come and go with the view
+    /// in any order, so they do not hold on to the pages of `boxes`.
+    restored_boxes: BoxArenas,
+    call_draws: InstanceDraws,
     thread_line_vertex: VertexArena<LineSegment>,
     gc_vertex: VertexArena<GCBox>,
+    /// Reused across frames, so uploads do not allocate staging memory.
+    staging_belt: StagingBelt,
     thread_queue: BinaryHeap<Reverse<TraceBatch>>,
+    /// Evicted batches and those skipped after a backlog, for scrolling
+    /// back to them.
+    history: History,
+    /// Batches uploaded again from `history` because they are in view, by
+    /// their key there.
+    restored: BTreeMap<BatchKey, TraceBatch>,
+    view: View,
     base_time: u64,
+    /// How long batches are kept after they end, at least the visible
+    /// window.
+    retention: u64,
     depth: MultiSet<u32>,
 }
 
@@ -337,16 +457,19 @@ impl Renderer {
         device: wgpu::Device,
         queue: wgpu::Queue,
         trace_queue: Arc<crossbeam_queue::SegQueue<SlowTrace>>,
+        metadata_queue: Arc<crossbeam_queue::SegQueue<Metadata>>,
+        retention: u64,
+        history_budget: usize,
     ) -> Self {
-        let limits = device.limits();
-        let lane_alignment = limits.min_uniform_buffer_offset_alignment;
         let shader = device.create_shader_module(wgpu::include_wgsl!("shader.wgsl"));
 
         let camera_uniform = CameraUniform {
             view_proj: Mat4::IDENTITY.to_cols_array_2d(),
             base_time: [0, 0],
             max_depth: 0,
-            num_threads: 0,
+            lane_depth: 1.0,
+            context_filter: 0,
+            _padding: [0; 3],
         };
         let camera_buffer = device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
             label: Some("Camera Buffer"),
@@ -354,21 +477,6 @@ impl Renderer {
             usage: wgpu::BufferUsages::UNIFORM | wgpu::BufferUsages::COPY_DST,
         });
 
-        const MAX_LANES: u32 = 256;
-        let thread_info_buffer_size = MAX_LANES * lane_alignment;
-        let mut thread_info_data = vec![0u8; thread_info_buffer_size as usize];
-        for i in 0..MAX_LANES {
-            let offset = (i * lane_alignment) as usize;
-            let info = ThreadInfo { lane_id: i };
-            thread_info_data[offset..offset + 4].copy_from_slice(bytemuck::bytes_of(&info));
-        }
-
-        let thread_info_buffer = device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
-            label: Some("Thread Info Buffer"),
-            contents: &thread_info_data,
-            usage: wgpu::BufferUsages::UNIFORM | wgpu::BufferUsages::COPY_DST,
-        });
-
         let camera_bind_group_layout =
             device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
                 entries: &[
@@ -386,8 +494,8 @@ impl Renderer {
                         binding: 1,
                         visibility: wgpu::ShaderStages::VERTEX,
                         ty: wgpu::BindingType::Buffer {
-                            ty: wgpu::BufferBindingType::Uniform,
-                            has_dynamic_offset: true,
+                            ty: wgpu::BufferBindingType::Storage { read_only: true },
+                            has_dynamic_offset: false,
                             min_binding_size: None,
                         },
                         count: None,
@@ -396,29 +504,55 @@ impl Renderer {
                 label: Some("camera_bind_group_layout"),
             });
 
-        let camera_bind_group = device.create_bind_group(&wgpu::BindGroupDescriptor {
-            layout: &camera_bind_group_layout,
-            entries: &[
-                wgpu::BindGroupEntry {
-                    binding: 0,
-                    resource: camera_buffer.as_entire_binding(),
-                },
-                wgpu::BindGroupEntry {
-                    binding: 1,
-                    resource: wgpu::BindingResource::Buffer(wgpu::BufferBinding {
-                        buffer: &thread_info_buffer,
-                        offset: 0,
-                        size: wgpu::BufferSize::new(std::mem::size_of::<ThreadInfo>() as u64),
-                    }),
-                },
-            ],
-            label: Some("camera_bind_group"),
-        });
+        let lanes = LaneBuffer::new(device.clone(), queue.clone());
+        let camera_bind_group = Self::create_camera_bind_group(
+            &device,
+            &camera_bind_group_layout,
+            &camera_buffer,
+            &lanes,
+        );
+
+        let method_bind_group_layout =
+            device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
+                entries: &[
+                    wgpu::BindGroupLayoutEntry {
+                        binding: 0,
+                        visibility: wgpu::ShaderStages::VERTEX | wgpu::ShaderStages::FRAGMENT,
+                        ty: wgpu::BindingType::Buffer {
+                            ty: wgpu::BufferBindingType::Storage { read_only: true },
+                            has_dynamic_offset: false,
+                            min_binding_size: None,
+                        },
+                        count: None,
+                    },
+                    wgpu::BindGroupLayoutEntry {
+                        binding: 1,
+                        visibility: wgpu::ShaderStages::VERTEX,
+                        ty: wgpu::BindingType::Buffer {
+                            ty: wgpu::BufferBindingType::Storage { read_only: true },
+                            has_dynamic_offset: false,
+                            min_binding_size: None,
+                        },
+                        count: None,
+                    },
+                ],
+                label: Some("method_bind_group_layout"),
+            });
+
+        let palette = Palette::new(device.clone(), queue.clone());
+        let highlight = Highlight::new(device.clone(), queue.clone());
+        let method_bind_group = Self::create_method_bind_group(
+            &device,
+            &method_bind_group_layout,
+            &palette,
+            &highlight,
+        );
+        let heatmap_view = HeatmapView::new(&device, queue.clone(), &method_bind_group_layout);
 
         let render_pipeline_layout =
             device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
                 label: Some("Render Pipeline Layout"),
-                bind_group_layouts: &[&camera_bind_group_layout],
+                bind_group_layouts: &[&camera_bind_group_layout, &method_bind_group_layout],
                 immediate_size: 0,
             });
 
@@ -448,6 +582,15 @@ impl Renderer {
             usage: wgpu::BufferUsages::INDEX,
         });
         let num_indices = INDICES.len() as u32;
+        // Indirect draws start at arbitrary instances in the shared arenas.
+        let indirect_draws = device
+            .features()
+            .contains(wgpu::Features::INDIRECT_FIRST_INSTANCE)
+            && adapter
+                .get_downlevel_capabilities()
+                .flags
+                .contains(wgpu::DownlevelFlags::INDIRECT_EXECUTION);
+        let call_draws = InstanceDraws::new(device.clone(), queue.clone(), indirect_draws);
 
         Self {
             instance,
@@ -465,26 +608,92 @@ impl Renderer {
             num_indices,
             camera_uniform,
             camera_buffer,
+            camera_bind_group_layout,
             camera_bind_group,
-            lane_alignment,
+            method_bind_group_layout,
+            method_bind_group,
             trace_queue,
+            pending_traces: VecDeque::new(),
+            metadata_queue,
+            symbols: SymbolTable::new(),
+            palette,
+            highlight,
+            search: None,
+            longest_match: None,
+            heatmap_view,
+            counter_view: CounterView::new(device.clone(), queue.clone()),
+            occurrences: OccurrenceIndex::new(),
+            context_stats: ContextStats::new(),
+            context_filter: None,
             data_per_thread: BTreeMap::new(),
+            lane_slots: SlotAllocator::new(),
+            lanes,
+            boxes: BoxArenas::new(&device),
+            restored_boxes: BoxArenas::new(&device),
+            call_draws,
             thread_line_vertex: VertexArena::new(
                 device.clone(),
-                queue.clone(),
                 BufferUsages::COPY_DST | BufferUsages::VERTEX,
             ),
             gc_vertex: VertexArena::new(
-                device,
-                queue,
+                device.clone(),
                 BufferUsages::COPY_DST | BufferUsages::VERTEX,
             ),
+            staging_belt: StagingBelt::new(device, STAGING_CHUNK_SIZE),
             thread_queue: BinaryHeap::new(),
+            history: History::new(history_budget),
+            restored: BTreeMap::new(),
+            view: View::new(),
             base_time: 0,
+            retention,
             depth: MultiSet::new(),
         }
     }
 
+    fn create_camera_bind_group(
+        device: &wgpu::Device,
+        layout: &wgpu::BindGroupLayout,
+        camera_buffer: &wgpu::Buffer,
+        lanes: &LaneBuffer,
+    ) -> wgpu::BindGroup {
+        device.create_bind_group(&wgpu::BindGroupDescriptor {
+            layout,
+            entries: &[
+                wgpu::BindGroupEntry {
+                    binding: 0,
+                    resource: camera_buffer.as_entire_binding(),
+                },
+                wgpu::BindGroupEntry {
+                    binding: 1,
+                    resource: lanes.buffer().as_entire_binding(),
+                },
+            ],
+            label: Some("camera_bind_group"),
+        })
+    }
+
+    fn create_method_bind_group(
+        device: &wgpu::Device,
+        layout: &wgpu::BindGroupLayout,
+        palette: &Palette,
+        highlight: &Highlight,
+    ) -> wgpu::BindGroup {
+        device.create_bind_group(&wgpu::BindGroupDescriptor {
+            layout,
+            entries: &[
+                wgpu::BindGroupEntry {
+                    binding: 0,
+                    resource: palette.buffer().as_entire_binding(),
+                },
+                wgpu::BindGroupEntry {
+                    binding: 1,
+                    resource: highlight.buffer().as_entire_binding(),
+                },
+            ],
+            label: Some("method_bind_group"),
+        })
+    }
+
     pub fn set_window(&mut self, window: std::sync::Arc<winit::window::Window>) {
         let size = window.inner_size();
         let surface = self.instance.create_surface(window).unwrap();
@@ -501,7 +710,9 @@ impl Renderer {
             format: surface_format,
             width: size.width,
             height: size.height,
-            present_mode: surface_caps.present_modes[0],
+            // Frames are paced by the event loop, so presenting waits for
+            // vblank instead of whatever mode the surface lists first.
+            present_mode: wgpu::PresentMode::AutoVsync,
             alpha_mode: surface_caps.alpha_modes[0],
             view_formats: vec![],
             desired_maximum_frame_latency: 2,
@@ -550,6 +761,48 @@ impl Renderer {
                 multiview_mask: None,
             });
 
+        let annotation_pipeline =
+            self.device
+                .create_render_pipeline(&wgpu::RenderPipelineDescriptor {
+                    label: Some("Annotation Pipeline"),
+                    layout: Some(&self.render_pipeline_layout),
+                    vertex: wgpu::VertexState {
+                        module: &self.shader,
+                        entry_point: Some("vs_annotation"),
+                        buffers: &[Vertex::desc(), CallBox::desc()],
+                        compilation_options: Default::default(),
+                    },
+                    fragment: Some(wgpu::FragmentState {
+                        module: &self.shader,
+                        entry_point: Some("fs_main"),
+                        targets: &[Some(wgpu::ColorTargetState {
+                            format: config.format,
+                            blend: Some(wgpu::BlendState::REPLACE),
+                            write_mask: wgpu::ColorWrites::ALL,
+                        })],
+                        compilation_options: Default::default(),
+                    }),
+                    primitive: wgpu::PrimitiveState {
+                        topology: wgpu::PrimitiveTopology::TriangleList,
+                        strip_index_format: None,
+                        front_face: wgpu::FrontFace::Ccw,
+                        cull_mode: Some(wgpu::Face::Front),
+                        polygon_mode: wgpu::PolygonMode::Fill,
+                        unclipped_depth: false,
+                        conservative: false,
+                    },
+                    depth_stencil: Some(wgpu::DepthStencilState {
+                        format: wgpu::TextureFormat::Depth32Float,
+                        depth_write_enabled: true,
+                        depth_compare: wgpu::CompareFunction::Less,
+                        stencil: wgpu::StencilState::default(),
+                        bias: wgpu::DepthBiasState::default(),
+                    }),
+                    multisample: wgpu::MultisampleState::default(),
+                    cache: None,
+                    multiview_mask: None,
+                });
+
         let gc_pipeline = self
             .device
             .create_render_pipeline(&wgpu::RenderPipelineDescriptor {
@@ -634,6 +887,10 @@ impl Renderer {
                 multiview_mask: None,
             });
 
+        let heatmap_pipeline = self
+            .heatmap_view
+            .create_pipeline(&self.device, config.format);
+
         let depth_texture = Self::create_depth_texture(&self.device, &config);
 
         self.surface_state = Some(SurfaceState {
@@ -642,6 +899,8 @@ impl Renderer {
             render_pipeline,
             line_pipeline,
             gc_pipeline,
+            annotation_pipeline,
+            heatmap_pipeline,
             depth_texture,
         });
     }
@@ -683,125 +942,455 @@ impl Renderer {
 
     pub fn sync(&mut self) -> bool {
         let mut updated = false;
+        while let Some(metadata) = self.metadata_queue.pop() {
+            match metadata {
+                Metadata::Name(info) => self.symbols.insert_name(info.key, info.name),
+                Metadata::Method(info) => {
+                    let key = info.key;
+                    let symbol = self.symbols.insert_method(info);
+                    if let Some(pattern) = &self.search
+                        && pattern.matches(symbol.name())
+                    {
+                        self.highlight.set(key);
+                    }
+                    self.palette.set(
+                        key,
+                        PaletteEntry {
+                            color: symbol.color(),
+                            category: symbol.category(),
+                        },
+                    );
+                }
+            }
+        }
+        let palette_reallocated = self.palette.sync();
+        let highlight_reallocated = self.highlight.sync();
+        if palette_reallocated || highlight_reallocated {
+            self.method_bind_group = Self::create_method_bind_group(
+                &self.device,
+                &self.method_bind_group_layout,
+                &self.palette,
+                &self.highlight,
+            );
+        }
+        let sync_start = Instant::now();
+        self.base_time = (sync_start - *BASE_TIME.get().unwrap()).as_nanos() as u64;
         while let Some(trace) = self.trace_queue.pop() {
+            self.pending_traces.push_back(trace);
+        }
+        // After a backlog, traces that are already out of the visible window
+        // are recorded without uploading their boxes, so the newest traces
+        // are drawn sooner. They go straight to the history instead.
+        let visible_start = self.base_time.saturating_sub(VISIBLE_DURATION);
+        while sync_start.elapsed() < SYNC_BUDGET
+            && let Some(trace) = self.pending_traces.pop_front()
+        {
             updated = true;
-            let mut allocation_ids = Vec::new();
+            self.heatmap_view.record(&trace);
+            self.counter_view.record(&trace);
+            self.context_stats.record(&trace);
             for thread_data in trace.data() {
-                let thread_id = thread_data.thread_id();
-                let call_box = thread_data.call_boxes();
-                let s = self
-                    .data_per_thread
-                    .entry(thread_id)
-                    .or_insert_with(|| ThreadArena {
-                        used_segments: 0,
-                        vertex: VertexArena::new(
-                            self.device.clone(),
-                            self.queue.clone(),
-                            BufferUsages::COPY_DST | BufferUsages::VERTEX,
-                        ),
-                    });
-                s.used_segments += 1;
-                let allocation_id = if call_box.is_empty() {
-                    None
-                } else {
-                    let (allocation_id, slot) = s.vertex.alloc(call_box.len());
-                    slot.copy_from_slice(call_box);
-                    Some(allocation_id)
-                };
-                allocation_ids.push((thread_id, allocation_id));
+                for call in thread_data.completed_calls() {
+                    self.occurrences
+                        .insert(call.method_id(), call.start_time(), call.end_time());
+                }
+            }
+            if trace.end_time() < visible_start {
+                if self.history.is_enabled() {
+                    let batch = Batch::from_trace(&trace);
+                    self.history
+                        .push(batch.start_time(), batch.end_time, batch.encode().into());
+                }
+                continue;
+            }
+            let batch = Batch::from_trace(&trace);
+            let mut uploaded = self.upload_batch(&batch, false);
+            if self.history.is_enabled() {
+                uploaded.history = Some((batch.start_time(), batch.encode().into()));
+            }
+            self.thread_queue.push(Reverse(uploaded));
+        }
+        let mut evicted = false;
+        while let Some(Reverse(TraceBatch { end_time, .. })) = self.thread_queue.peek()
+            && end_time + self.retention < self.base_time
+        {
+            let Reverse(mut batch) = self.thread_queue.pop().unwrap();
+            evicted = true;
+            if let Some((start_time, bytes)) = batch.history.take() {
+                self.history.push(start_time, batch.end_time, bytes);
+            }
+            self.free_batch(batch);
+        }
+        if evicted {
+            // Statistics cover the history too, so searches can jump into it.
+            let horizon = self
+                .base_time
+                .saturating_sub(self.retention)
+                .min(self.history.start_time().unwrap_or(u64::MAX));
+            self.occurrences.evict_before(horizon);
+            self.counter_view.evict_before(horizon);
+            self.context_stats.evict_before(horizon);
+            if let Some(context) = self.context_filter
+                && self.context_stats.get(context).is_none()
+            {
+                self.context_filter = None;
             }
+        }
+        // Batches of the history that are in view are uploaded again, and
+        // dropped from the GPU once they are out of view.
+        let view_end = self.view.end_time(self.base_time);
+        let wanted = self
+            .history
+            .overlapping(view_end.saturating_sub(self.view.duration()), view_end);
+        let stale = self
+            .restored
+            .keys()
+            .filter(|key| wanted.binary_search(key).is_err())
+            .copied()
+            .collect::<Vec<_>>();
+        for key in stale {
+            updated = true;
+            let batch = self.restored.remove(&key).unwrap();
+            self.free_batch(batch);
+        }
+        for key in wanted {
+            if sync_start.elapsed() >= SYNC_BUDGET {
+                break;
+            }
+            if self.restored.contains_key(&key) {
+                continue;
+            }
+            if let Some(batch) = self.history.get(key) {
+                updated = true;
+                let uploaded = self.upload_batch(&batch, true);
+                self.restored.insert(key, uploaded);
+            }
+        }
+        // Lanes stay in thread order without gaps, and threads that have
+        // made no calls in the visible window are packed into thin lanes.
+        let (lanes, lane_depth) = lanes::layout(
+            self.data_per_thread.values().map(|thread| {
+                (
+                    thread.slot,
+                    thread.last_active + VISIBLE_DURATION < view_end,
+                )
+            }),
+            self.lane_slots.capacity(),
+        );
+        self.camera_uniform.lane_depth = lane_depth.max(1.0);
+        if self.lanes.sync(lanes) {
+            self.camera_bind_group = Self::create_camera_bind_group(
+                &self.device,
+                &self.camera_bind_group_layout,
+                &self.camera_buffer,
+                &self.lanes,
+            );
+        }
+        updated
+    }
 
-            let gc_events = trace.gc_events();
-            let line_count = trace.data().len();
-            let line_data = if line_count > 0 {
-                let mut line_segments = Vec::with_capacity(line_count);
-                for thread_data in trace.data() {
-                    let thread_line = thread_data.thread_line();
-                    let thread_id = thread_data.thread_id();
-                    let lane = self
-                        .data_per_thread
-                        .keys()
-                        .position(|&id| id == thread_id)
-                        .unwrap_or(0) as f32;
-                    line_segments.push(LineSegment {
-                        start_time: thread_line.start_time(),
-                        end_time: thread_line.end_time(),
-                        start_pos: [0.0, 0.0, lane + 0.5],
-                        end_pos: [0.0, 0.0, lane + 0.5],
-                        color: THREAD_LINE_COLOR,
-                        kind: LineSegment::KIND_THREAD,
-                        _padding: [0; 3],
-                    });
+    /// Copies the boxes, lines and GC events of `batch` into the arenas, the
+    /// boxes into `restored_boxes` for a batch restored from the history.
+    fn upload_batch(&mut self, batch: &Batch, restored: bool) -> TraceBatch {
+        let boxes = if restored {
+            &mut self.restored_boxes
+        } else {
+            &mut self.boxes
+        };
+        let mut thread_data = Vec::with_capacity(batch.threads.len());
+        let mut line_segments = Vec::new();
+        for thread in &batch.threads {
+            let thread_lane = self
+                .data_per_thread
+                .entry(thread.thread_id)
+                .or_insert_with(|| ThreadLane {
+                    used_segments: 0,
+                    slot: self.lane_slots.alloc(),
+                    last_active: 0,
+                });
+            thread_lane.used_segments += 1;
+            if thread.levels[0]
+                .as_ref()
+                .is_some_and(|boxes| !boxes.is_empty())
+            {
+                thread_lane.last_active = thread_lane.last_active.max(batch.end_time);
+            }
+            let lane = thread_lane.slot;
+            let mut call_boxes = [None; lod::LEVELS];
+            for ((call_boxes, vertex), level) in call_boxes
+                .iter_mut()
+                .zip(&mut boxes.calls)
+                .zip(&thread.levels)
+            {
+                if let Some(level) = level
+                    && !level.is_empty()
+                {
+                    *call_boxes = Some(alloc_lane_boxes(vertex, level, lane));
                 }
-                let (allocation_id, slot) = self.thread_line_vertex.alloc(line_segments.len());
-                slot.copy_from_slice(&line_segments);
-                Some(allocation_id)
-            } else {
+            }
+            let annotation_boxes = if thread.annotation_boxes.is_empty() {
                 None
-            };
-            let gc_data = if !gc_events.is_empty() {
-                let mut gc_boxes = Vec::with_capacity(gc_events.len());
-                for &event_time in gc_events {
-                    gc_boxes.push(GCBox {
-                        time: encode_time(event_time),
-                    });
-                }
-                if !gc_boxes.is_empty() {
-                    let (allocation_id, slot) = self.gc_vertex.alloc(gc_boxes.len());
-                    slot.copy_from_slice(&gc_boxes);
-                    Some(allocation_id)
-                } else {
-                    None
-                }
             } else {
-                None
+                Some(alloc_lane_boxes(
+                    &mut boxes.annotations,
+                    &thread.annotation_boxes,
+                    lane,
+                ))
             };
+            thread_data.push(ThreadBatch {
+                thread_id: thread.thread_id,
+                call_boxes,
+                annotation_boxes,
+            });
+            line_segments.push(LineSegment {
+                start_time: encode_time(thread.line_start),
+                end_time: encode_time(thread.line_end),
+                start_pos: [0.0, 0.0, 0.5],
+                end_pos: [0.0, 0.0, 0.5],
+                color: THREAD_LINE_COLOR,
+                kind: LineSegment::KIND_THREAD,
+                lane,
+                _padding: [0; 2],
+            });
+            for &mark in &thread.marks {
+                let time = encode_time(mark);
+                line_segments.push(LineSegment {
+                    start_time: time,
+                    end_time: time,
+                    start_pos: [0.0, -MARK_HEIGHT, 0.5],
+                    end_pos: [0.0, 0.0, 0.5],
+                    color: MARK_COLOR,
+                    kind: LineSegment::KIND_THREAD,
+                    lane,
+                    _padding: [0; 2],
+                });
+            }
+        }
 
-            let end_time = trace.end_time();
-            let max_depth = trace.max_depth();
-            self.thread_queue.push(Reverse(TraceBatch {
-                end_time,
-                max_depth,
-                thread_data: allocation_ids,
-                line_data,
-                gc_data,
-            }));
-            self.depth.insert(max_depth);
-        }
-        self.base_time = (Instant::now() - *BASE_TIME.get().unwrap()).as_nanos() as u64;
-        while let Some(Reverse(TraceBatch { end_time, .. })) = self.thread_queue.peek()
-            && end_time + VISIBLE_DURATION < self.base_time
+        let line_data = if !line_segments.is_empty() {
+            let (allocation_id, slot) = self.thread_line_vertex.alloc(line_segments.len());
+            slot.copy_from_slice(&line_segments);
+            Some(allocation_id)
+        } else {
+            None
+        };
+        let gc_data = if !batch.gc_events.is_empty() {
+            let (allocation_id, slot) = self.gc_vertex.alloc(batch.gc_events.len());
+            for (gc_box, &event_time) in slot.iter_mut().zip(&batch.gc_events) {
+                *gc_box = GCBox {
+                    time: encode_time(event_time),
+                };
+            }
+            Some(allocation_id)
+        } else {
+            None
+        };
+
+        self.depth.insert(batch.max_depth);
+        TraceBatch {
+            end_time: batch.end_time,
+            max_depth: batch.max_depth,
+            thread_data,
+            line_data,
+            gc_data,
+            history: None,
+            restored,
+        }
+    }
+
+    fn free_batch(&mut self, batch: TraceBatch) {
+        let TraceBatch {
+            thread_data,
+            line_data,
+            max_depth,
+            gc_data,
+            restored,
+            ..
+        } = batch;
+        let boxes = if restored {
+            &mut self.restored_boxes
+        } else {
+            &mut self.boxes
+        };
+        self.depth.remove(max_depth);
+        for ThreadBatch {
+            thread_id,
+            call_boxes,
+            annotation_boxes,
+        } in thread_data
         {
-            let Reverse(TraceBatch {
-                thread_data,
-                line_data,
-                max_depth,
-                gc_data,
-                ..
-            }) = self.thread_queue.pop().unwrap();
-            self.depth.remove(max_depth);
-            for (thread_id, allocation_id) in thread_data {
-                match self.data_per_thread.entry(thread_id) {
-                    Entry::Vacant(_) => unreachable!(),
-                    Entry::Occupied(mut s) => {
-                        let s_ref = s.get_mut();
-                        s_ref.used_segments -= 1;
-                        if s_ref.used_segments == 0 {
-                            s.remove();
-                        } else if let Some(allocation_id) = allocation_id {
-                            s_ref.vertex.dealloc(allocation_id);
-                        }
-                    }
+            for (vertex, allocation_id) in boxes.calls.iter_mut().zip(call_boxes) {
+                if let Some(allocation_id) = allocation_id {
+                    vertex.dealloc(allocation_id);
                 }
             }
-            if let Some(line_allocation_id) = line_data {
-                self.thread_line_vertex.dealloc(line_allocation_id);
+            if let Some(allocation_id) = annotation_boxes {
+                boxes.annotations.dealloc(allocation_id);
             }
-            if let Some(gc_allocation_id) = gc_data {
-                self.gc_vertex.dealloc(gc_allocation_id);
+            match self.data_per_thread.entry(thread_id) {
+                Entry::Vacant(_) => unreachable!(),
+                Entry::Occupied(mut s) => {
+                    s.get_mut().used_segments -= 1;
+                    if s.get().used_segments == 0 {
+                        self.lane_slots.free(s.remove().slot);
+                    }
+                }
             }
         }
-        updated
+        if let Some(line_allocation_id) = line_data {
+            self.thread_line_vertex.dealloc(line_allocation_id);
+        }
+        if let Some(gc_allocation_id) = gc_data {
+            self.gc_vertex.dealloc(gc_allocation_id);
+        }
+    }
+
+    /// Highlights methods whose name matches `pattern` and dims all others.
+    /// `None` or an empty pattern turns highlighting off.
+    pub fn set_search(&mut self, pattern: Option<&str>) {
+        self.search = pattern.map(Pattern::new).filter(|p| !p.is_empty());
+        self.longest_match = None;
+        self.highlight.reset(self.search.is_some());
+        if let Some(pattern) = &self.search {
+            for (key, symbol) in self.symbols.methods() {
+                if pattern.matches(symbol.name()) {
+                    self.highlight.set(key);
+                }
+            }
+        }
+    }
+
+    pub fn cycle_heatmap(&mut self) {
+        self.heatmap_view.cycle_level();
+    }
+
+    /// Steps the context filter from the most recently active context to
+    /// older ones, then back to showing everything.
+    pub fn cycle_context_filter(&mut self) {
+        let recent = self.context_stats.recent();
+        self.context_filter = match self.context_filter {
+            None => recent.first().copied(),
+            Some(current) => recent
+                .iter()
+                .position(|&id| id == current)
+                .and_then(|index| recent.get(index + 1).copied()),
+        };
+    }
+
+    /// Whether any batch is on screen and the view follows the newest data,
+    /// so it scrolls as time passes.
+    pub fn has_data(&self) -> bool {
+        self.view.is_live() && !self.thread_queue.is_empty()
+    }
+
+    /// Freezes the view at the current time, or follows the newest data
+    /// again.
+    pub fn toggle_pause(&mut self) {
+        self.view.toggle_pause(self.base_time);
+    }
+
+    /// Moves the view by `steps` quarters of the screen, negative steps
+    /// towards older data, as far back as the history goes.
+    pub fn scroll(&mut self, steps: i32) {
+        let oldest = self
+            .history
+            .start_time()
+            .or_else(|| {
+                self.thread_queue
+                    .peek()
+                    .map(|Reverse(batch)| batch.end_time)
+            })
+            .unwrap_or(self.base_time);
+        self.view.scroll(steps, self.base_time, oldest);
+    }
+
+    /// Stretches the time axis by `factor`, between the full visible window
+    /// and a 1024th of it.
+    pub fn zoom_by(&mut self, factor: f32) {
+        self.view.zoom_by(factor);
+    }
+
+    /// Centers the view on the next call after the middle of the screen, or
+    /// the previous one before it, of any method matching the search.
+    /// Returns false when there is no such call.
+    pub fn jump_to_match(&mut self, forward: bool) -> bool {
+        let Some(pattern) = &self.search else {
+            return false;
+        };
+        let center = self
+            .view
+            .end_time(self.base_time)
+            .saturating_sub(self.view.duration() / 2);
+        let starts = self
+            .symbols
+            .methods()
+            .filter(|(_, symbol)| pattern.matches(symbol.name()))
+            .filter_map(|(key, _)| {
+                if forward {
+                    self.occurrences.next_after(key, center)
+                } else {
+                    self.occurrences.prev_before(key, center)
+                }
+            })
+            .map(|occurrence| occurrence.start_time);
+        let target = if forward { starts.min() } else { starts.max() };
+        let Some(time) = target else {
+            return false;
+        };
+        self.view.center_on(time, self.base_time);
+        true
+    }
+
+    /// Centers the view on the longest calls of the methods matching the
+    /// search one at a time, from the longest down, or back up when
+    /// `forward` is false. Returns false when there is no such call.
+    pub fn cycle_longest_match(&mut self, forward: bool) -> bool {
+        let Some(pattern) = &self.search else {
+            return false;
+        };
+        let longest = self.occurrences.longest(
+            self.symbols
+                .methods()
+                .filter(|(_, symbol)| pattern.matches(symbol.name()))
+                .map(|(key, _)| key),
+        );
+        if longest.is_empty() {
+            self.longest_match = None;
+            return false;
+        }
+        let rank = match self.longest_match {
+            Some((rank, _)) if forward => (rank + 1) % longest.len(),
+            Some((rank, _)) => (rank + longest.len() - 1) % longest.len(),
+            None if forward => 0,
+            None => longest.len() - 1,
+        };
+        let call = longest[rank];
+        self.longest_match = Some((rank, call));
+        self.view
+            .center_on(call.start_time + call.duration / 2, self.base_time);
+        true
+    }
+
+    /// The rank, from 1, and duration of the call `cycle_longest_match`
+    /// last centered the view on.
+    pub fn longest_match(&self) -> Option<(usize, Duration)> {
+        let (rank, call) = self.longest_match?;
+        Some((rank + 1, Duration::from_nanos(call.duration)))
+    }
+
+    /// How far the view is behind the current time and how far it is
+    /// zoomed in, or `None` while it follows the newest data unzoomed.
+    pub fn view_status(&self) -> Option<(Duration, f32)> {
+        if self.view.is_live() && self.view.zoom() == 1.0 {
+            return None;
+        }
+        let behind = self.base_time - self.view.end_time(self.base_time);
+        Some((Duration::from_nanos(behind), self.view.zoom()))
+    }
+
+    pub fn context_filter(&self) -> Option<(u32, ContextSummary)> {
+        let context = self.context_filter?;
+        Some((context, *self.context_stats.get(context)?))
     }
 
     pub fn render(&mut self) -> Result<(), wgpu::SurfaceError> {
@@ -822,10 +1411,14 @@ impl Renderer {
             Vec3::Y,                   // up
         );
         let proj = perspective(std::f32::consts::FRAC_PI_4, aspect, 0.1, 10000.0);
-        self.camera_uniform.view_proj = (proj * view).to_cols_array_2d();
-        self.camera_uniform.base_time = encode_time(self.base_time);
+        // Zooming stretches the time axis away from the end of the view.
+        let zoom = Mat4::from_scale(Vec3::new(self.view.zoom(), 1.0, 1.0));
+        let view_proj = proj * view * zoom;
+        let view_end = self.view.end_time(self.base_time);
+        self.camera_uniform.view_proj = view_proj.to_cols_array_2d();
+        self.camera_uniform.base_time = encode_time(view_end);
         self.camera_uniform.max_depth = self.depth.max().map_or(1, |&m| m + 1);
-        self.camera_uniform.num_threads = self.data_per_thread.len() as u32;
+        self.camera_uniform.context_filter = self.context_filter.unwrap_or(0);
 
         self.queue.write_buffer(
             &self.camera_buffer,
@@ -833,6 +1426,60 @@ impl Renderer {
             bytemuck::cast_slice(&[self.camera_uniform]),
         );
 
+        self.heatmap_view.sync();
+        self.counter_view.sync(view_end);
+
+        // Older batches are farther from the camera, so they are drawn at the
+        // coarsest level whose merged boxes still fit in a pixel there.
+        let mut visible: [Vec<AllocationId>; lod::LEVELS] = Default::default();
+        let batches = self.thread_queue.iter().map(|Reverse(batch)| batch);
+        for batch in batches.chain(self.restored.values()) {
+            let age = view_end.saturating_sub(batch.end_time);
+            let level = lod::level_for(ns_per_pixel(
+                view_proj,
+                state.config.width,
+                state.config.height,
+                age,
+            ));
+            for thread in &batch.thread_data {
+                let drawn = thread.call_boxes[..=level]
+                    .iter()
+                    .enumerate()
+                    .rev()
+                    .find_map(|(level, id)| Some((level, (*id)?)));
+                if let Some((level, id)) = drawn {
+                    visible[level].push(id);
+                }
+            }
+        }
+        // Only the ranges changed since the last frame are uploaded. They are
+        // submitted before the surface texture is acquired, so they are not
+        // lost when that fails.
+        let mut upload = self
+            .device
+            .create_command_encoder(&wgpu::CommandEncoderDescriptor {
+                label: Some("Upload Encoder"),
+            });
+        self.boxes.sync(&mut upload, &mut self.staging_belt);
+        self.restored_boxes
+            .sync(&mut upload, &mut self.staging_belt);
+        self.thread_line_vertex
+            .sync(&mut upload, &mut self.staging_belt);
+        self.gc_vertex.sync(&mut upload, &mut self.staging_belt);
+        self.staging_belt.finish();
+        self.queue.submit(iter::once(upload.finish()));
+        self.staging_belt.recall();
+
+        self.call_draws.clear();
+        for boxes in [&self.boxes, &self.restored_boxes] {
+            for (vertex, ids) in boxes.calls.iter().zip(&visible) {
+                vertex.read_allocations(ids.iter().copied(), |buffer, range| {
+                    self.call_draws.push(buffer, range)
+                });
+            }
+        }
+        self.call_draws.sync(self.num_indices);
+
         let output = state.surface.get_current_texture()?;
         let view = output
             .texture
@@ -873,34 +1520,33 @@ impl Renderer {
                 multiview_mask: None,
             });
 
+            render_pass.set_bind_group(1, &self.method_bind_group, &[]);
             render_pass.set_pipeline(&state.render_pipeline);
             render_pass.set_vertex_buffer(0, self.vertex_buffer.slice(..));
             render_pass.set_index_buffer(self.index_buffer.slice(..), wgpu::IndexFormat::Uint16);
 
             let num_indices = self.num_indices;
             let camera_bind_group = &self.camera_bind_group;
-            let lane_alignment = self.lane_alignment;
 
-            for (lane, (_, vertices)) in self.data_per_thread.iter_mut().enumerate() {
-                vertices.vertex.sync();
-                vertices.vertex.read_buffers(|buffer, len| {
+            render_pass.set_bind_group(0, camera_bind_group, &[]);
+            self.call_draws.draw(&mut render_pass, num_indices);
+
+            render_pass.set_pipeline(&state.annotation_pipeline);
+            for boxes in [&self.boxes, &self.restored_boxes] {
+                boxes.annotations.read_buffers(|buffer, len| {
                     if len == 0 {
                         return;
                     }
-                    let offset = lane as u32 * lane_alignment;
-                    render_pass.set_bind_group(0, camera_bind_group, &[offset]);
                     render_pass.set_vertex_buffer(1, buffer.slice(..));
                     render_pass.draw_indexed(0..num_indices, 0, 0..len as u32);
                 });
             }
 
             render_pass.set_pipeline(&state.line_pipeline);
-            render_pass.set_bind_group(0, camera_bind_group, &[0]);
             render_pass.set_vertex_buffer(0, self.line_vertex_buffer.slice(..));
             render_pass.set_vertex_buffer(1, self.axis_line_buffer.slice(..));
             render_pass.draw(0..2, 0..AXIS_LINE_INSTANCES.len() as u32);
 
-            self.thread_line_vertex.sync();
             self.thread_line_vertex.read_buffers(|buffer, len| {
                 if len == 0 {
                     return;
@@ -910,9 +1556,10 @@ impl Renderer {
                 render_pass.draw(0..2, 0..len as u32);
             });
 
+            render_pass.set_vertex_buffer(0, self.line_vertex_buffer.slice(..));
+            self.counter_view.draw(&mut render_pass);
+
             render_pass.set_pipeline(&state.gc_pipeline);
-            render_pass.set_bind_group(0, camera_bind_group, &[0]);
-            self.gc_vertex.sync();
             self.gc_vertex.read_buffers(|buffer, len| {
                 if len == 0 {
                     return;
@@ -921,6 +1568,12 @@ impl Renderer {
                 render_pass.set_vertex_buffer(1, buffer.slice(..));
                 render_pass.draw(0..4, 0..len as u32);
             });
+
+            self.heatmap_view.draw(
+                &mut render_pass,
+                &state.heatmap_pipeline,
+                &self.method_bind_group,
+            );
         }
 
         self.queue.submit(iter::once(encoder.finish()));
@@ -930,6 +1583,67 @@ impl Renderer {
     }
 }
 
+/// Call boxes of all lanes, one arena per `lod` level, and annotation
+/// boxes.
+struct BoxArenas {
+    calls: [PagedArena<CallBox>; lod::LEVELS],
+    annotations: PagedArena<CallBox>,
+}
+
+impl BoxArenas {
+    fn new(device: &wgpu::Device) -> BoxArenas {
+        let arena = || {
+            PagedArena::new(
+                device.clone(),
+                BufferUsages::COPY_DST | BufferUsages::VERTEX,
+            )
+        };
+        BoxArenas {
+            calls: std::array::from_fn(|_| arena()),
+            annotations: arena(),
+        }
+    }
+
+    fn sync(&mut self, encoder: &mut wgpu::CommandEncoder, belt: &mut StagingBelt) {
+        for vertex in &mut self.calls {
+            vertex.sync(encoder, belt);
+        }
+        self.annotations.sync(encoder, belt);
+    }
+}
+
+/// Copies a thread's boxes into an arena shared by all lanes, tagged with
+/// the thread's lane.
+fn alloc_lane_boxes(
+    vertex: &mut PagedArena<CallBox>,
+    boxes: &[CallBox],
+    lane: u32,
+) -> AllocationId {
+    let (allocation_id, slot) = vertex.alloc(boxes.len());
+    slot.copy_from_slice(boxes);
+    for call_box in slot {
+        call_box.set_lane(lane);
+    }
+    allocation_id
+}
+
+/// Nanoseconds of trace per screen pixel along the time axis, `age`
+/// nanoseconds before the base time. Returns 0 where the axis is behind the
+/// camera, which selects the finest level.
+fn ns_per_pixel(view_proj: Mat4, width: u32, height: u32, age: u64) -> f64 {
+    const STEP: f32 = 0.002;
+    let x = age as f32 / 500000000.0;
+    let half_size = Vec2::new(width as f32, height as f32) / 2.0;
+    let project = |x: f32| {
+        let clip = view_proj * Vec4::new(x, 0.5, 0.5, 1.0);
+        (clip.w > 0.0).then(|| clip.truncate().truncate() / clip.w * half_size)
+    };
+    match (project(x), project(x + STEP)) {
+        (Some(a), Some(b)) if a != b => STEP as f64 * 500000000.0 / a.distance(b) as f64,
+        _ => 0.0,
+    }
+}
+
 struct MultiSet<T> {
     inner: BTreeMap<T, usize>,
 }
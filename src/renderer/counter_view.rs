@@ -0,0 +1,139 @@
+use super::LineSegment;
+use crate::counters::{Bucket, Counters};
+use crate::symbol_table::hsl_to_rgb;
+use crate::trace_state::{SlowTrace, VISIBLE_DURATION, encode_time};
+use wgpu::{Buffer, BufferAddress, BufferDescriptor, BufferUsages, Device, Queue, RenderPass};
+
+/// Horizontal resolution of the graphs. Each bucket is drawn as its min/max
+/// range plus a connector from the previous bucket, so the segment count
+/// per series stays bounded however many samples are visible.
+const BUCKETS: usize = 512;
+/// Depth between graph planes, starting behind the first thread lane.
+const SERIES_SPACING: f32 = 0.15;
+const INITIAL_CAPACITY: usize = 1024;
+
+/// Line graphs of the `Rrtrace.counter` series over the visible window.
+/// Every series is scaled to its own visible range.
+pub struct CounterView {
+    device: Device,
+    queue: Queue,
+    counters: Counters,
+    buckets: Vec<Option<Bucket>>,
+    segments: Vec<LineSegment>,
+    buffer: Buffer,
+}
+
+impl CounterView {
+    pub fn new(device: Device, queue: Queue) -> CounterView {
+        let buffer = Self::create_buffer(&device, INITIAL_CAPACITY);
+        CounterView {
+            device,
+            queue,
+            counters: Counters::new(),
+            buckets: vec![None; BUCKETS + 1],
+            segments: Vec::new(),
+            buffer,
+        }
+    }
+
+    fn create_buffer(device: &Device, capacity: usize) -> Buffer {
+        device.create_buffer(&BufferDescriptor {
+            label: Some("Counter Line Buffer"),
+            size: (capacity * size_of::<LineSegment>()) as BufferAddress,
+            usage: BufferUsages::VERTEX | BufferUsages::COPY_DST,
+            mapped_at_creation: false,
+        })
+    }
+
+    pub fn record(&mut self, trace: &SlowTrace) {
+        self.counters.record(trace);
+    }
+
+    pub fn evict_before(&mut self, time: u64) {
+        self.counters.evict_before(time);
+    }
+
+    /// Rebuilds the graphs for the window ending at `base_time`. Buckets are
+    /// aligned to absolute time so that they do not shimmer while scrolling.
+    pub fn sync(&mut self, base_time: u64) {
+        let bucket_ns = VISIBLE_DURATION / BUCKETS as u64;
+        let start = base_time.saturating_sub(VISIBLE_DURATION) / bucket_ns * bucket_ns;
+        self.segments.clear();
+        for (index, (key, series)) in self.counters.series().enumerate() {
+            self.buckets.fill(None);
+            series.downsample(start, bucket_ns, &mut self.buckets);
+            let (min, max) = self
+                .buckets
+                .iter()
+                .flatten()
+                .fold((f32::INFINITY, f32::NEG_INFINITY), |(min, max), bucket| {
+                    (min.min(bucket.min), max.max(bucket.max))
+                });
+            if min > max {
+                continue;
+            }
+            let y = |value: f32| {
+                if max > min {
+                    (value - min) / (max - min)
+                } else {
+                    0.5
+                }
+            };
+            let z = -SERIES_SPACING * (index + 1) as f32;
+            let color = series_color(key);
+            let mut segment = |start_time: u64, start_y: f32, end_time: u64, end_y: f32| {
+                self.segments.push(LineSegment {
+                    start_time: encode_time(start_time),
+                    end_time: encode_time(end_time),
+                    start_pos: [0.0, start_y, z],
+                    end_pos: [0.0, end_y, z],
+                    color,
+                    kind: LineSegment::KIND_GRAPH,
+                    lane: 0,
+                    _padding: [0; 2],
+                });
+            };
+            let mut previous = None;
+            for (i, bucket) in self.buckets.iter().enumerate() {
+                let Some(bucket) = bucket else {
+                    continue;
+                };
+                let time = start + i as u64 * bucket_ns + bucket_ns / 2;
+                if let Some((previous_time, previous_value)) = previous {
+                    segment(previous_time, y(previous_value), time, y(bucket.first));
+                }
+                if bucket.max > bucket.min {
+                    segment(time, y(bucket.min), time, y(bucket.max));
+                }
+                previous = Some((time, bucket.last));
+            }
+        }
+
+        if self.segments.is_empty() {
+            return;
+        }
+        let capacity = self.buffer.size() as usize / size_of::<LineSegment>();
+        if self.segments.len() > capacity {
+            self.buffer =
+                Self::create_buffer(&self.device, self.segments.len().next_power_of_two());
+        }
+        self.queue
+            .write_buffer(&self.buffer, 0, bytemuck::cast_slice(&self.segments));
+    }
+
+    /// Expects the line pipeline, the camera bind group and the line vertex
+    /// buffer in slot 0 to be set.
+    pub fn draw(&self, render_pass: &mut RenderPass<'_>) {
+        if self.segments.is_empty() {
+            return;
+        }
+        render_pass.set_vertex_buffer(1, self.buffer.slice(..));
+        render_pass.draw(0..2, 0..self.segments.len() as u32);
+    }
+}
+
+fn series_color(key: u32) -> [f32; 4] {
+    let hue = (key as f32 * 0.618_034 + 0.1).fract();
+    let [r, g, b] = hsl_to_rgb(hue, 0.8, 0.6);
+    [r, g, b, 1.0]
+}
@@ -0,0 +1,234 @@
+use crate::heatmap::{COLUMNS, Heatmap, LEVELS, ROWS};
+use crate::trace_state::SlowTrace;
+use wgpu::util::DeviceExt;
+
+#[repr(C)]
+#[derive(Copy, Clone, Debug, bytemuck::Pod, bytemuck::Zeroable)]
+struct HeatmapParams {
+    head_column: u32,
+    bucket_ns: f32,
+    _padding: [u32; 2],
+    rows: [[u32; 4]; ROWS],
+}
+
+/// Draws one level of the `Heatmap` as a single textured quad overlaid on
+/// the bottom of the window. Hidden until toggled on.
+pub struct HeatmapView {
+    queue: wgpu::Queue,
+    heatmap: Heatmap,
+    level: Option<usize>,
+    texture: wgpu::Texture,
+    params_buffer: wgpu::Buffer,
+    bind_group: wgpu::BindGroup,
+    shader: wgpu::ShaderModule,
+    pipeline_layout: wgpu::PipelineLayout,
+    needs_upload: bool,
+}
+
+impl HeatmapView {
+    pub fn new(
+        device: &wgpu::Device,
+        queue: wgpu::Queue,
+        method_bind_group_layout: &wgpu::BindGroupLayout,
+    ) -> HeatmapView {
+        let shader = device.create_shader_module(wgpu::include_wgsl!("../heatmap.wgsl"));
+        let texture = device.create_texture(&wgpu::TextureDescriptor {
+            label: Some("Heatmap Texture"),
+            size: wgpu::Extent3d {
+                width: COLUMNS as u32,
+                height: ROWS as u32,
+                depth_or_array_layers: 1,
+            },
+            mip_level_count: 1,
+            sample_count: 1,
+            dimension: wgpu::TextureDimension::D2,
+            format: wgpu::TextureFormat::R32Float,
+            usage: wgpu::TextureUsages::TEXTURE_BINDING | wgpu::TextureUsages::COPY_DST,
+            view_formats: &[],
+        });
+        let params_buffer = device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
+            label: Some("Heatmap Params Buffer"),
+            contents: bytemuck::bytes_of(&HeatmapParams {
+                head_column: 0,
+                bucket_ns: 1.0,
+                _padding: [0; 2],
+                rows: [[0; 4]; ROWS],
+            }),
+            usage: wgpu::BufferUsages::UNIFORM | wgpu::BufferUsages::COPY_DST,
+        });
+
+        let bind_group_layout = device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
+            entries: &[
+                wgpu::BindGroupLayoutEntry {
+                    binding: 0,
+                    visibility: wgpu::ShaderStages::FRAGMENT,
+                    ty: wgpu::BindingType::Buffer {
+                        ty: wgpu::BufferBindingType::Uniform,
+                        has_dynamic_offset: false,
+                        min_binding_size: None,
+                    },
+                    count: None,
+                },
+                wgpu::BindGroupLayoutEntry {
+                    binding: 1,
+                    visibility: wgpu::ShaderStages::FRAGMENT,
+                    ty: wgpu::BindingType::Texture {
+                        sample_type: wgpu::TextureSampleType::Float { filterable: false },
+                        view_dimension: wgpu::TextureViewDimension::D2,
+                        multisampled: false,
+                    },
+                    count: None,
+                },
+            ],
+            label: Some("heatmap_bind_group_layout"),
+        });
+        let view = texture.create_view(&wgpu::TextureViewDescriptor::default());
+        let bind_group = device.create_bind_group(&wgpu::BindGroupDescriptor {
+            layout: &bind_group_layout,
+            entries: &[
+                wgpu::BindGroupEntry {
+                    binding: 0,
+                    resource: params_buffer.as_entire_binding(),
+                },
+                wgpu::BindGroupEntry {
+                    binding: 1,
+                    resource: wgpu::BindingResource::TextureView(&view),
+                },
+            ],
+            label: Some("heatmap_bind_group"),
+        });
+        let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
+            label: Some("Heatmap Pipeline Layout"),
+            bind_group_layouts: &[&bind_group_layout, method_bind_group_layout],
+            immediate_size: 0,
+        });
+
+        HeatmapView {
+            queue,
+            heatmap: Heatmap::new(),
+            level: None,
+            texture,
+            params_buffer,
+            bind_group,
+            shader,
+            pipeline_layout,
+            needs_upload: false,
+        }
+    }
+
+    pub fn create_pipeline(
+        &self,
+        device: &wgpu::Device,
+        format: wgpu::TextureFormat,
+    ) -> wgpu::RenderPipeline {
+        device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
+            label: Some("Heatmap Pipeline"),
+            layout: Some(&self.pipeline_layout),
+            vertex: wgpu::VertexState {
+                module: &self.shader,
+                entry_point: Some("vs_heatmap"),
+                buffers: &[],
+                compilation_options: Default::default(),
+            },
+            fragment: Some(wgpu::FragmentState {
+                module: &self.shader,
+                entry_point: Some("fs_heatmap"),
+                targets: &[Some(wgpu::ColorTargetState {
+                    format,
+                    blend: Some(wgpu::BlendState::ALPHA_BLENDING),
+                    write_mask: wgpu::ColorWrites::ALL,
+                })],
+                compilation_options: Default::default(),
+            }),
+            primitive: wgpu::PrimitiveState {
+                topology: wgpu::PrimitiveTopology::TriangleStrip,
+                strip_index_format: None,
+                front_face: wgpu::FrontFace::Ccw,
+                cull_mode: None,
+                polygon_mode: wgpu::PolygonMode::Fill,
+                unclipped_depth: false,
+                conservative: false,
+            },
+            depth_stencil: Some(wgpu::DepthStencilState {
+                format: wgpu::TextureFormat::Depth32Float,
+                depth_write_enabled: false,
+                depth_compare: wgpu::CompareFunction::Always,
+                stencil: wgpu::StencilState::default(),
+                bias: wgpu::DepthBiasState::default(),
+            }),
+            multisample: wgpu::MultisampleState::default(),
+            cache: None,
+            multiview_mask: None,
+        })
+    }
+
+    pub fn record(&mut self, trace: &SlowTrace) {
+        self.heatmap.record(trace);
+    }
+
+    /// Cycles hidden -> 10 ms buckets -> 160 ms -> ... -> hidden.
+    pub fn cycle_level(&mut self) {
+        self.level = match self.level {
+            None => Some(0),
+            Some(level) if level + 1 < LEVELS => Some(level + 1),
+            Some(_) => None,
+        };
+        self.needs_upload = true;
+    }
+
+    pub fn sync(&mut self) {
+        self.needs_upload |= self.heatmap.take_dirty();
+        let Some(level) = self.level else {
+            return;
+        };
+        if !std::mem::take(&mut self.needs_upload) {
+            return;
+        }
+
+        self.queue.write_texture(
+            wgpu::TexelCopyTextureInfo {
+                texture: &self.texture,
+                mip_level: 0,
+                origin: wgpu::Origin3d::ZERO,
+                aspect: wgpu::TextureAspect::All,
+            },
+            bytemuck::cast_slice(self.heatmap.cells(level)),
+            wgpu::TexelCopyBufferLayout {
+                offset: 0,
+                bytes_per_row: Some((COLUMNS * size_of::<f32>()) as u32),
+                rows_per_image: Some(ROWS as u32),
+            },
+            wgpu::Extent3d {
+                width: COLUMNS as u32,
+                height: ROWS as u32,
+                depth_or_array_layers: 1,
+            },
+        );
+
+        let keys = self.heatmap.row_keys();
+        let order = self.heatmap.row_order();
+        let params = HeatmapParams {
+            head_column: (self.heatmap.head(level) % COLUMNS as u64) as u32,
+            bucket_ns: self.heatmap.bucket_ns(level) as f32,
+            _padding: [0; 2],
+            rows: order.map(|row| [row, keys[row as usize], 0, 0]),
+        };
+        self.queue
+            .write_buffer(&self.params_buffer, 0, bytemuck::bytes_of(&params));
+    }
+
+    pub fn draw(
+        &self,
+        render_pass: &mut wgpu::RenderPass<'_>,
+        pipeline: &wgpu::RenderPipeline,
+        method_bind_group: &wgpu::BindGroup,
+    ) {
+        if self.level.is_none() {
+            return;
+        }
+        render_pass.set_pipeline(pipeline);
+        render_pass.set_bind_group(0, &self.bind_group, &[]);
+        render_pass.set_bind_group(1, method_bind_group, &[]);
+        render_pass.draw(0..4, 0..1);
+    }
+}
@@ -0,0 +1,87 @@
+use wgpu::{Buffer, BufferAddress, BufferDescriptor, BufferUsages, Device, Queue};
+
+const INITIAL_CAPACITY: usize = 1024;
+
+/// Bitset over method keys selected by the current search, laid out as
+/// `{ active: u32, bits: array<u32> }`. Boxes test their bit in the shader,
+/// so changing the search never touches the call box buffers.
+pub struct Highlight {
+    device: Device,
+    queue: Queue,
+    words: Vec<u32>,
+    buffer: Buffer,
+    uploaded_words: usize,
+    dirty: bool,
+}
+
+impl Highlight {
+    pub fn new(device: Device, queue: Queue) -> Highlight {
+        let buffer = Self::create_buffer(&device, INITIAL_CAPACITY);
+        Highlight {
+            device,
+            queue,
+            words: vec![0],
+            buffer,
+            uploaded_words: 0,
+            dirty: true,
+        }
+    }
+
+    fn create_buffer(device: &Device, capacity: usize) -> Buffer {
+        device.create_buffer(&BufferDescriptor {
+            label: Some("Highlight Buffer"),
+            size: (capacity * size_of::<u32>()) as BufferAddress,
+            usage: BufferUsages::STORAGE | BufferUsages::COPY_DST,
+            mapped_at_creation: false,
+        })
+    }
+
+    pub fn buffer(&self) -> &Buffer {
+        &self.buffer
+    }
+
+    /// Clears all bits. While active, methods without a bit are dimmed.
+    pub fn reset(&mut self, active: bool) {
+        self.words.truncate(1);
+        self.words[0] = active as u32;
+        self.dirty = true;
+    }
+
+    pub fn set(&mut self, key: u32) {
+        let word = 1 + key as usize / 32;
+        if self.words.len() <= word {
+            self.words.resize(word + 1, 0);
+        }
+        self.words[word] |= 1 << (key % 32);
+        self.dirty = true;
+    }
+
+    /// Uploads the bitset if it changed. Returns true when the buffer was
+    /// reallocated and bind groups referring to it have to be recreated.
+    pub fn sync(&mut self) -> bool {
+        if !self.dirty {
+            return false;
+        }
+        self.dirty = false;
+
+        let capacity = self.buffer.size() as usize / size_of::<u32>();
+        let reallocated = self.words.len() > capacity;
+        if reallocated {
+            self.buffer = Self::create_buffer(&self.device, self.words.len().next_power_of_two());
+            self.uploaded_words = 0;
+        }
+        self.queue
+            .write_buffer(&self.buffer, 0, bytemuck::cast_slice(&self.words));
+        // Words past the end may still hold bits of a previous search.
+        if self.uploaded_words > self.words.len() {
+            let zeros = vec![0u32; self.uploaded_words - self.words.len()];
+            self.queue.write_buffer(
+                &self.buffer,
+                (self.words.len() * size_of::<u32>()) as BufferAddress,
+                bytemuck::cast_slice(&zeros),
+            );
+        }
+        self.uploaded_words = self.words.len();
+        reallocated
+    }
+}
@@ -0,0 +1,101 @@
+use std::ops::Range;
+use wgpu::util::DrawIndexedIndirectArgs;
+use wgpu::{Buffer, BufferAddress, BufferDescriptor, BufferUsages, Device, Queue, RenderPass};
+
+const INITIAL_CAPACITY: usize = 256;
+
+/// The instance ranges of one frame's call boxes, grouped by the arena
+/// buffer they live in. Each group is one multi-draw-indirect call where the
+/// device supports indirect draws with a first instance, and one draw per
+/// range otherwise.
+pub struct InstanceDraws {
+    device: Device,
+    queue: Queue,
+    indirect: bool,
+    indirect_buffer: Buffer,
+    capacity: usize,
+    /// Arena buffer and the part of `ranges` drawn from it.
+    groups: Vec<(Buffer, Range<usize>)>,
+    ranges: Vec<Range<u32>>,
+}
+
+impl InstanceDraws {
+    pub fn new(device: Device, queue: Queue, indirect: bool) -> InstanceDraws {
+        let indirect_buffer = Self::create_buffer(&device, INITIAL_CAPACITY);
+        InstanceDraws {
+            device,
+            queue,
+            indirect,
+            indirect_buffer,
+            capacity: INITIAL_CAPACITY,
+            groups: Vec::new(),
+            ranges: Vec::new(),
+        }
+    }
+
+    fn create_buffer(device: &Device, capacity: usize) -> Buffer {
+        device.create_buffer(&BufferDescriptor {
+            label: Some("Indirect Draw Buffer"),
+            size: (capacity * size_of::<DrawIndexedIndirectArgs>()) as BufferAddress,
+            usage: BufferUsages::INDIRECT | BufferUsages::COPY_DST,
+            mapped_at_creation: false,
+        })
+    }
+
+    pub fn clear(&mut self) {
+        self.groups.clear();
+        self.ranges.clear();
+    }
+
+    pub fn push(&mut self, buffer: &Buffer, instances: Range<u32>) {
+        let index = self.ranges.len();
+        self.ranges.push(instances);
+        match self.groups.last_mut() {
+            Some((last, range)) if last == buffer => range.end = index + 1,
+            _ => self.groups.push((buffer.clone(), index..index + 1)),
+        }
+    }
+
+    /// Writes the indirect arguments of the pushed ranges.
+    pub fn sync(&mut self, index_count: u32) {
+        if !self.indirect || self.ranges.is_empty() {
+            return;
+        }
+        if self.ranges.len() > self.capacity {
+            self.capacity = self.ranges.len().next_power_of_two();
+            self.indirect_buffer = Self::create_buffer(&self.device, self.capacity);
+        }
+        let mut bytes =
+            Vec::with_capacity(self.ranges.len() * size_of::<DrawIndexedIndirectArgs>());
+        for range in &self.ranges {
+            let args = DrawIndexedIndirectArgs {
+                index_count,
+                instance_count: range.end - range.start,
+                first_index: 0,
+                base_vertex: 0,
+                first_instance: range.start,
+            };
+            bytes.extend_from_slice(args.as_bytes());
+        }
+        self.queue.write_buffer(&self.indirect_buffer, 0, &bytes);
+    }
+
+    /// Expects the box pipeline with its bind groups, the box vertex buffer
+    /// in slot 0 and its index buffer.
+    pub fn draw(&self, render_pass: &mut RenderPass<'_>, index_count: u32) {
+        for (buffer, range) in &self.groups {
+            render_pass.set_vertex_buffer(1, buffer.slice(..));
+            if self.indirect {
+                render_pass.multi_draw_indexed_indirect(
+                    &self.indirect_buffer,
+                    (range.start * size_of::<DrawIndexedIndirectArgs>()) as BufferAddress,
+                    range.len() as u32,
+                );
+            } else {
+                for instances in &self.ranges[range.clone()] {
+                    render_pass.draw_indexed(0..index_count, 0, instances.clone());
+                }
+            }
+        }
+    }
+}
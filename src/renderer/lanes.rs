@@ -0,0 +1,171 @@
+use std::collections::BTreeSet;
+use wgpu::{Buffer, BufferAddress, BufferDescriptor, BufferUsages, Device, Queue};
+
+const INITIAL_CAPACITY: usize = 64;
+/// Depth of the lane of a thread without calls on screen, relative to a
+/// busy thread's lane.
+pub const IDLE_LANE_DEPTH: f32 = 0.25;
+
+/// Hands out the lane slots that boxes and thread lines refer to. A thread
+/// keeps its slot while it has data, so nothing has to be rewritten when
+/// other threads come and go. Freed slots are reused lowest first, and the
+/// slot range shrinks when its last slots are freed.
+#[derive(Debug, Default)]
+pub struct SlotAllocator {
+    free: BTreeSet<u32>,
+    len: u32,
+}
+
+impl SlotAllocator {
+    pub fn new() -> SlotAllocator {
+        SlotAllocator::default()
+    }
+
+    pub fn alloc(&mut self) -> u32 {
+        self.free.pop_first().unwrap_or_else(|| {
+            self.len += 1;
+            self.len - 1
+        })
+    }
+
+    pub fn free(&mut self, slot: u32) {
+        self.free.insert(slot);
+        while let Some(&last) = self.free.last()
+            && last + 1 == self.len
+        {
+            self.free.pop_last();
+            self.len -= 1;
+        }
+    }
+
+    /// One past the highest slot in use.
+    pub fn capacity(&self) -> usize {
+        self.len as usize
+    }
+}
+
+/// Where a slot's lane is drawn, laid out as `{ offset: f32, depth: f32 }`.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default, PartialEq, bytemuck::Pod, bytemuck::Zeroable)]
+pub struct LaneInfo {
+    offset: f32,
+    depth: f32,
+}
+
+/// Stacks the lanes of `threads`, given as slot and whether the thread is
+/// idle in their display order, without gaps for freed slots. Idle threads
+/// get thinner lanes. Returns the lane of every slot and the total depth.
+pub fn layout(
+    threads: impl IntoIterator<Item = (u32, bool)>,
+    slots: usize,
+) -> (Vec<LaneInfo>, f32) {
+    let mut lanes = vec![LaneInfo::default(); slots];
+    let mut offset = 0.0;
+    for (slot, idle) in threads {
+        let depth = if idle { IDLE_LANE_DEPTH } else { 1.0 };
+        lanes[slot as usize] = LaneInfo { offset, depth };
+        offset += depth;
+    }
+    (lanes, offset)
+}
+
+/// The lanes of every slot in a storage buffer, so the number of threads
+/// is not limited by uniform buffer sizes.
+pub struct LaneBuffer {
+    device: Device,
+    queue: Queue,
+    lanes: Vec<LaneInfo>,
+    buffer: Buffer,
+}
+
+impl LaneBuffer {
+    pub fn new(device: Device, queue: Queue) -> LaneBuffer {
+        let buffer = Self::create_buffer(&device, INITIAL_CAPACITY);
+        LaneBuffer {
+            device,
+            queue,
+            lanes: Vec::new(),
+            buffer,
+        }
+    }
+
+    fn create_buffer(device: &Device, capacity: usize) -> Buffer {
+        device.create_buffer(&BufferDescriptor {
+            label: Some("Lane Buffer"),
+            size: (capacity * size_of::<LaneInfo>()) as BufferAddress,
+            usage: BufferUsages::STORAGE | BufferUsages::COPY_DST,
+            mapped_at_creation: false,
+        })
+    }
+
+    pub fn buffer(&self) -> &Buffer {
+        &self.buffer
+    }
+
+    /// Uploads the lanes if they changed. Returns true when the buffer was
+    /// reallocated and bind groups referring to it have to be recreated.
+    pub fn sync(&mut self, lanes: Vec<LaneInfo>) -> bool {
+        if lanes == self.lanes {
+            return false;
+        }
+        self.lanes = lanes;
+        let capacity = self.buffer.size() as usize / size_of::<LaneInfo>();
+        let reallocated = self.lanes.len() > capacity;
+        if reallocated {
+            self.buffer = Self::create_buffer(&self.device, self.lanes.len().next_power_of_two());
+        }
+        self.queue
+            .write_buffer(&self.buffer, 0, bytemuck::cast_slice(&self.lanes));
+        reallocated
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn slots_are_reused_lowest_first_and_shrink_from_the_end() {
+        let mut slots = SlotAllocator::new();
+        assert_eq!(
+            (0..4).map(|_| slots.alloc()).collect::<Vec<_>>(),
+            [0, 1, 2, 3]
+        );
+
+        slots.free(1);
+        slots.free(2);
+        assert_eq!(slots.capacity(), 4);
+        assert_eq!(slots.alloc(), 1);
+
+        slots.free(3);
+        assert_eq!(slots.capacity(), 2);
+        slots.free(1);
+        assert_eq!(slots.capacity(), 1);
+        assert_eq!(slots.alloc(), 1);
+    }
+
+    #[test]
+    fn layout_stacks_lanes_without_gaps_and_packs_idle_threads() {
+        let (lanes, depth) = layout([(3, false), (0, true), (1, false)], 4);
+
+        assert_eq!(
+            lanes,
+            [
+                LaneInfo {
+                    offset: 1.0,
+                    depth: IDLE_LANE_DEPTH,
+                },
+                LaneInfo {
+                    offset: 1.25,
+                    depth: 1.0,
+                },
+                LaneInfo::default(),
+                LaneInfo {
+                    offset: 0.0,
+                    depth: 1.0,
+                },
+            ]
+        );
+        assert_eq!(depth, 2.25);
+    }
+}
@@ -0,0 +1,295 @@
+use crate::renderer::vertex_arena::AllocationId;
+use bytemuck::NoUninit;
+use std::collections::{BTreeMap, HashMap};
+use std::mem;
+use std::ops::Range;
+use wgpu::util::StagingBelt;
+use wgpu::{
+    Buffer, BufferAddress, BufferDescriptor, BufferSize, BufferUsages, CommandEncoder, Device,
+};
+
+const PAGE_BYTES: u64 = 1 << 20;
+/// Released pages kept for reuse, so steady eviction and growth do not
+/// create buffers.
+const MAX_SPARE_PAGES: usize = 4;
+
+struct Page<T> {
+    buffer: Buffer,
+    /// The last allocated elements, not uploaded yet. The rest of the page
+    /// is only kept on the GPU.
+    pending: Vec<T>,
+}
+
+/// How much of a page is allocated and by how many allocations.
+#[derive(Debug)]
+struct PageUse {
+    capacity: usize,
+    /// Elements allocated in the page.
+    len: usize,
+    /// Allocations in the page that have not been freed yet.
+    live: usize,
+}
+
+/// Where the allocations of a `PagedArena` are, apart from the buffers, so
+/// the page accounting does not need a device.
+#[derive(Debug)]
+struct PageTable {
+    page_len: usize,
+    /// By page number. Only the newest page is allocated from.
+    pages: BTreeMap<u64, PageUse>,
+    next_page: u64,
+    allocations: HashMap<AllocationId, (u64, Range<usize>)>,
+}
+
+impl PageTable {
+    fn new(page_len: usize) -> PageTable {
+        PageTable {
+            page_len,
+            pages: BTreeMap::new(),
+            next_page: 0,
+            allocations: HashMap::new(),
+        }
+    }
+
+    /// Appends `len` elements to the newest page, or to a new one when they
+    /// do not fit. Returns the page number, the range in the page and
+    /// whether the page is new.
+    fn alloc(&mut self, len: usize) -> (AllocationId, u64, Range<usize>, bool) {
+        let fits = self
+            .pages
+            .last_key_value()
+            .is_some_and(|(_, page)| page.len + len <= page.capacity);
+        if !fits {
+            let page = PageUse {
+                capacity: len.max(self.page_len),
+                len: 0,
+                live: 0,
+            };
+            self.pages.insert(self.next_page, page);
+            self.next_page += 1;
+        }
+        let (&page_number, page) = self.pages.iter_mut().next_back().unwrap();
+        let range = page.len..page.len + len;
+        page.len += len;
+        page.live += 1;
+
+        let id = AllocationId::new();
+        self.allocations.insert(id, (page_number, range.clone()));
+        (id, page_number, range, !fits)
+    }
+
+    /// Frees the allocation, and its page if nothing else is left in it.
+    /// Returns the number of a freed page.
+    fn dealloc(&mut self, id: AllocationId) -> Option<u64> {
+        let (page_number, _) = self.allocations.remove(&id)?;
+        let page = self.pages.get_mut(&page_number).unwrap();
+        page.live -= 1;
+        if page.live > 0 {
+            return None;
+        }
+        self.pages.remove(&page_number);
+        Some(page_number)
+    }
+}
+
+/// An arena for data that is freed in about the order it was allocated, as
+/// batches are. Allocations are appended to the newest page, and each page
+/// is released once everything in them is freed, so allocating and freeing
+/// are O(1), nothing fragments, and an allocation that outlives the ones
+/// after it keeps only its own page.
+///
+/// Each page has its own GPU buffer. An allocation never spans pages, and
+/// allocations larger than a page get a page of their own. Nothing is read
+/// back from the arena, so data is dropped from the CPU once uploaded.
+pub struct PagedArena<T> {
+    device: Device,
+    usage: BufferUsages,
+    table: PageTable,
+    pages: BTreeMap<u64, Page<T>>,
+    /// Buffers of released pages of the default size.
+    spare: Vec<Buffer>,
+}
+
+impl<T> PagedArena<T> {
+    pub fn new(device: Device, usage: BufferUsages) -> PagedArena<T> {
+        let max_len = device.limits().max_buffer_size / size_of::<T>() as u64;
+        let page_len = (PAGE_BYTES / size_of::<T>() as u64).min(max_len) as usize;
+        PagedArena {
+            device,
+            usage,
+            table: PageTable::new(page_len),
+            pages: BTreeMap::new(),
+            spare: Vec::new(),
+        }
+    }
+
+    pub fn alloc(&mut self, len: usize) -> (AllocationId, &mut [T])
+    where
+        T: Default,
+    {
+        let (id, page_number, _, new_page) = self.table.alloc(len);
+        if new_page {
+            let page = self.new_page(self.table.pages[&page_number].capacity);
+            self.pages.insert(page_number, page);
+        }
+        let page = self.pages.get_mut(&page_number).unwrap();
+        let pending_start = page.pending.len();
+        page.pending.resize_with(pending_start + len, T::default);
+        (id, &mut page.pending[pending_start..])
+    }
+
+    fn new_page(&mut self, len: usize) -> Page<T> {
+        let buffer = if len == self.table.page_len
+            && let Some(buffer) = self.spare.pop()
+        {
+            buffer
+        } else {
+            self.device.create_buffer(&BufferDescriptor {
+                label: None,
+                size: (len * size_of::<T>()) as BufferAddress,
+                usage: self.usage,
+                mapped_at_creation: false,
+            })
+        };
+        Page {
+            buffer,
+            pending: Vec::new(),
+        }
+    }
+
+    pub fn dealloc(&mut self, id: AllocationId) {
+        let Some(page_number) = self.table.dealloc(id) else {
+            return;
+        };
+        let page = self.pages.remove(&page_number).unwrap();
+        let page_bytes = (self.table.page_len * size_of::<T>()) as BufferAddress;
+        if page.buffer.size() == page_bytes && self.spare.len() < MAX_SPARE_PAGES {
+            self.spare.push(page.buffer);
+        }
+    }
+
+    /// Uploads what was allocated since the last sync through `belt`, with
+    /// the copies recorded into `encoder`.
+    pub fn sync(&mut self, encoder: &mut CommandEncoder, belt: &mut StagingBelt)
+    where
+        T: NoUninit,
+    {
+        // Only the newest page is appended to, so everything before the
+        // newest fully uploaded page is uploaded too.
+        for (page_number, page) in self.pages.iter_mut().rev() {
+            let pending = mem::take(&mut page.pending);
+            let bytes: &[u8] = bytemuck::cast_slice(&pending);
+            let Some(size) = BufferSize::new(bytes.len() as u64) else {
+                break;
+            };
+            let len = self.table.pages[page_number].len;
+            belt.write_buffer(
+                encoder,
+                &page.buffer,
+                ((len - pending.len()) * size_of::<T>()) as BufferAddress,
+                size,
+            )
+            .copy_from_slice(bytes);
+        }
+    }
+
+    pub fn read_buffers(&self, mut f: impl FnMut(&Buffer, usize)) {
+        for (page_number, page) in &self.pages {
+            let len = self.table.pages[page_number].len;
+            if len > 0 {
+                f(&page.buffer, len);
+            }
+        }
+    }
+
+    /// Like `read_buffers`, but only over the given allocations, with
+    /// neighbouring allocations drawn as one range. Allocations of other
+    /// arenas are skipped.
+    pub fn read_allocations(
+        &self,
+        ids: impl IntoIterator<Item = AllocationId>,
+        mut f: impl FnMut(&Buffer, Range<u32>),
+    ) {
+        let ranges = ids
+            .into_iter()
+            .filter_map(|id| self.table.allocations.get(&id).cloned())
+            .collect();
+        for (page_number, range) in page_ranges(ranges) {
+            f(
+                &self.pages[&page_number].buffer,
+                range.start as u32..range.end as u32,
+            );
+        }
+    }
+}
+
+/// Sorts (page, range) pairs and merges neighbouring ranges in the same
+/// page.
+fn page_ranges(mut ranges: Vec<(u64, Range<usize>)>) -> Vec<(u64, Range<usize>)> {
+    ranges.sort_unstable_by_key(|(page, range)| (*page, range.start));
+    let mut merged: Vec<(u64, Range<usize>)> = Vec::with_capacity(ranges.len());
+    for (page, range) in ranges.into_iter().filter(|(_, range)| !range.is_empty()) {
+        match merged.last_mut() {
+            Some((last_page, last)) if *last_page == page && last.end >= range.start => {
+                last.end = last.end.max(range.end)
+            }
+            _ => merged.push((page, range)),
+        }
+    }
+    merged
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::collections::VecDeque;
+
+    #[test]
+    fn page_ranges_merge_neighbours_within_a_page() {
+        assert_eq!(
+            page_ranges(vec![(1, 0..4), (0, 5..8), (0, 0..5), (1, 4..6), (0, 9..9)]),
+            [(0, 0..8), (1, 0..6)]
+        );
+        assert_eq!(
+            page_ranges(vec![(0, 4..8), (1, 8..10)]),
+            [(0, 4..8), (1, 8..10)]
+        );
+    }
+
+    #[test]
+    fn allocation_held_across_many_batches_keeps_only_its_page() {
+        let mut table = PageTable::new(100);
+        // A batch restored from the history that stays in view.
+        let (restored, ..) = table.alloc(10);
+        let mut live = VecDeque::new();
+        for _ in 0..1000 {
+            live.push_back(table.alloc(30).0);
+            if live.len() > 8 {
+                table.dealloc(live.pop_front().unwrap());
+            }
+            assert!(table.pages.len() <= 5, "{:?}", table.pages);
+        }
+        assert!(table.pages.contains_key(&0));
+
+        for id in live {
+            table.dealloc(id);
+        }
+        assert_eq!(table.pages.keys().collect::<Vec<_>>(), [&0]);
+        assert_eq!(table.dealloc(restored), Some(0));
+        assert!(table.pages.is_empty());
+        assert!(table.allocations.is_empty());
+    }
+
+    #[test]
+    fn large_allocations_get_a_page_of_their_own() {
+        let mut table = PageTable::new(100);
+        let (_, first, ..) = table.alloc(60);
+        let (large, page, range, new_page) = table.alloc(250);
+        assert!(new_page);
+        assert_ne!(page, first);
+        assert_eq!(range, 0..250);
+        assert_eq!(table.pages[&page].capacity, 250);
+        assert!(table.alloc(1).3);
+        assert_eq!(table.dealloc(large), Some(page));
+    }
+}
@@ -0,0 +1,87 @@
+use std::ops::Range;
+use wgpu::{Buffer, BufferAddress, BufferDescriptor, BufferUsages, Device, Queue};
+
+const INITIAL_CAPACITY: usize = 1024;
+
+#[repr(C)]
+#[derive(Copy, Clone, Debug, Default, bytemuck::Pod, bytemuck::Zeroable)]
+pub struct PaletteEntry {
+    pub color: u32,
+    pub category: u32,
+}
+
+/// Per-method lookup table indexed by interned method key. Entries are only
+/// ever written once per key, so uploads stay proportional to the number of
+/// newly seen methods.
+pub struct Palette {
+    device: Device,
+    queue: Queue,
+    entries: Vec<PaletteEntry>,
+    buffer: Buffer,
+    dirty_range: Range<usize>,
+}
+
+impl Palette {
+    pub fn new(device: Device, queue: Queue) -> Palette {
+        let buffer = Self::create_buffer(&device, INITIAL_CAPACITY);
+        #[allow(clippy::reversed_empty_ranges)]
+        Palette {
+            device,
+            queue,
+            entries: Vec::new(),
+            buffer,
+            dirty_range: usize::MAX..0,
+        }
+    }
+
+    fn create_buffer(device: &Device, capacity: usize) -> Buffer {
+        device.create_buffer(&BufferDescriptor {
+            label: Some("Palette Buffer"),
+            size: (capacity * size_of::<PaletteEntry>()) as BufferAddress,
+            usage: BufferUsages::STORAGE | BufferUsages::COPY_DST,
+            mapped_at_creation: false,
+        })
+    }
+
+    pub fn buffer(&self) -> &Buffer {
+        &self.buffer
+    }
+
+    pub fn set(&mut self, key: u32, entry: PaletteEntry) {
+        let index = key as usize;
+        if self.entries.len() <= index {
+            self.entries.resize(index + 1, PaletteEntry::default());
+        }
+        self.entries[index] = entry;
+        self.dirty_range.start = self.dirty_range.start.min(index);
+        self.dirty_range.end = self.dirty_range.end.max(index + 1);
+    }
+
+    /// Uploads pending entries. Returns true when the buffer was reallocated
+    /// and bind groups referring to it have to be recreated.
+    pub fn sync(&mut self) -> bool {
+        if self.dirty_range.start >= self.dirty_range.end {
+            return false;
+        }
+
+        let capacity = self.buffer.size() as usize / size_of::<PaletteEntry>();
+        let reallocated = self.entries.len() > capacity;
+        if reallocated {
+            self.buffer = Self::create_buffer(&self.device, self.entries.len().next_power_of_two());
+            self.dirty_range = 0..self.entries.len();
+        }
+
+        let offset = (self.dirty_range.start * size_of::<PaletteEntry>()) as BufferAddress;
+        self.queue.write_buffer(
+            &self.buffer,
+            offset,
+            bytemuck::cast_slice(&self.entries[self.dirty_range.clone()]),
+        );
+
+        #[allow(clippy::reversed_empty_ranges)]
+        {
+            self.dirty_range = usize::MAX..0;
+        }
+        reallocated
+    }
+}
@@ -2,15 +2,19 @@ use bytemuck::NoUninit;
 use std::collections::{BTreeMap, BTreeSet, HashMap};
 use std::fmt;
 use std::fmt::{Debug, Formatter};
+use std::mem;
 use std::ops::Range;
 use std::sync::atomic;
-use wgpu::{Buffer, BufferAddress, BufferDescriptor, BufferUsages, Device, Queue};
+use wgpu::util::StagingBelt;
+use wgpu::{
+    Buffer, BufferAddress, BufferDescriptor, BufferSize, BufferUsages, CommandEncoder, Device,
+};
 
 #[derive(Debug, Clone, Copy, Ord, PartialOrd, Eq, PartialEq, Hash)]
 pub struct AllocationId(usize);
 
 impl AllocationId {
-    fn new() -> AllocationId {
+    pub(super) fn new() -> AllocationId {
         static COUNTER: atomic::AtomicUsize = atomic::AtomicUsize::new(0);
         AllocationId(COUNTER.fetch_add(1, atomic::Ordering::Relaxed))
     }
@@ -18,13 +22,57 @@ impl AllocationId {
 
 pub struct VertexArena<T> {
     device: Device,
-    queue: Queue,
     data: Vec<T>,
     gpu_buffer: Vec<Buffer>,
     max_buffer_size: u64,
     allocations: HashMap<AllocationId, Range<usize>>,
     free_list: FreeList,
-    dirty_range: Range<usize>,
+    dirty: RangeSet,
+}
+
+/// Disjoint ranges, with inserted ranges merged into the ranges they
+/// overlap or touch.
+#[derive(Debug, Default)]
+struct RangeSet {
+    by_start: BTreeMap<usize, usize>,
+}
+
+impl RangeSet {
+    fn new() -> Self {
+        Self::default()
+    }
+
+    fn is_empty(&self) -> bool {
+        self.by_start.is_empty()
+    }
+
+    fn insert(&mut self, range: Range<usize>) {
+        if range.is_empty() {
+            return;
+        }
+        let mut start = range.start;
+        let mut end = range.end;
+        if let Some((&prev_start, &prev_end)) = self.by_start.range(..=start).next_back()
+            && prev_end >= start
+        {
+            start = prev_start;
+            end = end.max(prev_end);
+        }
+        while let Some((&next_start, &next_end)) = self.by_start.range(start..).next()
+            && next_start <= end
+        {
+            self.by_start.remove(&next_start);
+            end = end.max(next_end);
+        }
+        self.by_start.insert(start, end);
+    }
+
+    fn take(&mut self) -> Vec<Range<usize>> {
+        mem::take(&mut self.by_start)
+            .into_iter()
+            .map(|(start, end)| start..end)
+            .collect()
+    }
 }
 
 struct FreeList {
@@ -88,24 +136,22 @@ where
 }
 
 impl<T> VertexArena<T> {
-    pub fn new(device: Device, queue: Queue, usage: BufferUsages) -> VertexArena<T> {
+    pub fn new(device: Device, usage: BufferUsages) -> VertexArena<T> {
         let max_buffer_size = device.limits().max_buffer_size;
         let gpu_buffer = device.create_buffer(&BufferDescriptor {
             label: None,
             size: (max_buffer_size / size_of::<T>() as u64).min(256) * size_of::<T>() as u64,
-            usage,
+            usage: usage | BufferUsages::COPY_SRC,
             mapped_at_creation: false,
         });
-        #[allow(clippy::reversed_empty_ranges)]
         VertexArena {
             data: Vec::new(),
             device,
-            queue,
             gpu_buffer: vec![gpu_buffer],
             max_buffer_size,
             allocations: HashMap::new(),
             free_list: FreeList::new(),
-            dirty_range: usize::MAX..0,
+            dirty: RangeSet::new(),
         }
     }
 
@@ -123,8 +169,7 @@ impl<T> VertexArena<T> {
         };
 
         self.allocations.insert(id, range.clone());
-        self.dirty_range.start = self.dirty_range.start.min(range.start);
-        self.dirty_range.end = self.dirty_range.end.max(range.end);
+        self.dirty.insert(range.clone());
 
         let result = &mut self.data[range.clone()];
         assert_eq!(result.len(), len);
@@ -137,106 +182,72 @@ impl<T> VertexArena<T> {
         }
     }
 
-    pub fn sync(&mut self)
+    /// Uploads the changed ranges through `belt`, with the copies recorded
+    /// into `encoder`.
+    pub fn sync(&mut self, encoder: &mut CommandEncoder, belt: &mut StagingBelt)
     where
         T: NoUninit,
     {
-        if self.dirty_range.start >= self.dirty_range.end {
+        if self.dirty.is_empty() {
             return;
         }
 
         let filled_buffer_len = self.max_buffer_size / size_of::<T>() as u64;
         let single_buffer_size_max = filled_buffer_len * size_of::<T>() as u64;
-        if let [gpu_buffer] = self.gpu_buffer.as_slice() {
-            let required_size = self.data.len() as u64 * size_of::<T>() as u64;
-            if required_size > gpu_buffer.size() {
-                if required_size <= self.max_buffer_size {
-                    self.gpu_buffer = vec![self.device.create_buffer(&BufferDescriptor {
-                        label: None,
-                        size: required_size.next_power_of_two(),
-                        usage: gpu_buffer.usage(),
-                        mapped_at_creation: false,
-                    })];
-                } else {
-                    let required_buffer_count = required_size.div_ceil(single_buffer_size_max);
-                    let buffer_usages = gpu_buffer.usage();
-                    if gpu_buffer.size() < single_buffer_size_max {
-                        self.gpu_buffer.clear();
-                    }
-                    for _ in 1..required_buffer_count {
-                        self.gpu_buffer
-                            .push(self.device.create_buffer(&BufferDescriptor {
-                                label: None,
-                                size: single_buffer_size_max,
-                                usage: buffer_usages,
-                                mapped_at_creation: false,
-                            }));
-                    }
-                }
-                self.dirty_range = 0..self.data.len();
-            }
-        } else {
-            let new_buffer_len = self.data.len().div_ceil(filled_buffer_len as usize);
-            let usage = self.gpu_buffer[0].usage();
-            for _ in self.gpu_buffer.len()..new_buffer_len {
-                self.gpu_buffer
-                    .push(self.device.create_buffer(&BufferDescriptor {
-                        label: None,
-                        size: single_buffer_size_max,
-                        usage,
-                        mapped_at_creation: false,
-                    }));
+        let required_size = self.data.len() as u64 * size_of::<T>() as u64;
+        // Grown buffers get the old contents by a copy on the GPU, so only
+        // the changed ranges are uploaded.
+        if let [gpu_buffer] = self.gpu_buffer.as_slice()
+            && required_size > gpu_buffer.size()
+        {
+            let size = if required_size <= single_buffer_size_max {
+                required_size
+                    .next_power_of_two()
+                    .min(single_buffer_size_max)
+            } else {
+                single_buffer_size_max
+            };
+            if size > gpu_buffer.size() {
+                let buffer = self.create_buffer(size);
+                encoder.copy_buffer_to_buffer(gpu_buffer, 0, &buffer, 0, gpu_buffer.size());
+                self.gpu_buffer = vec![buffer];
             }
         }
+        let required_buffer_count = required_size.div_ceil(single_buffer_size_max) as usize;
+        for _ in self.gpu_buffer.len()..required_buffer_count {
+            let buffer = self.create_buffer(single_buffer_size_max);
+            self.gpu_buffer.push(buffer);
+        }
 
-        if let [gpu_buffer] = self.gpu_buffer.as_slice() {
-            let dirty_data = &self.data[self.dirty_range.clone()];
-            let offset = (self.dirty_range.start * size_of::<T>()) as BufferAddress;
-            let bytes: &[u8] = bytemuck::cast_slice(dirty_data);
-            self.queue.write_buffer(gpu_buffer, offset, bytes);
+        let chunk_len = if let [_] = self.gpu_buffer.as_slice() {
+            usize::MAX
         } else {
-            let start_block = self.dirty_range.start / filled_buffer_len as usize;
-            let start_item = self.dirty_range.start % filled_buffer_len as usize;
-            let end_block = self.dirty_range.end / filled_buffer_len as usize;
-            let end_item = self.dirty_range.end % filled_buffer_len as usize;
-            match &self.gpu_buffer[start_block..=end_block] {
-                [] => unreachable!(),
-                [buffer] => {
-                    let dirty_data = &self.data[self.dirty_range.clone()];
-                    let offset = (start_item * size_of::<T>()) as BufferAddress;
-                    let bytes: &[u8] = bytemuck::cast_slice(dirty_data);
-                    self.queue.write_buffer(buffer, offset, bytes);
-                }
-                [first, mid @ .., last] => {
-                    let data = &self.data[start_block * filled_buffer_len as usize
-                        ..((end_block + 1) * filled_buffer_len as usize).min(self.data.len())];
-                    let mut data_iter = data.chunks(filled_buffer_len as usize);
-                    let first_chunk = data_iter.next().unwrap();
-                    let last_chunk = data_iter.next_back().unwrap();
-                    self.queue.write_buffer(
-                        first,
-                        (start_item * size_of::<T>()) as BufferAddress,
-                        bytemuck::cast_slice(&first_chunk[start_item..]),
-                    );
-                    if end_item > 0 {
-                        self.queue.write_buffer(
-                            last,
-                            0,
-                            bytemuck::cast_slice(&last_chunk[..end_item]),
-                        );
-                    }
-                    for (buffer, data) in mid.iter().zip(data_iter) {
-                        self.queue
-                            .write_buffer(buffer, 0, bytemuck::cast_slice(data));
-                    }
-                }
-            }
+            filled_buffer_len as usize
+        };
+        for (buffer, range) in buffer_ranges(self.dirty.take(), chunk_len) {
+            let buffer_start = buffer * chunk_len;
+            let data = &self.data[buffer_start + range.start..buffer_start + range.end];
+            let bytes: &[u8] = bytemuck::cast_slice(data);
+            let Some(size) = BufferSize::new(bytes.len() as u64) else {
+                continue;
+            };
+            belt.write_buffer(
+                encoder,
+                &self.gpu_buffer[buffer],
+                (range.start * size_of::<T>()) as BufferAddress,
+                size,
+            )
+            .copy_from_slice(bytes);
         }
+    }
 
-        #[allow(clippy::reversed_empty_ranges)]
-        {
-            self.dirty_range = usize::MAX..0;
-        }
+    fn create_buffer(&self, size: u64) -> Buffer {
+        self.device.create_buffer(&BufferDescriptor {
+            label: None,
+            size,
+            usage: self.gpu_buffer[0].usage(),
+            mapped_at_creation: false,
+        })
     }
 
     pub fn read_buffers(&self, mut f: impl FnMut(&Buffer, usize)) {
@@ -256,6 +267,31 @@ impl<T> VertexArena<T> {
     }
 }
 
+/// Sorts and merges the ranges, then splits them at the boundaries of the
+/// `chunk_len` sized GPU buffers into (buffer, range in the buffer) pairs.
+fn buffer_ranges(mut ranges: Vec<Range<usize>>, chunk_len: usize) -> Vec<(usize, Range<usize>)> {
+    ranges.sort_unstable_by_key(|range| range.start);
+    let mut merged: Vec<Range<usize>> = Vec::with_capacity(ranges.len());
+    for range in ranges.into_iter().filter(|range| !range.is_empty()) {
+        match merged.last_mut() {
+            Some(last) if last.end >= range.start => last.end = last.end.max(range.end),
+            _ => merged.push(range),
+        }
+    }
+    let mut result = Vec::with_capacity(merged.len());
+    for range in merged {
+        let mut start = range.start;
+        while start < range.end {
+            let buffer = start / chunk_len;
+            let buffer_start = buffer * chunk_len;
+            let end = range.end.min(buffer_start.saturating_add(chunk_len));
+            result.push((buffer, start - buffer_start..end - buffer_start));
+            start = end;
+        }
+    }
+    result
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -306,4 +342,34 @@ mod tests {
         // remains 5..10, 40..50
         assert_eq!(fl.by_start.len(), 2);
     }
+
+    #[test]
+    fn buffer_ranges_merge_neighbours_and_split_at_buffers() {
+        assert_eq!(
+            buffer_ranges(vec![10..20, 0..5, 5..8, 30..30], usize::MAX),
+            [(0, 0..8), (0, 10..20)]
+        );
+        assert_eq!(
+            buffer_ranges(vec![8..12, 12..30], 10),
+            [(0, 8..10), (1, 0..10), (2, 0..10)]
+        );
+    }
+
+    #[test]
+    fn range_set_merges_overlapping_and_touching_ranges() {
+        let mut set = RangeSet::new();
+        set.insert(10..20);
+        set.insert(30..40);
+        set.insert(0..2);
+        set.insert(5..5);
+        assert_eq!(set.take(), [0..2, 10..20, 30..40]);
+        assert!(set.is_empty());
+
+        set.insert(10..20);
+        set.insert(30..40);
+        set.insert(20..25);
+        set.insert(15..32);
+        set.insert(0..2);
+        assert_eq!(set.take(), [0..2, 10..40]);
+    }
 }
@@ -0,0 +1,123 @@
+use crate::trace_state::VISIBLE_DURATION;
+
+const MAX_ZOOM: f32 = 1024.0;
+/// Share of the visible time span one scroll step moves the view.
+const SCROLL_STEP: f64 = 0.25;
+
+/// Which part of the trace is on screen. The view either follows the
+/// newest data or is frozen at an end time the user paused or scrolled to,
+/// and the time axis is stretched by `zoom`, so the screen shows
+/// `VISIBLE_DURATION / zoom` of trace.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct View {
+    end_time: Option<u64>,
+    zoom: f32,
+}
+
+impl Default for View {
+    fn default() -> View {
+        View {
+            end_time: None,
+            zoom: 1.0,
+        }
+    }
+}
+
+impl View {
+    pub fn new() -> View {
+        View::default()
+    }
+
+    /// The time at the right edge of the screen, given the current time.
+    pub fn end_time(&self, now: u64) -> u64 {
+        self.end_time.unwrap_or(now)
+    }
+
+    pub fn is_live(&self) -> bool {
+        self.end_time.is_none()
+    }
+
+    pub fn zoom(&self) -> f32 {
+        self.zoom
+    }
+
+    /// Time on screen.
+    pub fn duration(&self) -> u64 {
+        (VISIBLE_DURATION as f64 / self.zoom as f64) as u64
+    }
+
+    pub fn toggle_pause(&mut self, now: u64) {
+        self.end_time = match self.end_time {
+            None => Some(now),
+            Some(_) => None,
+        };
+    }
+
+    /// Moves the view by `steps` quarters of the screen, negative steps
+    /// towards older data, but not so far that `oldest` leaves the screen.
+    /// Reaching the current time follows the newest data again.
+    pub fn scroll(&mut self, steps: i32, now: u64, oldest: u64) {
+        let step = (self.duration() as f64 * SCROLL_STEP) as i64 * steps as i64;
+        let end_time = self.end_time(now).saturating_add_signed(step);
+        let earliest = oldest.saturating_add(self.duration()).min(now);
+        self.end_time = (end_time < now).then(|| end_time.max(earliest));
+    }
+
+    /// Freezes the view with `time` in the middle of the screen.
+    pub fn center_on(&mut self, time: u64, now: u64) {
+        self.end_time = Some(time.saturating_add(self.duration() / 2).min(now));
+    }
+
+    pub fn zoom_by(&mut self, factor: f32) {
+        self.zoom = (self.zoom * factor).clamp(1.0, MAX_ZOOM);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const SECOND: u64 = 1_000_000_000;
+
+    #[test]
+    fn scrolling_freezes_the_view_until_it_catches_up() {
+        let mut view = View::new();
+        let now = 100 * SECOND;
+
+        view.scroll(-2, now, 0);
+        assert_eq!(view.end_time(now), now - VISIBLE_DURATION / 2);
+        assert_eq!(view.end_time(now + SECOND), now - VISIBLE_DURATION / 2);
+
+        view.scroll(-1000, now, 90 * SECOND);
+        assert_eq!(view.end_time(now), 90 * SECOND + VISIBLE_DURATION);
+
+        view.zoom_by(4.0);
+        view.scroll(-1, now, 0);
+        assert_eq!(
+            view.end_time(now),
+            90 * SECOND + VISIBLE_DURATION - VISIBLE_DURATION / 16
+        );
+        view.scroll(1000, now, 0);
+        assert!(view.is_live());
+    }
+
+    #[test]
+    fn pausing_and_centering_freeze_the_view() {
+        let mut view = View::new();
+        view.toggle_pause(50 * SECOND);
+        assert_eq!(view.end_time(60 * SECOND), 50 * SECOND);
+        view.toggle_pause(60 * SECOND);
+        assert!(view.is_live());
+
+        view.center_on(10 * SECOND, 60 * SECOND);
+        assert_eq!(
+            view.end_time(60 * SECOND),
+            10 * SECOND + VISIBLE_DURATION / 2
+        );
+        view.center_on(59 * SECOND, 60 * SECOND);
+        assert_eq!(view.end_time(70 * SECOND), 60 * SECOND);
+
+        view.zoom_by(0.5);
+        assert_eq!(view.zoom(), 1.0);
+    }
+}
@@ -20,6 +20,11 @@ pub enum RRTraceEventType {
     ThreadSuspended,
     ThreadResume,
     ThreadExit,
+    SpanBegin,
+    SpanEnd,
+    Mark,
+    Counter,
+    Context,
 }
 
 impl RRTraceEvent {
@@ -38,6 +43,11 @@ impl RRTraceEvent {
             0x6000000000000000 => RRTraceEventType::ThreadSuspended,
             0x7000000000000000 => RRTraceEventType::ThreadResume,
             0x8000000000000000 => RRTraceEventType::ThreadExit,
+            0x9000000000000000 => RRTraceEventType::SpanBegin,
+            0xA000000000000000 => RRTraceEventType::SpanEnd,
+            0xB000000000000000 => RRTraceEventType::Mark,
+            0xC000000000000000 => RRTraceEventType::Counter,
+            0xD000000000000000 => RRTraceEventType::Context,
             _ => unreachable!(),
         }
     }
@@ -45,10 +55,22 @@ impl RRTraceEvent {
     pub fn data(&self) -> u64 {
         self.data
     }
-}
 
-pub const SIZE: usize = 65_536;
-pub const MASK: usize = SIZE - 1;
+    /// The two words as they are laid out in the ring.
+    pub fn to_raw(self) -> [u64; 2] {
+        [self.timestamp_and_event_type, self.data]
+    }
+
+    /// Builds an event for tests; the variants are in the order of their
+    /// type bits.
+    #[cfg(test)]
+    pub fn new(event_type: RRTraceEventType, timestamp: u64, data: u64) -> RRTraceEvent {
+        RRTraceEvent {
+            timestamp_and_event_type: timestamp | (event_type as u64) << 60,
+            data,
+        }
+    }
+}
 
 #[repr(C, align(128))]
 struct RRTraceEventRingBufferWriter {
@@ -62,16 +84,30 @@ struct RRTraceEventRingBufferReader {
     write_index_cache: u64,
 }
 
+/// The events follow the indices; their number is `capacity`, a power of
+/// two chosen by the tracer.
 #[repr(C)]
 pub struct RRTraceEventRingBuffer {
-    buffer: [RRTraceEvent; SIZE],
+    capacity: u64,
     writer: RRTraceEventRingBufferWriter,
     reader: RRTraceEventRingBufferReader,
+    buffer: [RRTraceEvent; 0],
 }
 
 impl RRTraceEventRingBuffer {
+    unsafe fn buffer<'a>(this: *mut Self) -> &'a [RRTraceEvent] {
+        unsafe {
+            std::slice::from_raw_parts(
+                (&raw const (*this).buffer).cast::<RRTraceEvent>(),
+                (*this).capacity as usize,
+            )
+        }
+    }
+
     unsafe fn read(this: *mut Self, buffer: &mut [RRTraceEvent]) -> usize {
         unsafe {
+            let ring = Self::buffer(this);
+            let mask = ring.len() - 1;
             let read_index = (*this).reader.read_index.load(atomic::Ordering::Acquire);
             let write_index = (*this).reader.write_index_cache;
             let available = (write_index - read_index) as usize;
@@ -86,15 +122,12 @@ impl RRTraceEventRingBuffer {
             let read_len = available.min(buffer.len());
             let buffer = &mut buffer[..read_len];
 
-            let first_part_len = (&(*this).buffer)[read_index as usize & MASK..].len();
-            if read_len <= first_part_len {
-                buffer
-                    .copy_from_slice(&(&(*this).buffer)[read_index as usize & MASK..][..read_len]);
+            let first_part = &ring[read_index as usize & mask..];
+            if read_len <= first_part.len() {
+                buffer.copy_from_slice(&first_part[..read_len]);
             } else {
-                buffer[..first_part_len]
-                    .copy_from_slice(&(&(*this).buffer)[read_index as usize & MASK..]);
-                buffer[first_part_len..]
-                    .copy_from_slice(&(&(*this).buffer)[0..read_len - first_part_len]);
+                buffer[..first_part.len()].copy_from_slice(first_part);
+                buffer[first_part.len()..].copy_from_slice(&ring[..read_len - first_part.len()]);
             }
 
             (*this)
@@ -0,0 +1,49 @@
+/// Method search pattern. Matches display names such as `Foo::Bar#baz` or
+/// `Foo.create` anywhere in the name; `*` matches any run of characters, so
+/// `Foo*#save` finds `save` on every class under `Foo`.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct Pattern {
+    parts: Vec<String>,
+}
+
+impl Pattern {
+    pub fn new(pattern: &str) -> Pattern {
+        Pattern {
+            parts: pattern
+                .split('*')
+                .filter(|part| !part.is_empty())
+                .map(str::to_owned)
+                .collect(),
+        }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.parts.is_empty()
+    }
+
+    pub fn matches(&self, name: &str) -> bool {
+        let mut rest = name;
+        for part in &self.parts {
+            match rest.find(part.as_str()) {
+                Some(index) => rest = &rest[index + part.len()..],
+                None => return false,
+            }
+        }
+        true
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn matches_substrings_and_wildcards() {
+        assert!(Pattern::new("User").matches("App::User#save"));
+        assert!(Pattern::new("#save").matches("App::User#save"));
+        assert!(!Pattern::new("#save").matches("App::User.save"));
+        assert!(Pattern::new("App*#save").matches("App::Admin#save!"));
+        assert!(!Pattern::new("save*App").matches("App::User#save"));
+        assert!(Pattern::new("**").is_empty());
+    }
+}
@@ -7,6 +7,10 @@ struct CallBox {
     @location(2) end_time: vec2<u32>,
     @location(3) method_id: u32,
     @location(4) depth: u32,
+    @location(5) context: u32,
+    @location(6) count: u32,
+    @location(7) busy_time: u32,
+    @location(8) lane: u32,
 }
 
 struct GCBox {
@@ -24,28 +28,55 @@ struct LineSegment {
     @location(4) end_pos: vec3<f32>,
     @location(5) color: vec4<f32>,
     @location(6) kind: u32,
+    @location(7) lane: u32,
 }
 
 struct CameraUniform {
     view_proj: mat4x4<f32>,
     base_time: vec2<u32>, // x: lo, y: hi
     max_depth: u32,
-    num_threads: u32,
+    lane_depth: f32,
+    context_filter: u32, // 0: no filter
 }
 
-struct ThreadInfo {
-    lane_id: u32,
+struct PaletteEntry {
+    color: u32, // rgba8, r in the lowest byte
+    category: u32,
+}
+
+struct LaneInfo {
+    offset: f32,
+    depth: f32,
 }
 
 @group(0) @binding(0)
 var<uniform> camera: CameraUniform;
 
+// Indexed by the lane slot of a thread.
 @group(0) @binding(1)
-var<uniform> thread_info: ThreadInfo;
+var<storage, read> lanes: array<LaneInfo>;
+
+struct Highlight {
+    active: u32,
+    bits: array<u32>, // one bit per method key
+}
+
+@group(1) @binding(0)
+var<storage, read> palette: array<PaletteEntry>;
+
+@group(1) @binding(1)
+var<storage, read> highlight: Highlight;
+
+const HIGHLIGHT_NONE: u32 = 0u;
+const HIGHLIGHT_MATCHED: u32 = 1u;
+const HIGHLIGHT_DIMMED: u32 = 2u;
 
 struct VertexOutput {
     @builtin(position) clip_position: vec4<f32>,
     @location(0) color: vec4<f32>,
+    @location(1) @interpolate(flat) highlight: u32,
+    // Share of each stripe drawn lit, 0 for a solid box.
+    @location(2) @interpolate(flat) stripe: f32,
 }
 
 fn sub64(a: vec2<u32>, b: vec2<u32>) -> vec2<u32> {
@@ -65,43 +96,142 @@ fn u64tof32(v: vec2<u32>) -> f32 {
 }
 
 fn get_color(method_id: u32) -> vec4<f32> {
-    let m = method_id;
+    if (method_id < arrayLength(&palette)) {
+        let color = palette[method_id].color;
+        if (color != 0u) {
+            return unpack4x8unorm(color);
+        }
+    }
+    // The method's symbol has not arrived yet.
+    return hash_color(method_id);
+}
+
+fn hash_color(id: u32) -> vec4<f32> {
+    let m = id;
     let r = f32((m * 123u) % 255u) / 255.0;
     let g = f32((m * 456u) % 255u) / 255.0;
     let b = f32((m * 789u) % 255u) / 255.0;
     return vec4<f32>(r, g, b, 1.0);
 }
 
+fn highlight_state(method_id: u32) -> u32 {
+    if (highlight.active == 0u) {
+        return HIGHLIGHT_NONE;
+    }
+    let word = method_id / 32u;
+    if (word < arrayLength(&highlight.bits)
+        && (highlight.bits[word] & (1u << (method_id % 32u))) != 0u) {
+        return HIGHLIGHT_MATCHED;
+    }
+    return HIGHLIGHT_DIMMED;
+}
+
+// Whether `t` is after the end of the view, which happens while the view
+// is paused or scrolled back.
+fn after_view(t: vec2<u32>) -> bool {
+    return t.y > camera.base_time.y || (t.y == camera.base_time.y && t.x > camera.base_time.x);
+}
+
+// X of time `t`, clamped to the end of the view.
+fn time_x(t: vec2<u32>) -> f32 {
+    if (after_view(t)) {
+        return 0.0;
+    }
+    return u64tof32(sub64(camera.base_time, t)) / 500000000.0;
+}
+
+fn box_x(v: Vertex, call: CallBox) -> f32 {
+    var end_x = 0.0;
+    if (call.end_time.y != 0xffffffffu) {
+        end_x = time_x(call.end_time);
+    }
+    return select(time_x(call.start_time), end_x, v.position.x > 0.5);
+}
+
+// Coalesced runs of calls are striped, with the lit share of each stripe
+// matching the share of the box the calls were running.
+fn run_stripe(call: CallBox) -> f32 {
+    if (call.count <= 1u) {
+        return 0.0;
+    }
+    let span = max(u64tof32(sub64(call.end_time, call.start_time)), 1.0);
+    return clamp(f32(call.busy_time) / span, 0.3, 0.9);
+}
+
+// World z of a point at `z` within the lane of `slot`, 0 at its front.
+fn lane_z(slot: u32, z: f32) -> f32 {
+    let lane = lanes[slot];
+    return (lane.offset + z * lane.depth) / camera.lane_depth;
+}
+
+// Boxes outside the selected context collapse to a point and are culled.
+fn filtered_out(call: CallBox) -> bool {
+    return camera.context_filter != 0u && call.context != camera.context_filter;
+}
+
 @vertex
 fn vs_main(
     v: Vertex,
     call: CallBox,
 ) -> VertexOutput {
-    var end_time: vec2<u32>;
-    if (call.end_time.y == 0xffffffffu) {
-        end_time = vec2<u32>(0, 0);
-    } else {
-        end_time = sub64(camera.base_time, call.end_time);
-    }
-    let start_time = sub64(camera.base_time, call.start_time);
-
-    let x = select(start_time, end_time, v.position.x > 0.5);
-
     let world_pos = vec3<f32>(
-        u64tof32(x) / 500000000.0,
+        box_x(v, call),
         (f32(call.depth) + v.position.y) / f32(camera.max_depth),
-        (f32(thread_info.lane_id) + v.position.z) / f32(camera.num_threads),
+        lane_z(call.lane, v.position.z),
     );
 
     var out: VertexOutput;
     out.color = get_color(call.method_id);
-    out.clip_position = camera.view_proj * vec4<f32>(world_pos, 1.0);
+    out.highlight = highlight_state(call.method_id);
+    out.stripe = run_stripe(call);
+    out.clip_position = select(
+        camera.view_proj * vec4<f32>(world_pos, 1.0),
+        vec4<f32>(0.0, 0.0, 0.0, 1.0),
+        filtered_out(call),
+    );
+    return out;
+}
+
+// Annotation spans hang below the call boxes of their thread, one level per
+// nesting depth. `method_id` holds the interned span name.
+const ANNOTATION_LEVEL_HEIGHT: f32 = 0.04;
+
+@vertex
+fn vs_annotation(
+    v: Vertex,
+    span: CallBox,
+) -> VertexOutput {
+    let world_pos = vec3<f32>(
+        box_x(v, span),
+        -(f32(span.depth) + 1.0 - v.position.y) * ANNOTATION_LEVEL_HEIGHT,
+        lane_z(span.lane, v.position.z),
+    );
+
+    var out: VertexOutput;
+    out.color = hash_color(span.method_id);
+    out.clip_position = select(
+        camera.view_proj * vec4<f32>(world_pos, 1.0),
+        vec4<f32>(0.0, 0.0, 0.0, 1.0),
+        filtered_out(span),
+    );
     return out;
 }
 
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4<f32> {
-    return in.color;
+    var color = in.color;
+    if (in.stripe > 0.0
+        && fract((in.clip_position.x + in.clip_position.y) / 8.0) >= in.stripe) {
+        color = vec4<f32>(color.rgb * 0.5, color.a);
+    }
+    if (in.highlight == HIGHLIGHT_DIMMED) {
+        let background = vec3<f32>(0.01, 0.02, 0.05);
+        return vec4<f32>(mix(background, color.rgb, 0.15), color.a);
+    }
+    if (in.highlight == HIGHLIGHT_MATCHED) {
+        return vec4<f32>(min(color.rgb * 1.25 + 0.05, vec3<f32>(1.0)), color.a);
+    }
+    return color;
 }
 
 @vertex
@@ -110,29 +240,30 @@ fn vs_line(
     segment: LineSegment,
 ) -> VertexOutput {
     let t = v.position;
-    let start_x = select(
-        segment.start_pos.x,
-        u64tof32(sub64(camera.base_time, segment.start_time)) / 500000000.0,
-        segment.kind == 0u,
-    );
-    let end_x = select(
-        segment.end_pos.x,
-        u64tof32(sub64(camera.base_time, segment.end_time)) / 500000000.0,
-        segment.kind == 0u,
-    );
+    let start_x = select(segment.start_pos.x, time_x(segment.start_time), segment.kind != 1u);
+    let end_x = select(segment.end_pos.x, time_x(segment.end_time), segment.kind != 1u);
+    // Thread lines sit inside their lane; counter graphs (kind 2) are placed
+    // behind the lanes at fixed depths.
+    let z = mix(segment.start_pos.z, segment.end_pos.z, t);
+    var world_z = z / camera.lane_depth;
+    if (segment.kind == 0u) {
+        world_z = lane_z(segment.lane, z);
+    } else if (segment.kind == 2u) {
+        world_z = z;
+    }
     let world_pos = vec3<f32>(
         mix(start_x, end_x, t),
         mix(segment.start_pos.y, segment.end_pos.y, t),
-        mix(
-            segment.start_pos.z / f32(max(camera.num_threads, 1u)),
-            segment.end_pos.z / f32(max(camera.num_threads, 1u)),
-            t,
-        ),
+        world_z,
     );
 
     var out: VertexOutput;
     out.color = segment.color;
-    out.clip_position = camera.view_proj * vec4<f32>(world_pos, 1.0);
+    out.clip_position = select(
+        camera.view_proj * vec4<f32>(world_pos, 1.0),
+        vec4<f32>(0.0, 0.0, 0.0, 1.0),
+        segment.kind != 1u && after_view(segment.start_time),
+    );
     return out;
 }
 
@@ -145,16 +276,18 @@ fn vs_gc(
     v: GCVertex,
     gc: GCBox,
 ) -> VertexOutput {
-    let time = sub64(camera.base_time, gc.time);
-
     let world_pos = vec3<f32>(
-        u64tof32(time) / 500000000.0,
+        time_x(gc.time),
         v.position.x,
         v.position.y,
     );
 
     var out: VertexOutput;
     out.color = vec4<f32>(1.0, 0.5, 0.0, 0.1);
-    out.clip_position = camera.view_proj * vec4<f32>(world_pos, 1.0);
+    out.clip_position = select(
+        camera.view_proj * vec4<f32>(world_pos, 1.0),
+        vec4<f32>(0.0, 0.0, 0.0, 1.0),
+        after_view(gc.time),
+    );
     return out;
 }
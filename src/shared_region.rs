@@ -0,0 +1,101 @@
+use crate::metadata::RRTraceMetadataRingBuffer;
+use crate::ringbuffer::RRTraceEventRingBuffer;
+use crate::trace_state::VISIBLE_DURATION;
+use std::path::PathBuf;
+use std::sync::atomic::{self, AtomicU64};
+
+const OUTPUT_PATH_MAX: usize = 1024;
+const FLAG_COALESCE_RUNS: u32 = 1;
+
+#[repr(C)]
+pub struct RRTraceSharedHeader {
+    output_mode: u32,
+    flags: u32,
+    retention_ns: u64,
+    max_fps: u32,
+    history_mb: u32,
+    stopped: AtomicU64,
+    output_path: [u8; OUTPUT_PATH_MAX],
+}
+
+/// The event ring directly follows the region, since its size depends on
+/// the capacity the tracer chose.
+#[repr(C)]
+pub struct RRTraceSharedRegion {
+    pub header: RRTraceSharedHeader,
+    pub metadata: RRTraceMetadataRingBuffer,
+}
+
+impl RRTraceSharedRegion {
+    pub unsafe fn events(this: *mut Self) -> *mut RRTraceEventRingBuffer {
+        unsafe { this.add(1).cast() }
+    }
+
+    pub unsafe fn options(this: *const Self) -> SessionOptions {
+        let header = unsafe { &(*this).header };
+        let output_mode = match header.output_mode {
+            1 => OutputMode::Record,
+            2 => OutputMode::Headless,
+            3 => OutputMode::Export,
+            _ => OutputMode::Window,
+        };
+        let path_len = header
+            .output_path
+            .iter()
+            .position(|&b| b == 0)
+            .unwrap_or(OUTPUT_PATH_MAX);
+        SessionOptions {
+            output_mode,
+            retention: header.retention_ns.max(VISIBLE_DURATION),
+            coalesce_runs: header.flags & FLAG_COALESCE_RUNS != 0,
+            max_fps: header.max_fps.max(1),
+            history_budget: header.history_mb as usize * 1024 * 1024,
+            output_path: PathBuf::from(
+                String::from_utf8_lossy(&header.output_path[..path_len]).into_owned(),
+            ),
+        }
+    }
+
+    /// Set by the tracer after its last event, for the output modes that
+    /// write a file.
+    pub unsafe fn stopped(this: *const Self) -> bool {
+        unsafe { (*this).header.stopped.load(atomic::Ordering::Acquire) != 0 }
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum OutputMode {
+    Window,
+    Record,
+    Headless,
+    Export,
+}
+
+/// The options of `Rrtrace.start` that concern the visualizer.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct SessionOptions {
+    pub output_mode: OutputMode,
+    /// How long data is kept before it is evicted, at least the visible
+    /// window.
+    pub retention: u64,
+    /// Whether runs of identical leaf calls are merged into one box.
+    pub coalesce_runs: bool,
+    /// Most frames per second the window draws.
+    pub max_fps: u32,
+    /// Memory for batches older than `retention`, kept for scrolling back
+    /// to them; 0 keeps none.
+    pub history_budget: usize,
+    pub output_path: PathBuf,
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn layout_matches_the_c_header() {
+        assert_eq!(size_of::<RRTraceSharedHeader>(), 1056);
+        assert_eq!(std::mem::offset_of!(RRTraceSharedRegion, metadata), 1152);
+        assert_eq!(size_of::<RRTraceSharedRegion>() % 128, 0);
+    }
+}
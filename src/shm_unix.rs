@@ -7,11 +7,17 @@ pub struct SharedMemory {
 }
 
 impl SharedMemory {
-    pub unsafe fn open(name: CString, size: usize) -> SharedMemory {
+    /// Maps the whole object, whose size the tracer chose.
+    pub unsafe fn open(name: CString) -> SharedMemory {
         let fd = unsafe { libc::shm_open(name.as_ptr(), libc::O_RDWR, 0) };
         if fd < 0 {
             panic!("shm_open failed");
         }
+        let mut stat = unsafe { std::mem::zeroed::<libc::stat>() };
+        if unsafe { libc::fstat(fd, &mut stat) } != 0 {
+            panic!("fstat failed");
+        }
+        let size = stat.st_size as usize;
         let memory = unsafe {
             libc::mmap(
                 std::ptr::null_mut(),
@@ -22,6 +28,7 @@ impl SharedMemory {
                 0,
             )
         };
+        unsafe { libc::close(fd) };
         if memory == libc::MAP_FAILED {
             panic!("mmap failed");
         }
@@ -37,6 +44,11 @@ impl SharedMemory {
     }
 }
 
+// The mapping stays valid until the value is dropped, and the rings in it
+// synchronize their readers and writers themselves.
+unsafe impl Send for SharedMemory {}
+unsafe impl Sync for SharedMemory {}
+
 impl Drop for SharedMemory {
     fn drop(&mut self) {
         unsafe {
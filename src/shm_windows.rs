@@ -11,7 +11,8 @@ pub struct SharedMemory {
 }
 
 impl SharedMemory {
-    pub unsafe fn open(name: CString, size: usize) -> SharedMemory {
+    /// Maps the whole object, whose size the tracer chose.
+    pub unsafe fn open(name: CString) -> SharedMemory {
         let handle =
             unsafe { OpenFileMappingA(FILE_MAP_ALL_ACCESS, 0, name.as_ptr() as *const u8) };
         if handle.is_null() {
@@ -20,7 +21,7 @@ impl SharedMemory {
             });
         }
 
-        let ptr = unsafe { MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, size) };
+        let ptr = unsafe { MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0) };
         if ptr.Value.is_null() {
             unsafe { CloseHandle(handle) };
             panic!("MapViewOfFile failed");
@@ -34,6 +35,11 @@ impl SharedMemory {
     }
 }
 
+// The mapping stays valid until the value is dropped, and the rings in it
+// synchronize their readers and writers themselves.
+unsafe impl Send for SharedMemory {}
+unsafe impl Sync for SharedMemory {}
+
 impl Drop for SharedMemory {
     fn drop(&mut self) {
         unsafe {
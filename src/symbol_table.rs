@@ -0,0 +1,214 @@
+use crate::metadata::MethodInfo;
+use std::collections::HashMap;
+
+#[derive(Debug, Clone)]
+pub struct MethodSymbol {
+    name: String,
+    category: u32,
+    color: u32,
+}
+
+impl MethodSymbol {
+    pub fn name(&self) -> &str {
+        &self.name
+    }
+
+    pub fn category(&self) -> u32 {
+        self.category
+    }
+
+    /// RGBA8 packed with the red channel in the lowest byte, as read by
+    /// `unpack4x8unorm` in the shader.
+    pub fn color(&self) -> u32 {
+        self.color
+    }
+}
+
+#[derive(Debug, Default)]
+pub struct SymbolTable {
+    methods: Vec<Option<MethodSymbol>>,
+    names: Vec<Option<String>>,
+    categories: Vec<String>,
+    category_ids: HashMap<String, u32>,
+}
+
+impl SymbolTable {
+    pub fn new() -> SymbolTable {
+        SymbolTable::default()
+    }
+
+    pub fn insert_method(&mut self, info: MethodInfo) -> &MethodSymbol {
+        let category_name = category_name(&info.class_path, &info.source_path);
+        let category = match self.category_ids.get(&category_name) {
+            Some(&id) => id,
+            None => {
+                let id = self.categories.len() as u32;
+                self.categories.push(category_name.clone());
+                self.category_ids.insert(category_name, id);
+                id
+            }
+        };
+        let name = display_name(&info.class_path, &info.method_name);
+        let color = method_color(category, &name);
+        let index = info.key as usize;
+        if self.methods.len() <= index {
+            self.methods.resize(index + 1, None);
+        }
+        self.methods[index].insert(MethodSymbol {
+            name,
+            category,
+            color,
+        })
+    }
+
+    pub fn method(&self, key: u32) -> Option<&MethodSymbol> {
+        self.methods.get(key as usize)?.as_ref()
+    }
+
+    pub fn insert_name(&mut self, key: u32, name: String) {
+        let index = key as usize;
+        if self.names.len() <= index {
+            self.names.resize(index + 1, None);
+        }
+        self.names[index] = Some(name);
+    }
+
+    /// Annotation name for a span or mark.
+    pub fn name(&self, key: u32) -> Option<&str> {
+        self.names.get(key as usize)?.as_deref()
+    }
+
+    pub fn methods(&self) -> impl Iterator<Item = (u32, &MethodSymbol)> {
+        self.methods
+            .iter()
+            .enumerate()
+            .filter_map(|(key, symbol)| Some((key as u32, symbol.as_ref()?)))
+    }
+
+    pub fn category_name(&self, category: u32) -> Option<&str> {
+        self.categories.get(category as usize).map(String::as_str)
+    }
+}
+
+fn singleton_target(class_path: &str) -> Option<&str> {
+    let inner = class_path.strip_prefix("#<Class:")?.strip_suffix('>')?;
+    (!inner.starts_with("#<")).then_some(inner)
+}
+
+fn display_name(class_path: &str, method_name: &str) -> String {
+    if class_path.is_empty() {
+        method_name.to_owned()
+    } else if let Some(target) = singleton_target(class_path) {
+        format!("{target}.{method_name}")
+    } else {
+        format!("{class_path}#{method_name}")
+    }
+}
+
+fn gem_name(source_path: &str) -> Option<&str> {
+    let (_, rest) = source_path.rsplit_once("/gems/")?;
+    let dir = rest.split('/').next()?;
+    match dir.rsplit_once('-') {
+        Some((name, version)) if version.starts_with(|c: char| c.is_ascii_digit()) => Some(name),
+        _ => Some(dir),
+    }
+}
+
+/// Methods are grouped by the gem that defines them when the source path
+/// lives in a gem directory, otherwise by the root of their namespace.
+fn category_name(class_path: &str, source_path: &str) -> String {
+    if let Some(gem) = gem_name(source_path) {
+        return format!("gem:{gem}");
+    }
+    let class_path = singleton_target(class_path).unwrap_or(class_path);
+    if class_path.is_empty() {
+        "(main)".to_owned()
+    } else if class_path.starts_with("#<") {
+        "(anonymous)".to_owned()
+    } else {
+        class_path.split("::").next().unwrap().to_owned()
+    }
+}
+
+fn fnv1a(s: &str) -> u32 {
+    s.bytes().fold(0x811c9dc5, |hash, b| {
+        (hash ^ b as u32).wrapping_mul(0x01000193)
+    })
+}
+
+/// Categories are spread around the hue circle by the golden ratio; methods
+/// within a category vary only in lightness so groups stay recognizable.
+fn method_color(category: u32, name: &str) -> u32 {
+    let hue = (category as f32 * 0.618_034).fract();
+    let lightness = 0.4 + 0.3 * (fnv1a(name) % 1024) as f32 / 1024.0;
+    let [r, g, b] = hsl_to_rgb(hue, 0.65, lightness);
+    let to_byte = |v: f32| (v.clamp(0.0, 1.0) * 255.0).round() as u32;
+    to_byte(r) | (to_byte(g) << 8) | (to_byte(b) << 16) | (0xff << 24)
+}
+
+pub fn hsl_to_rgb(h: f32, s: f32, l: f32) -> [f32; 3] {
+    let c = (1.0 - (2.0 * l - 1.0).abs()) * s;
+    let h6 = h * 6.0;
+    let x = c * (1.0 - (h6 % 2.0 - 1.0).abs());
+    let (r, g, b) = match h6 as u32 {
+        0 => (c, x, 0.0),
+        1 => (x, c, 0.0),
+        2 => (0.0, c, x),
+        3 => (0.0, x, c),
+        4 => (x, 0.0, c),
+        _ => (c, 0.0, x),
+    };
+    let m = l - c / 2.0;
+    [r + m, g + m, b + m]
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn method(key: u32, class_path: &str, method_name: &str, source_path: &str) -> MethodInfo {
+        MethodInfo {
+            key,
+            class_path: class_path.to_owned(),
+            method_name: method_name.to_owned(),
+            source_path: source_path.to_owned(),
+        }
+    }
+
+    #[test]
+    fn methods_are_grouped_by_gem_then_namespace() {
+        let mut table = SymbolTable::new();
+        let find = table
+            .insert_method(method(
+                3,
+                "ActiveRecord::Base",
+                "find",
+                "/usr/lib/ruby/gems/3.3.0/gems/activerecord-7.1.0/lib/active_record/base.rb",
+            ))
+            .category();
+        let user = table
+            .insert_method(method(0, "App::User", "save", "/app/models/user.rb"))
+            .category();
+        let admin = table
+            .insert_method(method(
+                1,
+                "#<Class:App::Admin>",
+                "create",
+                "/app/models/a.rb",
+            ))
+            .category();
+
+        assert_eq!(table.category_name(find), Some("gem:activerecord"));
+        assert_eq!(table.category_name(user), Some("App"));
+        assert_eq!(user, admin);
+        assert_eq!(table.method(1).unwrap().name(), "App::Admin.create");
+        assert!(table.method(2).is_none());
+    }
+
+    #[test]
+    fn colors_are_opaque() {
+        for category in 0..16 {
+            assert_eq!(method_color(category, "Foo#bar") >> 24, 0xff);
+        }
+    }
+}
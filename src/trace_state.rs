@@ -1,3 +1,4 @@
+use crate::lod;
 use crate::ringbuffer::{RRTraceEvent, RRTraceEventType};
 use smallvec::SmallVec;
 use std::collections::HashMap;
@@ -6,12 +7,78 @@ use std::fmt::Debug;
 use std::{iter, mem};
 
 #[repr(C)]
-#[derive(Copy, Default, Clone, Debug, bytemuck::Pod, bytemuck::Zeroable)]
+#[derive(Copy, Default, Clone, Debug, PartialEq, bytemuck::Pod, bytemuck::Zeroable)]
 pub struct CallBox {
     start_time: [u32; 2],
     end_time: [u32; 2],
     method_id: u32,
     depth: u32,
+    /// `Rrtrace.with_context` id of the thread while the box was open.
+    context: u32,
+    /// Number of identical sibling calls coalesced into the box, 1 for a
+    /// single call.
+    count: u32,
+    /// Total time of the coalesced calls in nanoseconds, without the gaps
+    /// between them. Only set when `count` is above 1.
+    busy_time: u32,
+    /// Lane slot of the thread, set by the renderer when the box is uploaded.
+    lane: u32,
+}
+
+impl CallBox {
+    pub fn new(start_time: u64, end_time: u64, method_id: u32, depth: u32, context: u32) -> Self {
+        CallBox {
+            start_time: encode_time(start_time),
+            end_time: encode_time(end_time),
+            method_id,
+            depth,
+            context,
+            count: 1,
+            busy_time: 0,
+            lane: 0,
+        }
+    }
+
+    pub fn set_lane(&mut self, lane: u32) {
+        self.lane = lane;
+    }
+
+    pub fn start_time_ns(&self) -> u64 {
+        decode_time(self.start_time)
+    }
+
+    pub fn end_time_ns(&self) -> u64 {
+        decode_time(self.end_time)
+    }
+
+    pub fn method_id(&self) -> u32 {
+        self.method_id
+    }
+
+    pub fn depth(&self) -> u32 {
+        self.depth
+    }
+
+    pub fn context(&self) -> u32 {
+        self.context
+    }
+
+    pub fn count(&self) -> u32 {
+        self.count
+    }
+
+    pub fn busy_time(&self) -> u32 {
+        self.busy_time
+    }
+
+    /// The box with `count` coalesced calls taking `busy_time` in total.
+    pub fn with_run(self, count: u32, busy_time: u32) -> Self {
+        CallBox {
+            count,
+            busy_time,
+            ..self
+        }
+    }
 }
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
@@ -30,10 +97,109 @@ impl ThreadLine {
     }
 }
 
+/// A call that returned within the batch, with the time it was entered even
+/// when that happened in an earlier batch or it was split by GC or thread
+/// switches.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct CompletedCall {
+    method_id: u32,
+    start_time: u64,
+    end_time: u64,
+}
+
+impl CompletedCall {
+    pub fn method_id(&self) -> u32 {
+        self.method_id
+    }
+
+    pub fn start_time(&self) -> u64 {
+        self.start_time
+    }
+
+    pub fn end_time(&self) -> u64 {
+        self.end_time
+    }
+}
+
+/// A `Rrtrace.mark` on a thread.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Mark {
+    name_key: u32,
+    time: u64,
+}
+
+impl Mark {
+    pub fn name_key(&self) -> u32 {
+        self.name_key
+    }
+
+    pub fn time(&self) -> u64 {
+        self.time
+    }
+}
+
+/// A stretch of time a thread ran inside a `Rrtrace.with_context` block,
+/// ended by a thread switch, a context change or the end of the batch.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct ContextPeriod {
+    context: u32,
+    start_time: u64,
+    end_time: u64,
+    calls: u32,
+}
+
+impl ContextPeriod {
+    pub fn context(&self) -> u32 {
+        self.context
+    }
+
+    pub fn start_time(&self) -> u64 {
+        self.start_time
+    }
+
+    pub fn end_time(&self) -> u64 {
+        self.end_time
+    }
+
+    pub fn calls(&self) -> u32 {
+        self.calls
+    }
+}
+
+/// A `Rrtrace.counter` sample. Counters belong to the process, not a thread.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct CounterSample {
+    name_key: u32,
+    time: u64,
+    value: f32,
+}
+
+impl CounterSample {
+    pub fn name_key(&self) -> u32 {
+        self.name_key
+    }
+
+    pub fn time(&self) -> u64 {
+        self.time
+    }
+
+    pub fn value(&self) -> f32 {
+        self.value
+    }
+}
+
 #[derive(Debug, Clone)]
 pub struct ThreadData {
     thread_id: u32,
     call_boxes: Vec<CallBox>,
+    /// `lod::build` of `call_boxes`, made on the trace threads.
+    lod_boxes: Vec<Option<Vec<CallBox>>>,
+    /// Spans with the interned name key in `method_id` and the nesting depth
+    /// among spans in `depth`.
+    annotation_boxes: Vec<CallBox>,
+    marks: Vec<Mark>,
+    completed_calls: Vec<CompletedCall>,
+    context_periods: Vec<ContextPeriod>,
     thread_line: ThreadLine,
 }
 
@@ -46,6 +212,31 @@ impl ThreadData {
         &self.call_boxes
     }
 
+    /// The boxes to draw at detail `level`, falling back to finer levels
+    /// where nothing was merged.
+    pub fn lod_boxes(&self, level: usize) -> Option<&[CallBox]> {
+        if level == 0 {
+            return Some(&self.call_boxes);
+        }
+        self.lod_boxes[level - 1].as_deref()
+    }
+
+    pub fn annotation_boxes(&self) -> &[CallBox] {
+        &self.annotation_boxes
+    }
+
+    pub fn marks(&self) -> &[Mark] {
+        &self.marks
+    }
+
+    pub fn completed_calls(&self) -> &[CompletedCall] {
+        &self.completed_calls
+    }
+
+    pub fn context_periods(&self) -> &[ContextPeriod] {
+        &self.context_periods
+    }
+
     pub fn thread_line(&self) -> ThreadLine {
         self.thread_line
     }
@@ -60,6 +251,10 @@ pub fn encode_time(time: u64) -> [u32; 2] {
     ]
 }
 
+pub fn decode_time(time: [u32; 2]) -> u64 {
+    time[0] as u64 | ((time[1] as u64) << 31)
+}
+
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
 enum ThreadId {
     None,
@@ -70,7 +265,10 @@ enum ThreadId {
 #[derive(Debug, Clone, Default)]
 struct StackState {
     unmarked_returns: SmallVec<[u64; 2]>,
-    stack: SmallVec<[u64; 16]>,
+    /// Method id and call time of every frame.
+    stack: SmallVec<[(u64, u64); 16]>,
+    /// Last context set in this part of the trace, if any.
+    context: Option<u32>,
     exited: bool,
 }
 
@@ -80,20 +278,29 @@ impl StackState {
     }
 
     #[inline(always)]
-    fn call(&mut self, method_id: u64) {
-        self.stack.push(method_id);
+    fn call(&mut self, method_id: u64, time: u64) {
+        self.stack.push((method_id, time));
     }
 
+    /// Pops frames of the same kind as `method_id` down to its frame.
+    /// Method returns leave spans open and span ends leave calls open, since
+    /// spans begin and end inside calls of their own.
     #[inline(always)]
     fn ret(&mut self, method_id: u64) {
-        loop {
-            match self.stack.pop() {
-                None => {
-                    self.unmarked_returns.push(method_id);
-                    break;
-                }
-                Some(m) if m == method_id => break,
-                Some(_) => {}
+        let annotation = method_id & ANNOTATION != 0;
+        match self.stack.iter().rposition(|&(m, _)| m == method_id) {
+            Some(index) => {
+                let other_kind = self
+                    .stack
+                    .drain(index..)
+                    .filter(|&(m, _)| (m & ANNOTATION != 0) != annotation)
+                    .collect::<SmallVec<[_; 4]>>();
+                self.stack.extend(other_kind);
+            }
+            None => {
+                self.stack
+                    .retain(|&mut (m, _)| (m & ANNOTATION != 0) != annotation);
+                self.unmarked_returns.push(method_id);
             }
         }
     }
@@ -108,14 +315,17 @@ impl StackState {
     }
 
     fn merge_into(&self, other: &mut Self) {
+        if other.context.is_none() {
+            other.context = self.context;
+        }
         let additional_push_stack = mem::replace(&mut other.stack, self.stack.clone());
         let unmarked_returns =
             mem::replace(&mut other.unmarked_returns, self.unmarked_returns.clone());
         for method_id in unmarked_returns {
             other.ret(method_id);
         }
-        for method_id in additional_push_stack {
-            other.call(method_id);
+        for (method_id, time) in additional_push_stack {
+            other.call(method_id, time);
         }
     }
 }
@@ -150,12 +360,21 @@ impl FastTrace {
             match event.event_type() {
                 RRTraceEventType::Call => {
                     let method_id = event.data();
-                    current_thread_stack.call(method_id);
+                    current_thread_stack.call(method_id, event.timestamp());
                 }
                 RRTraceEventType::Return => {
                     let method_id = event.data();
                     current_thread_stack.ret(method_id);
                 }
+                RRTraceEventType::SpanBegin => {
+                    current_thread_stack.call(event.data() | ANNOTATION, event.timestamp());
+                }
+                RRTraceEventType::SpanEnd => {
+                    current_thread_stack.ret(event.data() | ANNOTATION);
+                }
+                RRTraceEventType::Context => {
+                    current_thread_stack.context = Some(event.data() as u32);
+                }
                 RRTraceEventType::ThreadSuspended => {
                     current_thread = ThreadId::None;
                 }
@@ -178,7 +397,9 @@ impl FastTrace {
                 }
                 RRTraceEventType::GCStart
                 | RRTraceEventType::GCEnd
-                | RRTraceEventType::ThreadReady => {}
+                | RRTraceEventType::ThreadReady
+                | RRTraceEventType::Mark
+                | RRTraceEventType::Counter => {}
             }
         }
         let in_gc = events.last().unwrap().event_type() == RRTraceEventType::GCStart;
@@ -248,10 +469,23 @@ impl FastTrace {
     }
 }
 
+/// Set on stack entries that are annotation spans rather than method calls.
+/// Spans share the call stack so they are carried across batches the same
+/// way, but are drawn in their own lane and only closed by span ends.
+const ANNOTATION: u64 = 1 << 63;
+
 #[derive(Debug, Clone)]
 struct CallStackEntry {
     vertex_index: usize,
     method_id: u64,
+    start_time: u64,
+    depth: u32,
+}
+
+impl CallStackEntry {
+    fn is_annotation(&self) -> bool {
+        self.method_id & ANNOTATION != 0
+    }
 }
 
 #[derive(Debug, Clone)]
@@ -259,26 +493,39 @@ struct ThreadTraceState {
     thread_id: u32,
     stack: Vec<CallStackEntry>,
     call_boxes: Vec<CallBox>,
+    annotation_boxes: Vec<CallBox>,
+    marks: Vec<Mark>,
+    completed_calls: Vec<CompletedCall>,
+    context: u32,
+    /// Start time and call count of the open context period.
+    period: Option<(u64, u32)>,
+    context_periods: Vec<ContextPeriod>,
     thread_line: ThreadLine,
+    /// Index of the last box of completed leaf calls that the next identical
+    /// sibling can be coalesced into.
+    run: Option<usize>,
 }
 
 impl ThreadTraceState {
     fn from_stack(thread_id: u32, stack: &StackState, start_time: u64, end_time: u64) -> Self {
+        let mut depths = [0; 2];
         Self {
-            thread_id,
             stack: stack
                 .stack
                 .iter()
-                .map(|&method_id| CallStackEntry {
-                    method_id,
-                    vertex_index: usize::MAX,
+                .map(|&(method_id, start_time)| {
+                    let depth = &mut depths[(method_id & ANNOTATION != 0) as usize];
+                    *depth += 1;
+                    CallStackEntry {
+                        method_id,
+                        start_time,
+                        depth: *depth - 1,
+                        vertex_index: usize::MAX,
+                    }
                 })
                 .collect(),
-            call_boxes: Vec::new(),
-            thread_line: ThreadLine {
-                start_time: encode_time(start_time),
-                end_time: encode_time(end_time),
-            },
+            context: stack.context.unwrap_or(0),
+            ..Self::new(thread_id, start_time, end_time)
         }
     }
 
@@ -287,17 +534,186 @@ impl ThreadTraceState {
             thread_id,
             stack: Vec::new(),
             call_boxes: Vec::new(),
+            annotation_boxes: Vec::new(),
+            marks: Vec::new(),
+            completed_calls: Vec::new(),
+            context: 0,
+            period: None,
+            context_periods: Vec::new(),
             thread_line: ThreadLine {
                 start_time: encode_time(start_time),
                 end_time: encode_time(end_time),
             },
+            run: None,
+        }
+    }
+
+    fn push(&mut self, method_id: u64, time: u64, end_time: u64, max_depth: &mut u32) {
+        let annotation = method_id & ANNOTATION != 0;
+        let depth = self
+            .stack
+            .iter()
+            .rev()
+            .find(|entry| entry.is_annotation() == annotation)
+            .map_or(0, |entry| entry.depth + 1);
+        let boxes = if annotation {
+            &mut self.annotation_boxes
+        } else {
+            *max_depth = (*max_depth).max(depth);
+            if let Some((_, calls)) = &mut self.period {
+                *calls += 1;
+            }
+            &mut self.call_boxes
+        };
+        self.stack.push(CallStackEntry {
+            vertex_index: boxes.len(),
+            method_id,
+            start_time: time,
+            depth,
+        });
+        boxes.push(CallBox::new(
+            time,
+            end_time,
+            method_id as u32,
+            depth,
+            self.context,
+        ));
+    }
+
+    /// Closes the frames of the same kind as `method_id` down to its frame,
+    /// or all of them when it is not on the stack, like `StackState::ret`.
+    fn pop(&mut self, method_id: u64, time: u64, coalesce_runs: bool) {
+        let annotation = method_id & ANNOTATION != 0;
+        let start = self
+            .stack
+            .iter()
+            .rposition(|entry| entry.method_id == method_id)
+            .unwrap_or(0);
+        for index in (start..self.stack.len()).rev() {
+            if self.stack[index].is_annotation() != annotation {
+                continue;
+            }
+            let entry = self.stack.remove(index);
+            if annotation {
+                self.annotation_boxes[entry.vertex_index].end_time = encode_time(time);
+            } else {
+                self.call_boxes[entry.vertex_index].end_time = encode_time(time);
+                self.completed_calls.push(CompletedCall {
+                    method_id: entry.method_id as u32,
+                    start_time: entry.start_time,
+                    end_time: time,
+                });
+                if coalesce_runs {
+                    self.coalesce(&entry, time);
+                }
+            }
+        }
+    }
+
+    /// Merges the box of a call that just returned into the box before it,
+    /// when both are calls to the same method at the same depth and context
+    /// without children in between. Boxes split by GC, thread switches or
+    /// context changes never start or join a run.
+    fn coalesce(&mut self, entry: &CallStackEntry, time: u64) {
+        let index = entry.vertex_index;
+        if self.call_boxes.len().checked_sub(1) != Some(index)
+            || self.call_boxes[index].start_time_ns() != entry.start_time
+        {
+            self.run = None;
+            return;
+        }
+        let duration = u32::try_from(time - entry.start_time).unwrap_or(u32::MAX);
+        let call_box = self.call_boxes[index];
+        let Some(run) = self.run.filter(|&run| {
+            let run_box = &self.call_boxes[run];
+            run + 1 == index
+                && (run_box.method_id, run_box.depth, run_box.context)
+                    == (call_box.method_id, call_box.depth, call_box.context)
+        }) else {
+            self.run = Some(index);
+            return;
+        };
+        let run_box = &mut self.call_boxes[run];
+        if run_box.count == 1 {
+            run_box.busy_time =
+                u32::try_from(run_box.end_time_ns() - run_box.start_time_ns()).unwrap_or(u32::MAX);
         }
+        run_box.end_time = call_box.end_time;
+        run_box.count += 1;
+        run_box.busy_time = run_box.busy_time.saturating_add(duration);
+        self.call_boxes.pop();
+    }
+
+    /// Starts a new box for every frame on the stack, when the thread starts
+    /// running again.
+    fn open_stack(&mut self, time: u64, end_time: u64, max_depth: &mut u32) {
+        for entry in &mut self.stack {
+            let boxes = if entry.is_annotation() {
+                &mut self.annotation_boxes
+            } else {
+                *max_depth = (*max_depth).max(entry.depth);
+                &mut self.call_boxes
+            };
+            entry.vertex_index = boxes.len();
+            boxes.push(CallBox::new(
+                time,
+                end_time,
+                entry.method_id as u32,
+                entry.depth,
+                self.context,
+            ));
+        }
+    }
+
+    /// Ends the boxes of every frame on the stack, when the thread stops
+    /// running.
+    fn close_stack(&mut self, time: u64) {
+        for entry in &mut self.stack {
+            let boxes = if entry.is_annotation() {
+                &mut self.annotation_boxes
+            } else {
+                &mut self.call_boxes
+            };
+            boxes[entry.vertex_index].end_time = encode_time(time);
+            entry.vertex_index = usize::MAX;
+        }
+    }
+
+    fn begin_period(&mut self, time: u64) {
+        if self.context != 0 {
+            self.period = Some((time, 0));
+        }
+    }
+
+    fn end_period(&mut self, time: u64) {
+        if let Some((start_time, calls)) = self.period.take() {
+            self.context_periods.push(ContextPeriod {
+                context: self.context,
+                start_time,
+                end_time: time,
+                calls,
+            });
+        }
+    }
+
+    /// Splits the open boxes so that every box belongs to one context.
+    fn set_context(&mut self, context: u32, time: u64, end_time: u64, max_depth: &mut u32) {
+        self.close_stack(time);
+        self.end_period(time);
+        self.context = context;
+        self.open_stack(time, end_time, max_depth);
+        self.begin_period(time);
     }
 
     fn into_thread_data(self) -> ThreadData {
         ThreadData {
             thread_id: self.thread_id,
+            lod_boxes: lod::build(&self.call_boxes),
             call_boxes: self.call_boxes,
+            annotation_boxes: self.annotation_boxes,
+            marks: self.marks,
+            completed_calls: self.completed_calls,
+            context_periods: self.context_periods,
             thread_line: self.thread_line,
         }
     }
@@ -330,10 +746,18 @@ pub struct SlowTrace {
     max_depth: u32,
     end_time: u64,
     gc_events: Vec<u64>,
+    counters: Vec<CounterSample>,
 }
 
 impl SlowTrace {
-    pub fn trace(start_time: u64, fast_trace: &FastTrace, events: &[RRTraceEvent]) -> SlowTrace {
+    /// Builds the boxes of a batch. With `coalesce_runs`, consecutive
+    /// identical sibling calls without children share one box.
+    pub fn trace(
+        start_time: u64,
+        fast_trace: &FastTrace,
+        events: &[RRTraceEvent],
+        coalesce_runs: bool,
+    ) -> SlowTrace {
         let end_time = events.last().unwrap().timestamp();
         let mut max_depth = 0;
         let &FastTrace {
@@ -348,6 +772,7 @@ impl SlowTrace {
             ThreadId::Id(id) => id,
         };
         let mut gc_events = Vec::new();
+        let mut counters = Vec::new();
         let mut call_stack = thread_stacks
             .iter()
             .map(|(&thread_id, stack)| {
@@ -355,134 +780,94 @@ impl SlowTrace {
             })
             .collect::<Vec<_>>();
         call_stack.sort_unstable_by_key(|state| state.thread_id);
-        if !in_gc && let Ok(index) = find_thread_index(&call_stack, current_thread) {
-            let ThreadTraceState {
-                stack, call_boxes, ..
-            } = &mut call_stack[index];
-            call_boxes.reserve(stack.len());
-            for (depth, entry) in stack.iter_mut().enumerate() {
-                entry.vertex_index = call_boxes.len();
-                let depth = depth as u32;
-                max_depth = max_depth.max(depth);
-                call_boxes.push(CallBox {
-                    start_time: encode_time(start_time),
-                    end_time: encode_time(end_time),
-                    method_id: entry.method_id as u32,
-                    depth,
-                });
+        if let Ok(index) = find_thread_index(&call_stack, current_thread) {
+            let state = &mut call_stack[index];
+            if !in_gc {
+                state.call_boxes.reserve(state.stack.len());
+                state.open_stack(start_time, end_time, &mut max_depth);
             }
+            state.begin_period(start_time);
         }
         let mut current_thread_id = (current_thread != u32::MAX).then_some(current_thread);
         for event in events {
+            let current_index = current_thread_id
+                .and_then(|thread_id| find_thread_index(&call_stack, thread_id).ok());
             match event.event_type() {
                 RRTraceEventType::Call => {
-                    if let Some(index) = current_thread_id
-                        .and_then(|thread_id| find_thread_index(&call_stack, thread_id).ok())
-                    {
-                        let ThreadTraceState {
-                            stack: current_stack,
-                            call_boxes: current_vertices,
-                            ..
-                        } = &mut call_stack[index];
-                        let vertex_index = current_vertices.len();
-                        let depth = current_stack.len() as u32;
-                        current_stack.push(CallStackEntry {
-                            vertex_index,
-                            method_id: event.data(),
-                        });
-                        current_vertices.push(CallBox {
-                            start_time: encode_time(event.timestamp()),
-                            end_time: encode_time(end_time),
-                            method_id: event.data() as u32,
-                            depth,
-                        });
-                        max_depth = max_depth.max(depth);
+                    if let Some(index) = current_index {
+                        call_stack[index].push(
+                            event.data(),
+                            event.timestamp(),
+                            end_time,
+                            &mut max_depth,
+                        );
                     }
                 }
                 RRTraceEventType::Return => {
-                    if let Some(index) = current_thread_id
-                        .and_then(|thread_id| find_thread_index(&call_stack, thread_id).ok())
-                    {
-                        let ThreadTraceState {
-                            stack: current_stack,
-                            call_boxes: current_vertices,
-                            ..
-                        } = &mut call_stack[index];
-                        while let Some(CallStackEntry {
-                            vertex_index,
-                            method_id,
-                        }) = current_stack.pop()
-                        {
-                            current_vertices[vertex_index].end_time =
-                                encode_time(event.timestamp());
-                            if method_id == event.data() {
-                                break;
-                            }
-                        }
+                    if let Some(index) = current_index {
+                        call_stack[index].pop(event.data(), event.timestamp(), coalesce_runs);
                     }
                 }
+                RRTraceEventType::SpanBegin => {
+                    if let Some(index) = current_index {
+                        call_stack[index].push(
+                            event.data() | ANNOTATION,
+                            event.timestamp(),
+                            end_time,
+                            &mut max_depth,
+                        );
+                    }
+                }
+                RRTraceEventType::SpanEnd => {
+                    if let Some(index) = current_index {
+                        call_stack[index].pop(
+                            event.data() | ANNOTATION,
+                            event.timestamp(),
+                            coalesce_runs,
+                        );
+                    }
+                }
+                RRTraceEventType::Mark => {
+                    if let Some(index) = current_index {
+                        call_stack[index].marks.push(Mark {
+                            name_key: event.data() as u32,
+                            time: event.timestamp(),
+                        });
+                    }
+                }
+                RRTraceEventType::Context => {
+                    if let Some(index) = current_index {
+                        call_stack[index].set_context(
+                            event.data() as u32,
+                            event.timestamp(),
+                            end_time,
+                            &mut max_depth,
+                        );
+                    }
+                }
+                RRTraceEventType::Counter => {
+                    counters.push(CounterSample {
+                        name_key: (event.data() >> 32) as u32,
+                        time: event.timestamp(),
+                        value: f32::from_bits(event.data() as u32),
+                    });
+                }
                 RRTraceEventType::GCStart => {
                     gc_events.push(event.timestamp());
-                    if let Some(index) = current_thread_id
-                        .and_then(|thread_id| find_thread_index(&call_stack, thread_id).ok())
-                    {
-                        let ThreadTraceState {
-                            stack: current_stack,
-                            call_boxes: current_vertices,
-                            ..
-                        } = &mut call_stack[index];
-                        for CallStackEntry { vertex_index, .. } in current_stack.iter_mut() {
-                            current_vertices[*vertex_index].end_time =
-                                encode_time(event.timestamp());
-                            *vertex_index = usize::MAX;
-                        }
+                    if let Some(index) = current_index {
+                        call_stack[index].close_stack(event.timestamp());
                     }
                 }
                 RRTraceEventType::GCEnd => {
                     gc_events.push(event.timestamp());
-                    if let Some(index) = current_thread_id
-                        .and_then(|thread_id| find_thread_index(&call_stack, thread_id).ok())
-                    {
-                        let ThreadTraceState {
-                            stack: current_stack,
-                            call_boxes: current_vertices,
-                            ..
-                        } = &mut call_stack[index];
-                        for (
-                            depth,
-                            &mut CallStackEntry {
-                                ref mut vertex_index,
-                                method_id,
-                            },
-                        ) in current_stack.iter_mut().enumerate()
-                        {
-                            let new_index = current_vertices.len();
-                            let depth = depth as u32;
-                            current_vertices.push(CallBox {
-                                start_time: encode_time(event.timestamp()),
-                                end_time: encode_time(end_time),
-                                method_id: method_id as u32,
-                                depth,
-                            });
-                            max_depth = max_depth.max(depth);
-                            *vertex_index = new_index;
-                        }
+                    if let Some(index) = current_index {
+                        call_stack[index].open_stack(event.timestamp(), end_time, &mut max_depth);
                     }
                 }
                 RRTraceEventType::ThreadSuspended => {
-                    if let Some(index) = current_thread_id
-                        .and_then(|thread_id| find_thread_index(&call_stack, thread_id).ok())
-                    {
-                        let ThreadTraceState {
-                            stack: current_stack,
-                            call_boxes: current_vertices,
-                            ..
-                        } = &mut call_stack[index];
-                        for CallStackEntry { vertex_index, .. } in current_stack.iter_mut() {
-                            current_vertices[*vertex_index].end_time =
-                                encode_time(event.timestamp());
-                            *vertex_index = usize::MAX;
-                        }
+                    if let Some(index) = current_index {
+                        call_stack[index].close_stack(event.timestamp());
+                        call_stack[index].end_period(event.timestamp());
                     }
                     current_thread_id = None;
                 }
@@ -494,32 +879,8 @@ impl SlowTrace {
                         start_time,
                         end_time,
                     );
-                    let ThreadTraceState {
-                        stack: new_stack,
-                        call_boxes: new_vertices,
-                        ..
-                    } = &mut call_stack[index];
-
-                    for (
-                        depth,
-                        &mut CallStackEntry {
-                            ref mut vertex_index,
-                            method_id,
-                        },
-                    ) in new_stack.iter_mut().enumerate()
-                    {
-                        let new_index = new_vertices.len();
-                        let depth = depth as u32;
-                        new_vertices.push(CallBox {
-                            start_time: encode_time(event.timestamp()),
-                            end_time: encode_time(end_time),
-                            method_id: method_id as u32,
-                            depth,
-                        });
-                        max_depth = max_depth.max(depth);
-                        *vertex_index = new_index;
-                    }
-
+                    call_stack[index].open_stack(event.timestamp(), end_time, &mut max_depth);
+                    call_stack[index].begin_period(event.timestamp());
                     current_thread_id = Some(thread_id);
                 }
                 RRTraceEventType::ThreadStart => {
@@ -543,17 +904,19 @@ impl SlowTrace {
                     let thread_state = &mut call_stack[index];
                     thread_state.thread_line.end_time = encode_time(event.timestamp());
                     if current_thread_id == Some(thread_id) {
-                        for CallStackEntry { vertex_index, .. } in thread_state.stack.iter_mut() {
-                            thread_state.call_boxes[*vertex_index].end_time =
-                                encode_time(event.timestamp());
-                            *vertex_index = usize::MAX;
-                        }
+                        thread_state.close_stack(event.timestamp());
+                        thread_state.end_period(event.timestamp());
                         current_thread_id = None;
                     }
                 }
                 RRTraceEventType::ThreadReady => {}
             }
         }
+        if let Some(thread_id) = current_thread_id
+            && let Ok(index) = find_thread_index(&call_stack, thread_id)
+        {
+            call_stack[index].end_period(end_time);
+        }
         SlowTrace {
             data: call_stack
                 .into_iter()
@@ -562,6 +925,7 @@ impl SlowTrace {
             max_depth,
             end_time,
             gc_events,
+            counters,
         }
     }
 
@@ -573,6 +937,10 @@ impl SlowTrace {
         &self.gc_events
     }
 
+    pub fn counters(&self) -> &[CounterSample] {
+        &self.counters
+    }
+
     pub fn end_time(&self) -> u64 {
         self.end_time
     }
@@ -586,21 +954,6 @@ impl SlowTrace {
 mod tests {
     use super::*;
 
-    fn event(event_type: RRTraceEventType, timestamp: u64, data: u64) -> RRTraceEvent {
-        let event_bits = match event_type {
-            RRTraceEventType::Call => 0x0000000000000000,
-            RRTraceEventType::Return => 0x1000000000000000,
-            RRTraceEventType::GCStart => 0x2000000000000000,
-            RRTraceEventType::GCEnd => 0x3000000000000000,
-            RRTraceEventType::ThreadStart => 0x4000000000000000,
-            RRTraceEventType::ThreadReady => 0x5000000000000000,
-            RRTraceEventType::ThreadSuspended => 0x6000000000000000,
-            RRTraceEventType::ThreadResume => 0x7000000000000000,
-            RRTraceEventType::ThreadExit => 0x8000000000000000,
-        };
-        unsafe { mem::transmute([timestamp | event_bits, data]) }
-    }
-
     #[test]
     fn slow_trace_uses_thread_id_instead_of_vector_index() {
         let fast_trace = FastTrace {
@@ -610,7 +963,12 @@ mod tests {
             in_gc: false,
         };
 
-        let trace = SlowTrace::trace(0, &fast_trace, &[event(RRTraceEventType::Call, 10, 42)]);
+        let trace = SlowTrace::trace(
+            0,
+            &fast_trace,
+            &[RRTraceEvent::new(RRTraceEventType::Call, 10, 42)],
+            true,
+        );
         let thread_data = trace
             .data()
             .iter()
@@ -634,9 +992,10 @@ mod tests {
             0,
             &fast_trace,
             &[
-                event(RRTraceEventType::ThreadStart, 5, 1),
-                event(RRTraceEventType::Call, 10, 42),
+                RRTraceEvent::new(RRTraceEventType::ThreadStart, 5, 1),
+                RRTraceEvent::new(RRTraceEventType::Call, 10, 42),
             ],
+            true,
         );
         let main_thread = trace
             .data()
@@ -653,4 +1012,390 @@ mod tests {
         assert_eq!(main_thread.call_boxes()[0].method_id, 42);
         assert!(child_thread.call_boxes().is_empty());
     }
+
+    #[test]
+    fn spans_are_drawn_in_their_own_lane() {
+        let fast_trace = FastTrace {
+            thread_stacks: HashMap::from([(0, StackState::new())]),
+            initial_thread_stack: StackState::new(),
+            current_thread: ThreadId::Id(0),
+            in_gc: false,
+        };
+
+        let trace = SlowTrace::trace(
+            0,
+            &fast_trace,
+            &[
+                RRTraceEvent::new(RRTraceEventType::Call, 10, 42),
+                RRTraceEvent::new(RRTraceEventType::SpanBegin, 11, 3),
+                RRTraceEvent::new(RRTraceEventType::Call, 12, 43),
+                RRTraceEvent::new(RRTraceEventType::Mark, 13, 4),
+                RRTraceEvent::new(RRTraceEventType::Return, 14, 43),
+                RRTraceEvent::new(RRTraceEventType::SpanEnd, 15, 3),
+                RRTraceEvent::new(RRTraceEventType::Return, 16, 42),
+            ],
+            true,
+        );
+        let thread_data = &trace.data()[0];
+
+        let depths = thread_data
+            .call_boxes()
+            .iter()
+            .map(|call_box| (call_box.method_id, call_box.depth))
+            .collect::<Vec<_>>();
+        assert_eq!(depths, [(42, 0), (43, 1)]);
+        let span = thread_data.annotation_boxes()[0];
+        assert_eq!((span.method_id, span.depth), (3, 0));
+        assert_eq!((span.start_time_ns(), span.end_time_ns()), (11, 15));
+        assert_eq!(
+            thread_data.marks(),
+            &[Mark {
+                name_key: 4,
+                time: 13
+            }]
+        );
+        assert_eq!(thread_data.completed_calls().len(), 2);
+    }
+
+    #[test]
+    fn method_returns_leave_spans_open() {
+        // Spans are begun and ended from C methods, whose returns come right
+        // after the span events.
+        let mut previous = FastTrace::from_events(&[
+            RRTraceEvent::new(RRTraceEventType::Call, 5, 42),
+            RRTraceEvent::new(RRTraceEventType::Call, 6, 50),
+            RRTraceEvent::new(RRTraceEventType::SpanBegin, 7, 3),
+            RRTraceEvent::new(RRTraceEventType::Return, 8, 50),
+        ]);
+        previous.mark_as_first();
+        assert_eq!(
+            previous.thread_stacks[&0].stack.as_slice(),
+            &[(42, 5), (3 | ANNOTATION, 7)]
+        );
+
+        let trace = SlowTrace::trace(
+            10,
+            &previous,
+            &[
+                RRTraceEvent::new(RRTraceEventType::Call, 12, 43),
+                RRTraceEvent::new(RRTraceEventType::Return, 13, 43),
+                RRTraceEvent::new(RRTraceEventType::Call, 14, 51),
+                RRTraceEvent::new(RRTraceEventType::SpanEnd, 15, 3),
+                RRTraceEvent::new(RRTraceEventType::Return, 16, 51),
+                RRTraceEvent::new(RRTraceEventType::Return, 20, 42),
+            ],
+            true,
+        );
+        let thread_data = &trace.data()[0];
+
+        let boxes = thread_data
+            .call_boxes()
+            .iter()
+            .map(|b| (b.method_id, b.depth, b.start_time_ns(), b.end_time_ns()))
+            .collect::<Vec<_>>();
+        assert_eq!(boxes, [(42, 0, 10, 20), (43, 1, 12, 13), (51, 1, 14, 16)]);
+        let span = thread_data.annotation_boxes()[0];
+        assert_eq!((span.method_id, span.depth), (3, 0));
+        assert_eq!((span.start_time_ns(), span.end_time_ns()), (10, 15));
+        assert_eq!(thread_data.completed_calls().len(), 3);
+    }
+
+    #[test]
+    fn notification_spans_outlive_the_subscriber_frames() {
+        // Rrtrace::Notifications::Subscriber#start and #finish, each calling
+        // Rrtrace.span_begin or span_end and then the C method.
+        let fast_trace = FastTrace {
+            thread_stacks: HashMap::from([(0, StackState::new())]),
+            initial_thread_stack: StackState::new(),
+            current_thread: ThreadId::Id(0),
+            in_gc: false,
+        };
+        let frames =
+            |methods: [u64; 3], start: u64, span_event, end: u64| {
+                let mut events = methods
+                    .iter()
+                    .enumerate()
+                    .map(|(i, &m)| RRTraceEvent::new(RRTraceEventType::Call, start + i as u64, m))
+                    .collect::<Vec<_>>();
+                events.push(RRTraceEvent::new(span_event, start + 3, 5));
+                events.extend(
+                    methods.iter().rev().enumerate().map(|(i, &m)| {
+                        RRTraceEvent::new(RRTraceEventType::Return, end + i as u64, m)
+                    }),
+                );
+                events
+            };
+        let mut events = vec![RRTraceEvent::new(RRTraceEventType::Call, 10, 60)];
+        events.extend(frames([61, 62, 63], 11, RRTraceEventType::SpanBegin, 15));
+        events.push(RRTraceEvent::new(RRTraceEventType::Call, 20, 43));
+        events.push(RRTraceEvent::new(RRTraceEventType::Return, 30, 43));
+        events.extend(frames([64, 65, 66], 31, RRTraceEventType::SpanEnd, 35));
+        events.push(RRTraceEvent::new(RRTraceEventType::Return, 40, 60));
+
+        let trace = SlowTrace::trace(0, &fast_trace, &events, true);
+        let thread_data = &trace.data()[0];
+
+        let span = thread_data.annotation_boxes()[0];
+        assert_eq!((span.start_time_ns(), span.end_time_ns()), (14, 34));
+        let work = thread_data
+            .call_boxes()
+            .iter()
+            .find(|b| b.method_id == 43)
+            .unwrap();
+        assert_eq!(
+            (work.depth, work.start_time_ns(), work.end_time_ns()),
+            (1, 20, 30)
+        );
+        let instrument = thread_data.call_boxes()[0];
+        assert_eq!((instrument.method_id, instrument.end_time_ns()), (60, 40));
+        assert_eq!(thread_data.completed_calls().len(), 8);
+    }
+
+    #[test]
+    fn nested_require_spans_outlive_the_measure_frames() {
+        // Kernel#require calls Rrtrace::Boot.measure, which calls
+        // Rrtrace.span_begin and then the original require, inside which
+        // the loaded file requires another one.
+        let fast_trace = FastTrace {
+            thread_stacks: HashMap::from([(0, StackState::new())]),
+            initial_thread_stack: StackState::new(),
+            current_thread: ThreadId::Id(0),
+            in_gc: false,
+        };
+        let begin = |events: &mut Vec<RRTraceEvent>, time: u64, key: u64| {
+            for (i, method) in [70, 71, 72, 73].into_iter().enumerate() {
+                events.push(RRTraceEvent::new(
+                    RRTraceEventType::Call,
+                    time + i as u64,
+                    method,
+                ));
+            }
+            events.push(RRTraceEvent::new(
+                RRTraceEventType::SpanBegin,
+                time + 4,
+                key,
+            ));
+            events.push(RRTraceEvent::new(RRTraceEventType::Return, time + 5, 73));
+            events.push(RRTraceEvent::new(RRTraceEventType::Return, time + 6, 72));
+            events.push(RRTraceEvent::new(RRTraceEventType::Call, time + 7, 74));
+        };
+        let end = |events: &mut Vec<RRTraceEvent>, time: u64, key: u64| {
+            events.push(RRTraceEvent::new(RRTraceEventType::Return, time, 74));
+            events.push(RRTraceEvent::new(RRTraceEventType::Call, time + 1, 75));
+            events.push(RRTraceEvent::new(RRTraceEventType::Call, time + 2, 76));
+            events.push(RRTraceEvent::new(RRTraceEventType::SpanEnd, time + 3, key));
+            for (i, method) in [76, 75, 71, 70].into_iter().enumerate() {
+                events.push(RRTraceEvent::new(
+                    RRTraceEventType::Return,
+                    time + 4 + i as u64,
+                    method,
+                ));
+            }
+        };
+        let mut events = Vec::new();
+        begin(&mut events, 10, 5);
+        begin(&mut events, 20, 6);
+        events.push(RRTraceEvent::new(RRTraceEventType::Call, 30, 43));
+        events.push(RRTraceEvent::new(RRTraceEventType::Return, 35, 43));
+        end(&mut events, 40, 6);
+        end(&mut events, 50, 5);
+
+        let trace = SlowTrace::trace(0, &fast_trace, &events, true);
+        let thread_data = &trace.data()[0];
+
+        let spans = thread_data
+            .annotation_boxes()
+            .iter()
+            .map(|span| (span.depth, span.start_time_ns(), span.end_time_ns()))
+            .collect::<Vec<_>>();
+        assert_eq!(spans, [(0, 14, 53), (1, 24, 43)]);
+        let work = thread_data
+            .call_boxes()
+            .iter()
+            .find(|b| b.method_id == 43)
+            .unwrap();
+        assert_eq!(
+            (work.depth, work.start_time_ns(), work.end_time_ns()),
+            (6, 30, 35)
+        );
+        assert_eq!(thread_data.completed_calls().len(), 15);
+    }
+
+    #[test]
+    fn per_test_spans_outlive_the_profiler_frames() {
+        // Rrtrace::TestProfiler#measure in selective mode: inside
+        // Rrtrace.trace, Rrtrace.span wraps Rrtrace.self_time, which wraps
+        // the test. The frames entered before the block are not recorded.
+        let fast_trace = FastTrace {
+            thread_stacks: HashMap::from([(0, StackState::new())]),
+            initial_thread_stack: StackState::new(),
+            current_thread: ThreadId::Id(0),
+            in_gc: false,
+        };
+        let test = |events: &mut Vec<RRTraceEvent>, time: u64, key: u64| {
+            events.extend([
+                RRTraceEvent::new(RRTraceEventType::Call, time, 80),
+                RRTraceEvent::new(RRTraceEventType::Call, time + 1, 81),
+                RRTraceEvent::new(RRTraceEventType::SpanBegin, time + 2, key),
+                RRTraceEvent::new(RRTraceEventType::Return, time + 3, 81),
+                RRTraceEvent::new(RRTraceEventType::Call, time + 4, 82),
+                RRTraceEvent::new(RRTraceEventType::Call, time + 5, 83),
+                RRTraceEvent::new(RRTraceEventType::Return, time + 6, 83),
+                RRTraceEvent::new(RRTraceEventType::Call, time + 10, 43),
+                RRTraceEvent::new(RRTraceEventType::Return, time + 20, 43),
+                RRTraceEvent::new(RRTraceEventType::Call, time + 21, 84),
+                RRTraceEvent::new(RRTraceEventType::Return, time + 22, 84),
+                RRTraceEvent::new(RRTraceEventType::Return, time + 23, 82),
+                RRTraceEvent::new(RRTraceEventType::Call, time + 24, 85),
+                RRTraceEvent::new(RRTraceEventType::SpanEnd, time + 25, key),
+                RRTraceEvent::new(RRTraceEventType::Return, time + 26, 85),
+                RRTraceEvent::new(RRTraceEventType::Return, time + 27, 80),
+                RRTraceEvent::new(RRTraceEventType::Call, time + 28, 86),
+                RRTraceEvent::new(RRTraceEventType::Return, time + 29, 86),
+            ]);
+        };
+        let mut events = Vec::new();
+        test(&mut events, 10, 5);
+        test(&mut events, 50, 6);
+
+        let trace = SlowTrace::trace(0, &fast_trace, &events, true);
+        let thread_data = &trace.data()[0];
+
+        let spans = thread_data
+            .annotation_boxes()
+            .iter()
+            .map(|span| (span.depth, span.start_time_ns(), span.end_time_ns()))
+            .collect::<Vec<_>>();
+        assert_eq!(spans, [(0, 12, 35), (0, 52, 75)]);
+        let tests = thread_data
+            .call_boxes()
+            .iter()
+            .filter(|b| b.method_id == 43)
+            .map(|b| (b.depth, b.start_time_ns(), b.end_time_ns()))
+            .collect::<Vec<_>>();
+        assert_eq!(tests, [(2, 20, 30), (2, 60, 70)]);
+        assert_eq!(thread_data.completed_calls().len(), 16);
+    }
+
+    #[test]
+    fn completed_calls_keep_the_original_call_time() {
+        let mut previous =
+            FastTrace::from_events(&[RRTraceEvent::new(RRTraceEventType::Call, 5, 42)]);
+        previous.mark_as_first();
+
+        let trace = SlowTrace::trace(
+            10,
+            &previous,
+            &[
+                RRTraceEvent::new(RRTraceEventType::GCStart, 12, 0),
+                RRTraceEvent::new(RRTraceEventType::GCEnd, 15, 0),
+                RRTraceEvent::new(RRTraceEventType::Return, 40, 42),
+            ],
+            true,
+        );
+        let calls = trace.data()[0].completed_calls();
+
+        assert_eq!(trace.data()[0].call_boxes().len(), 2);
+        assert_eq!(
+            calls,
+            &[CompletedCall {
+                method_id: 42,
+                start_time: 5,
+                end_time: 40,
+            }]
+        );
+    }
+
+    #[test]
+    fn context_changes_split_boxes_and_carry_across_batches() {
+        let mut previous = FastTrace::from_events(&[
+            RRTraceEvent::new(RRTraceEventType::Call, 5, 42),
+            RRTraceEvent::new(RRTraceEventType::Context, 6, 7),
+        ]);
+        previous.mark_as_first();
+
+        let trace = SlowTrace::trace(
+            10,
+            &previous,
+            &[
+                RRTraceEvent::new(RRTraceEventType::Call, 12, 43),
+                RRTraceEvent::new(RRTraceEventType::Return, 13, 43),
+                RRTraceEvent::new(RRTraceEventType::Context, 20, 0),
+                RRTraceEvent::new(RRTraceEventType::Return, 30, 42),
+            ],
+            true,
+        );
+        let thread_data = &trace.data()[0];
+
+        let boxes = thread_data
+            .call_boxes()
+            .iter()
+            .map(|b| (b.method_id, b.start_time_ns(), b.end_time_ns(), b.context))
+            .collect::<Vec<_>>();
+        assert_eq!(boxes, [(42, 10, 20, 7), (43, 12, 13, 7), (42, 20, 30, 0)]);
+        assert_eq!(
+            thread_data.context_periods(),
+            &[ContextPeriod {
+                context: 7,
+                start_time: 10,
+                end_time: 20,
+                calls: 1,
+            }]
+        );
+    }
+
+    #[test]
+    fn runs_of_identical_leaf_calls_share_one_box() {
+        let fast_trace = FastTrace {
+            thread_stacks: HashMap::from([(0, StackState::new())]),
+            initial_thread_stack: StackState::new(),
+            current_thread: ThreadId::Id(0),
+            in_gc: false,
+        };
+        let events = [
+            RRTraceEvent::new(RRTraceEventType::Call, 10, 1),
+            RRTraceEvent::new(RRTraceEventType::Call, 11, 2),
+            RRTraceEvent::new(RRTraceEventType::Return, 13, 2),
+            RRTraceEvent::new(RRTraceEventType::Call, 14, 2),
+            RRTraceEvent::new(RRTraceEventType::Return, 15, 2),
+            RRTraceEvent::new(RRTraceEventType::Call, 17, 2),
+            RRTraceEvent::new(RRTraceEventType::Return, 20, 2),
+            // A call with a child ends the run.
+            RRTraceEvent::new(RRTraceEventType::Call, 21, 2),
+            RRTraceEvent::new(RRTraceEventType::Call, 22, 3),
+            RRTraceEvent::new(RRTraceEventType::Return, 23, 3),
+            RRTraceEvent::new(RRTraceEventType::Return, 24, 2),
+            RRTraceEvent::new(RRTraceEventType::Return, 30, 1),
+        ];
+
+        let trace = SlowTrace::trace(0, &fast_trace, &events, true);
+        let thread_data = &trace.data()[0];
+
+        let boxes = thread_data
+            .call_boxes()
+            .iter()
+            .map(|b| {
+                (
+                    b.method_id,
+                    b.start_time_ns(),
+                    b.end_time_ns(),
+                    b.count,
+                    b.busy_time,
+                )
+            })
+            .collect::<Vec<_>>();
+        assert_eq!(
+            boxes,
+            [
+                (1, 10, 30, 1, 0),
+                (2, 11, 20, 3, 6),
+                (2, 21, 24, 1, 0),
+                (3, 22, 23, 1, 0),
+            ]
+        );
+        assert_eq!(thread_data.completed_calls().len(), 6);
+
+        let trace = SlowTrace::trace(0, &fast_trace, &events, false);
+        assert_eq!(trace.data()[0].call_boxes().len(), 6);
+    }
 }
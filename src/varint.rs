@@ -0,0 +1,40 @@
+/// LEB128 variable-length integers, used by the compressed in-memory stores.
+pub fn write(bytes: &mut Vec<u8>, mut value: u64) {
+    while value >= 0x80 {
+        bytes.push(value as u8 | 0x80);
+        value >>= 7;
+    }
+    bytes.push(value as u8);
+}
+
+pub fn read(bytes: &[u8], position: &mut usize) -> u64 {
+    let mut value = 0;
+    let mut shift = 0;
+    loop {
+        let byte = bytes[*position];
+        *position += 1;
+        value |= ((byte & 0x7f) as u64) << shift;
+        if byte & 0x80 == 0 {
+            return value;
+        }
+        shift += 7;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn round_trip() {
+        let mut bytes = Vec::new();
+        for value in [0, 1, 127, 128, 300, u64::MAX] {
+            write(&mut bytes, value);
+        }
+        let mut position = 0;
+        for value in [0, 1, 127, 128, 300, u64::MAX] {
+            assert_eq!(read(&bytes, &mut position), value);
+        }
+        assert_eq!(position, bytes.len());
+    }
+}